@@ -51,6 +51,9 @@ void CBytes::setBytes(const uint8_t *bytes, unsigned int len)
 	{
 		this->_CBytes.resize(len);
 		PA_MoveBlock((void *)bytes, (char *)&this->_CBytes[0], len);	
+	}else if(!len)
+	{
+		this->_CBytes.clear();//	setBytes(NULL, 0) empties the BLOB
 	}
 }
 
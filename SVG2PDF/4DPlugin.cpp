@@ -23,6 +23,88 @@ static cairo_status_t rsvg_cairo_write_func (void *data, const unsigned char *by
 	return CAIRO_STATUS_SUCCESS;
 }
 
+/* Same sizing rules as SVGL Convert: a zero width or height is derived
+   from the other, both zero means svg size times scale, both given
+   means fit and center. */
+static void get_output_size (double svg_width, double svg_height,
+														 int *width, int *height,
+														 double *scale, double *dx, double *dy)
+{
+	*dx = 0;
+	*dy = 0;
+	
+	if (*width <= 0 && *height <= 0) {
+		*width = (svg_width * *scale + 0.5);
+		*height = (svg_height * *scale + 0.5);
+	} else if (*width <= 0) {
+		*scale = (double) *height / (double) svg_height;
+		*width = (svg_width * *scale + 0.5);
+	} else if (*height <= 0) {
+		*scale = (double) *width / (double) svg_width;
+		*height = (svg_height * *scale + 0.5);
+	} else {
+		*scale = MIN ((double) *width / (double) svg_width, (double) *height / (double) svg_height);
+		/* Center the resulting image */
+		*dx = (*width - (int) (svg_width * *scale + 0.5)) / 2;
+		*dy = (*height - (int) (svg_height * *scale + 0.5)) / 2;
+	}
+}
+
+/* the fonts loaded by SVGL Load fonts, on a thread of their own: the
+   milliseconds it took for SVGL Get option, -1 while it runs */
+static std::thread svgl_fonts_thread;
+static std::mutex svgl_fonts_mutex;
+static double svgl_fonts_load_time = 0;
+
+static void join_fonts_thread ()
+{
+	if (svgl_fonts_thread.joinable())
+		svgl_fonts_thread.join();
+}
+
+/* set with SVGL SET OPTION, for every conversion that follows */
+static double svgl_detail_threshold = 0;
+static double svgl_simplify_tolerance = 0;
+static double svgl_image_resolution = 0;
+
+/* of the last document converted, for SVGL Get option */
+static double svgl_elided_state_count = 0;
+static double svgl_simplified_point_count = 0;
+
+static void get_statistics (svg_cairo_t *svgc)
+{
+	svgl_elided_state_count = svg_cairo_get_elided_state_count (svgc);
+	svgl_simplified_point_count = svg_cairo_get_simplified_point_count (svgc);
+}
+
+static void apply_options (svg_cairo_t *svgc)
+{
+	svg_cairo_set_detail_threshold (svgc, svgl_detail_threshold);
+	/* dpi, for an output whose unit (a point, a pixel) is 1/72 inch */
+	svg_cairo_set_image_resolution (svgc, svgl_image_resolution / 72);
+}
+
+/* Once parsed and sized: scale is output pixels per unit of the root's
+   content space. On failure the paths are left as they were. */
+static void simplify_paths (svg_cairo_t *svgc, double scale)
+{
+	if (svgl_simplify_tolerance > 0 && scale > 0)
+		svg_cairo_simplify_paths (svgc, svgl_simplify_tolerance / scale);
+}
+
+/* For an svg drawn once, at its own size, then replayed at several
+   scales: the options are met at the largest one, so that no output
+   has less detail than asked for. */
+static void apply_options_for_replay (svg_cairo_t *svgc, double max_scale)
+{
+	if (max_scale <= 0)
+		return;
+	
+	svg_cairo_set_detail_threshold (svgc, svgl_detail_threshold / max_scale);
+	svg_cairo_set_image_resolution (svgc, svgl_image_resolution / 72 * max_scale);
+	simplify_paths (svgc, max_scale * svg_cairo_get_content_scale (svgc));
+}
+
 #pragma mark -
 
 void PluginMain(PA_long32 selector, PA_PluginParameters params)
@@ -57,6 +139,55 @@ void CommandDispatcher (PA_long32 pProcNum, sLONG_PTR *pResult, PackagePtr pPara
 			SVGL_Convert(pResult, pParams);
 			break;
 
+// --- Compile
+
+		case 3 :
+			SVGL_Compile(pResult, pParams);
+			break;
+
+		case 4 :
+			SVGL_Convert_compiled(pResult, pParams);
+			break;
+
+// --- Convert Multiple
+
+		case 5 :
+			SVGL_Convert_multiple(pResult, pParams);
+			break;
+
+// --- Convert Region
+
+		case 6 :
+			SVGL_Convert_region(pResult, pParams);
+			break;
+
+// --- Convert Tiled
+
+		case 7 :
+			SVGL_Convert_tiled(pResult, pParams);
+			break;
+
+// --- Options
+
+		case 8 :
+			SVGL_SET_OPTION(pResult, pParams);
+			break;
+
+		case 9 :
+			SVGL_Get_option(pResult, pParams);
+			break;
+
+// --- Fonts
+
+		case 10 :
+			SVGL_Load_fonts(pResult, pParams);
+			break;
+
+		case kDeinitPlugin :
+		case kServerDeinitPlugin :
+			join_fonts_thread();
+			break;
+
 	}
 }
 
@@ -144,7 +275,7 @@ void SVGL_Convert_array(sLONG_PTR *pResult, PackagePtr pParams)
 								svg_cairo_status_t status;
 								svg_cairo_t *svgc;
 								
-								double dx = 0, dy = 0;
+								double dx, dy;
 								
 								double scale = 1;
 								if(Param5.getDoubleValue())
@@ -157,27 +288,17 @@ void SVGL_Convert_array(sLONG_PTR *pResult, PackagePtr pParams)
 								
 								if (!status) {
 									
+									apply_options (svgc);
+									
 									status = svg_cairo_parse_buffer (svgc, (const char *)p, PA_GetHandleSize(h));
 									
 									if (!status) {
 										
 										svg_cairo_get_size (svgc, &svg_width, &svg_height);
 										
-										if (width <= 0 && height <= 0) {
-											width = (svg_width * scale + 0.5);
-											height = (svg_height * scale + 0.5);
-										} else if (width <= 0) {
-											scale = (double) height / (double) svg_height;
-											width = (svg_width * scale + 0.5);
-										} else if (height <= 0) {
-											scale = (double) width / (double) svg_width;
-											height = (svg_height * scale + 0.5);
-										} else {
-											scale = MIN ((double) width / (double) svg_width, (double) height / (double) svg_height);
-											/* Center the resulting image */
-											dx = (width - (int) (svg_width * scale + 0.5)) / 2;
-											dy = (height - (int) (svg_height * scale + 0.5)) / 2;
-										}
+										get_output_size (svg_width, svg_height, &width, &height, &scale, &dx, &dy);
+										
+										simplify_paths (svgc, scale * svg_cairo_get_content_scale (svgc));
 										
 										surface = cairo_pdf_surface_create_for_stream (rsvg_cairo_write_func,
 																																	 (void *)&Param2,
@@ -195,6 +316,8 @@ void SVGL_Convert_array(sLONG_PTR *pResult, PackagePtr pParams)
 										
 									}else{returnValue.setIntValue(status);}
 									
+									get_statistics (svgc);
+									
 									svg_cairo_destroy (svgc);
 									
 								}else{returnValue.setIntValue(status);}
@@ -247,7 +370,7 @@ void SVGL_Convert(sLONG_PTR *pResult, PackagePtr pParams)
 		cairo_t *cr;
 		svg_cairo_t *svgc;
 		cairo_surface_t *surface;
-		double dx = 0, dy = 0;
+		double dx, dy;
 		
 		double scale = 1;
 		if(Param5.getDoubleValue())
@@ -260,28 +383,146 @@ void SVGL_Convert(sLONG_PTR *pResult, PackagePtr pParams)
 		
 		if (!status) {
 			
+			apply_options (svgc);
+			
 			status = svg_cairo_parse_buffer (svgc, (const char *)p, Param1.getBytesLength(&type));
 			
 			if (!status) {
 				
 				svg_cairo_get_size (svgc, &svg_width, &svg_height);
 				
-				if (width <= 0 && height <= 0) {
-					width = (svg_width * scale + 0.5);
-					height = (svg_height * scale + 0.5);
-				} else if (width <= 0) {
-					scale = (double) height / (double) svg_height;
-					width = (svg_width * scale + 0.5);
-				} else if (height <= 0) {
-					scale = (double) width / (double) svg_width;
-					height = (svg_height * scale + 0.5);
-				} else {
-					scale = MIN ((double) width / (double) svg_width, (double) height / (double) svg_height);
-					/* Center the resulting image */
-					dx = (width - (int) (svg_width * scale + 0.5)) / 2;
-					dy = (height - (int) (svg_height * scale + 0.5)) / 2;
+				get_output_size (svg_width, svg_height, &width, &height, &scale, &dx, &dy);
+				
+				simplify_paths (svgc, scale * svg_cairo_get_content_scale (svgc));
+				
+				surface = cairo_pdf_surface_create_for_stream (rsvg_cairo_write_func,
+																											 (void *)&Param2,
+																											 width,
+																											 height);
+				
+				cr = cairo_create (surface);
+				
+				cairo_translate (cr, dx, dy);
+				cairo_scale (cr, scale, scale);
+				
+				returnValue.setIntValue(svg_cairo_render (svgc, cr));
+				
+				cairo_show_page (cr);
+				cairo_destroy (cr);
+				cairo_surface_destroy (surface);
+				
+			}else{returnValue.setIntValue(status);}
+			
+			get_statistics (svgc);
+			
+			svg_cairo_destroy (svgc);
+			
+		}else{returnValue.setIntValue(status);}
+	}else{returnValue.setIntValue(-2);}
+	
+	Param2.toParamAtIndex(pParams, 2);
+	returnValue.setReturn(pResult);
+}
+
+// ------------------------------------ Compile -----------------------------------
+
+void SVGL_Compile(sLONG_PTR *pResult, PackagePtr pParams)
+{
+	C_PICTURE Param1;
+	C_BLOB Param2;
+	C_LONGINT returnValue;
+
+	Param1.fromParamAtIndex(pParams, 1);
+
+	CUTF8String type = CUTF8String((const uint8_t *)".svg", 4);
+	
+	const uint8_t *p = Param1.getBytesPtr(&type);
+	
+	if(p) {
+		
+		svg_cairo_status_t status;
+		svg_cairo_t *svgc;
+		
+		status = svg_cairo_create (&svgc);
+		
+		if (!status) {
+			
+			status = svg_cairo_parse_buffer (svgc, (const char *)p, Param1.getBytesLength(&type));
+			
+			if (!status) {
+				
+				void *data;
+				size_t size;
+				
+				status = svg_cairo_compile (svgc, &data, &size);
+				
+				if (!status) {
+					Param2.setBytes((const uint8_t *)data, (uint32_t)size);
+					free (data);
 				}
 				
+			}
+			
+			returnValue.setIntValue(status);
+			
+			get_statistics (svgc);
+			
+			svg_cairo_destroy (svgc);
+			
+		}else{returnValue.setIntValue(status);}
+	}else{returnValue.setIntValue(-2);}
+	
+	Param2.toParamAtIndex(pParams, 2);
+	returnValue.setReturn(pResult);
+}
+
+void SVGL_Convert_compiled(sLONG_PTR *pResult, PackagePtr pParams)
+{
+	C_BLOB Param1;
+	C_BLOB Param2;
+	C_LONGINT Param3;
+	C_LONGINT Param4;
+	C_REAL Param5;
+	C_LONGINT returnValue;
+
+	Param1.fromParamAtIndex(pParams, 1);
+	Param2.fromParamAtIndex(pParams, 2);
+	Param3.fromParamAtIndex(pParams, 3);
+	Param4.fromParamAtIndex(pParams, 4);
+	Param5.fromParamAtIndex(pParams, 5);
+
+	const uint8_t *p = Param1.getBytesPtr();
+	
+	if(p) {
+		
+		unsigned int svg_width, svg_height;
+		
+		svg_cairo_status_t status;
+		cairo_t *cr;
+		svg_cairo_t *svgc;
+		cairo_surface_t *surface;
+		double dx, dy;
+		
+		double scale = 1;
+		if(Param5.getDoubleValue())
+			scale = Param5.getDoubleValue();
+		
+		int width = Param3.getIntValue();
+		int height = Param4.getIntValue();
+		
+		status = svg_cairo_create (&svgc);
+		
+		if (!status) {
+			
+			/* Param1 outlives svgc, no need to copy */
+			status = svg_cairo_parse_compiled (svgc, p, Param1.getBytesLength());
+			
+			if (!status) {
+				
+				svg_cairo_get_size (svgc, &svg_width, &svg_height);
+				
+				get_output_size (svg_width, svg_height, &width, &height, &scale, &dx, &dy);
+				
 				surface = cairo_pdf_surface_create_for_stream (rsvg_cairo_write_func,
 																											 (void *)&Param2,
 																											 width,
@@ -300,6 +541,8 @@ void SVGL_Convert(sLONG_PTR *pResult, PackagePtr pParams)
 				
 			}else{returnValue.setIntValue(status);}
 			
+			get_statistics (svgc);
+			
 			svg_cairo_destroy (svgc);
 			
 		}else{returnValue.setIntValue(status);}
@@ -308,3 +551,768 @@ void SVGL_Convert(sLONG_PTR *pResult, PackagePtr pParams)
 	Param2.toParamAtIndex(pParams, 2);
 	returnValue.setReturn(pResult);
 }
+
+// -------------------------------- Convert Multiple ------------------------------
+
+void SVGL_Convert_multiple(sLONG_PTR *pResult, PackagePtr pParams)
+{
+	C_PICTURE Param1;
+	ARRAY_LONGINT Param2;
+	ARRAY_LONGINT Param3;
+	ARRAY_LONGINT Param4;
+	ARRAY_REAL Param5;
+	C_LONGINT returnValue;
+
+	Param1.fromParamAtIndex(pParams, 1);
+	Param2.fromParamAtIndex(pParams, 2);
+	Param3.fromParamAtIndex(pParams, 3);
+	Param4.fromParamAtIndex(pParams, 4);
+	Param5.fromParamAtIndex(pParams, 5);
+
+	PA_Variable Param6 = *((PA_Variable*) pParams[5]);
+	PA_Variable *param6 = ((PA_Variable *)pParams[5]);
+	
+	switch (Param6.fType)
+	{
+		case eVK_ArrayBlob:
+			break;
+		case eVK_Undefined:
+			PA_ClearVariable(&Param6);
+			Param6 = PA_CreateVariable(eVK_ArrayBlob);
+			param6->fType = Param6.fType;
+			break;
+		default:
+			break;
+	}
+	
+	CUTF8String type = CUTF8String((const uint8_t *)".svg", 4);
+	
+	const uint8_t *p = Param1.getBytesPtr(&type);
+	
+	if(p && (Param6.fType == eVK_ArrayBlob)) {
+		
+		unsigned int svg_width, svg_height;
+		
+		svg_cairo_status_t status;
+		svg_cairo_t *svgc;
+		
+		status = svg_cairo_create (&svgc);
+		
+		if (!status) {
+			
+			status = svg_cairo_parse_buffer (svgc, (const char *)p, Param1.getBytesLength(&type));
+			
+			if (!status) {
+				
+				svg_cairo_get_size (svgc, &svg_width, &svg_height);
+				
+				uint32_t count = Param2.getSize() ? Param2.getSize() - 1 : 0;
+				
+				double max_scale = 0;
+				
+				for(uint32_t i = 1; i <= count; ++i) {
+					
+					double dx, dy;
+					
+					double scale = 1;
+					if(Param5.getDoubleValueAtIndex(i))
+						scale = Param5.getDoubleValueAtIndex(i);
+					
+					int width = Param3.getIntValueAtIndex(i);
+					int height = Param4.getIntValueAtIndex(i);
+					
+					get_output_size (svg_width, svg_height, &width, &height, &scale, &dx, &dy);
+					
+					if (scale > max_scale)
+						max_scale = scale;
+				}
+				
+				apply_options_for_replay (svgc, max_scale);
+				
+				/* Render the document once, at its own size, then replay
+				   the recording into every output. svgc has to stay alive
+				   until the last replay: image data is referenced, not
+				   copied, by the recording. */
+				cairo_surface_t *recording = cairo_recording_surface_create (CAIRO_CONTENT_COLOR_ALPHA, NULL);
+				cairo_t *cr = cairo_create (recording);
+				
+				returnValue.setIntValue(svg_cairo_render (svgc, cr));
+				
+				cairo_destroy (cr);
+				
+				PA_ResizeArray(&Param6, count);
+				
+				for(uint32_t i = 1; i <= count; ++i) {
+					
+					C_BLOB image;
+					cairo_surface_t *surface;
+					double dx, dy;
+					
+					double scale = 1;
+					if(Param5.getDoubleValueAtIndex(i))
+						scale = Param5.getDoubleValueAtIndex(i);
+					
+					int width = Param3.getIntValueAtIndex(i);
+					int height = Param4.getIntValueAtIndex(i);
+					
+					get_output_size (svg_width, svg_height, &width, &height, &scale, &dx, &dy);
+					
+					int format = Param2.getIntValueAtIndex(i);
+					
+					if (format == SVGL_FORMAT_PNG) {
+						surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+					} else {
+						surface = cairo_pdf_surface_create_for_stream (rsvg_cairo_write_func,
+																													 (void *)&image,
+																													 width,
+																													 height);
+					}
+					
+					cr = cairo_create (surface);
+					
+					cairo_translate (cr, dx, dy);
+					cairo_scale (cr, scale, scale);
+					cairo_set_source_surface (cr, recording, 0, 0);
+					cairo_paint (cr);
+					
+					cairo_show_page (cr);
+					cairo_destroy (cr);
+					
+					if (format == SVGL_FORMAT_PNG) {
+						cairo_surface_write_to_png_stream (surface, rsvg_cairo_write_func, (void *)&image);
+					}
+					
+					/* finishes the PDF stream */
+					cairo_surface_destroy (surface);
+					
+					PA_Blob blob;
+					blob.fSize = image.getBytesLength();
+					blob.fHandle = PA_NewHandle(blob.fSize);
+					if (blob.fSize) {
+						memcpy (PA_LockHandle(blob.fHandle), image.getBytesPtr(), blob.fSize);
+						PA_UnlockHandle(blob.fHandle);
+					}
+					PA_SetBlobInArray(Param6, i, blob);
+				}
+				
+				cairo_surface_destroy (recording);
+				
+			}else{returnValue.setIntValue(status);}
+			
+			get_statistics (svgc);
+			
+			svg_cairo_destroy (svgc);
+			
+		}else{returnValue.setIntValue(status);}
+	}else{returnValue.setIntValue(-2);}
+	
+	param6->fFiller = 0;
+	param6->uValue.fArray.fCurrent = Param6.uValue.fArray.fCurrent;
+	param6->uValue.fArray.fNbElements = Param6.uValue.fArray.fNbElements;
+	param6->uValue.fArray.fData = Param6.uValue.fArray.fData;
+	
+	returnValue.setReturn(pResult);
+}
+
+// --------------------------------- Convert Region -------------------------------
+
+void SVGL_Convert_region(sLONG_PTR *pResult, PackagePtr pParams)
+{
+	C_PICTURE Param1;
+	C_BLOB Param2;
+	C_REAL Param3;
+	C_REAL Param4;
+	C_REAL Param5;
+	C_REAL Param6;
+	C_LONGINT Param7;
+	C_LONGINT Param8;
+	C_LONGINT Param9;
+	C_LONGINT returnValue;
+
+	Param1.fromParamAtIndex(pParams, 1);
+	Param2.fromParamAtIndex(pParams, 2);
+	Param3.fromParamAtIndex(pParams, 3);
+	Param4.fromParamAtIndex(pParams, 4);
+	Param5.fromParamAtIndex(pParams, 5);
+	Param6.fromParamAtIndex(pParams, 6);
+	Param7.fromParamAtIndex(pParams, 7);
+	Param8.fromParamAtIndex(pParams, 8);
+	Param9.fromParamAtIndex(pParams, 9);
+
+	CUTF8String type = CUTF8String((const uint8_t *)".svg", 4);
+	
+	const uint8_t *p = Param1.getBytesPtr(&type);
+	
+	double x = Param3.getDoubleValue();
+	double y = Param4.getDoubleValue();
+	double region_width = Param5.getDoubleValue();
+	double region_height = Param6.getDoubleValue();
+	
+	if(!p) {
+		returnValue.setIntValue(-2);
+	}else if(region_width <= 0 || region_height <= 0) {
+		returnValue.setIntValue(SVG_CAIRO_STATUS_INVALID_VALUE);
+	}else{
+		
+		svg_cairo_status_t status;
+		cairo_t *cr;
+		svg_cairo_t *svgc;
+		cairo_surface_t *surface;
+		double dx, dy;
+		double scale = 1;
+		
+		int width = Param7.getIntValue();
+		int height = Param8.getIntValue();
+		int format = Param9.getIntValue();
+		
+		status = svg_cairo_create (&svgc);
+		
+		if (!status) {
+			
+			apply_options (svgc);
+			
+			status = svg_cairo_parse_buffer (svgc, (const char *)p, Param1.getBytesLength(&type));
+			
+			if (!status) {
+				
+				/* the region plays the part of the svg size */
+				get_output_size (region_width, region_height, &width, &height, &scale, &dx, &dy);
+				
+				simplify_paths (svgc, scale);
+				
+				if (format == SVGL_FORMAT_PNG) {
+					surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+				} else {
+					surface = cairo_pdf_surface_create_for_stream (rsvg_cairo_write_func,
+																												 (void *)&Param2,
+																												 width,
+																												 height);
+				}
+				
+				cr = cairo_create (surface);
+				
+				cairo_translate (cr, dx, dy);
+				cairo_scale (cr, scale, scale);
+				cairo_translate (cr, -x, -y);
+				
+				returnValue.setIntValue(svg_cairo_render_region (svgc, cr, x, y, region_width, region_height));
+				
+				cairo_show_page (cr);
+				cairo_destroy (cr);
+				
+				if (format == SVGL_FORMAT_PNG) {
+					cairo_surface_write_to_png_stream (surface, rsvg_cairo_write_func, (void *)&Param2);
+				}
+				
+				cairo_surface_destroy (surface);
+				
+			}else{returnValue.setIntValue(status);}
+			
+			get_statistics (svgc);
+			
+			svg_cairo_destroy (svgc);
+			
+		}else{returnValue.setIntValue(status);}
+	}
+	
+	Param2.toParamAtIndex(pParams, 2);
+	returnValue.setReturn(pResult);
+}
+
+// --------------------------------- Convert Tiled --------------------------------
+
+/* Tiles are rendered by a pool of threads, each through its own
+   svg_cairo_t sharing the one parsed document, into a window of
+   SVGL_TILED_WINDOW strips of SVGL_TILE_SIZE rows. The calling thread
+   encodes each strip as soon as all of its tiles are done, which
+   frees the slot for the strip after next, so memory is bounded by
+   the window and not by the image. */
+
+#define SVGL_TILE_SIZE 256
+#define SVGL_TILED_WINDOW 2
+#define SVGL_TILED_MAX_THREADS 64
+
+typedef struct
+{
+	int width, height, stride;
+	double scale, dx, dy;
+	int tiles_x, tiles_y;
+	unsigned char *strips;
+	
+	std::mutex mutex;
+	std::condition_variable cond;
+	int next_tile;
+	int encoded_strips;
+	std::vector<int> pending;
+	svg_cairo_status_t status;
+} tiled_render_t;
+
+static void tiled_render_worker (tiled_render_t *t, svg_cairo_t *svgc)
+{
+	int num_tiles = t->tiles_x * t->tiles_y;
+	
+	for(;;) {
+		
+		int tile;
+		
+		{
+			std::unique_lock<std::mutex> lock (t->mutex);
+			/* wait for a slot in the window */
+			while (t->next_tile < num_tiles
+						 && t->next_tile / t->tiles_x >= t->encoded_strips + SVGL_TILED_WINDOW)
+				t->cond.wait (lock);
+			if (t->next_tile >= num_tiles)
+				return;
+			tile = t->next_tile++;
+		}
+		
+		int row = tile / t->tiles_x;
+		int tx = (tile % t->tiles_x) * SVGL_TILE_SIZE;
+		int ty = row * SVGL_TILE_SIZE;
+		
+		unsigned char *data = t->strips
+		+ (size_t)(row % SVGL_TILED_WINDOW) * SVGL_TILE_SIZE * t->stride
+		+ (size_t)tx * 4;
+		
+		cairo_surface_t *surface = cairo_image_surface_create_for_data (data,
+																																		CAIRO_FORMAT_ARGB32,
+																																		MIN (SVGL_TILE_SIZE, t->width - tx),
+																																		MIN (SVGL_TILE_SIZE, t->height - ty),
+																																		t->stride);
+		cairo_t *cr = cairo_create (surface);
+		
+		/* the slot still holds an earlier strip */
+		cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
+		cairo_paint (cr);
+		cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+		
+		/* the tile is the clip, which the engine culls against */
+		cairo_translate (cr, t->dx - tx, t->dy - ty);
+		cairo_scale (cr, t->scale, t->scale);
+		
+		svg_cairo_status_t status = svg_cairo_render (svgc, cr);
+		
+		cairo_destroy (cr);
+		cairo_surface_destroy (surface);
+		
+		{
+			std::unique_lock<std::mutex> lock (t->mutex);
+			if (status && !t->status)
+				t->status = status;
+			if (--t->pending[row] == 0)
+				t->cond.notify_all ();
+		}
+	}
+}
+
+static void png_write_blob (png_structp png, png_bytep data, png_size_t length)
+{
+	C_BLOB *blob = (C_BLOB *)png_get_io_ptr (png);
+	blob->addBytes (data, (uint32_t)length);
+}
+
+/* libpng reports errors with longjmp: keep each call in a frame of
+   its own with nothing that needs destroying */
+static int png_write_begin (png_structp png, png_infop info, C_BLOB *blob, int width, int height)
+{
+	if (setjmp (png_jmpbuf (png)))
+		return 0;
+	
+	png_set_write_fn (png, blob, png_write_blob, NULL);
+	png_set_IHDR (png, info, width, height, 8,
+								PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE,
+								PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info (png, info);
+	
+	return 1;
+}
+
+/* Writes rows of premultiplied ARGB32 as straight RGBA, like
+   cairo_surface_write_to_png */
+static int png_write_strip (png_structp png, const unsigned char *data, int stride,
+														int width, int rows, unsigned char *row_buffer)
+{
+	if (setjmp (png_jmpbuf (png)))
+		return 0;
+	
+	for (int y = 0; y < rows; ++y) {
+		
+		const uint32_t *pixel = (const uint32_t *)(data + (size_t)y * stride);
+		unsigned char *out = row_buffer;
+		
+		for (int x = 0; x < width; ++x, out += 4) {
+			uint32_t p = pixel[x];
+			unsigned int alpha = p >> 24;
+			if (alpha == 0) {
+				out[0] = out[1] = out[2] = out[3] = 0;
+			} else {
+				out[0] = (((p >> 16) & 0xff) * 255 + alpha / 2) / alpha;
+				out[1] = (((p >> 8) & 0xff) * 255 + alpha / 2) / alpha;
+				out[2] = ((p & 0xff) * 255 + alpha / 2) / alpha;
+				out[3] = alpha;
+			}
+		}
+		
+		png_write_row (png, row_buffer);
+	}
+	
+	return 1;
+}
+
+static int png_write_finish (png_structp png, png_infop info)
+{
+	if (setjmp (png_jmpbuf (png)))
+		return 0;
+	
+	png_write_end (png, info);
+	
+	return 1;
+}
+
+static svg_cairo_status_t render_tiled_png (svg_cairo_t *svgc, C_BLOB *blob,
+																						int width, int height,
+																						double scale, double dx, double dy,
+																						int num_threads)
+{
+	tiled_render_t t;
+	
+	t.width = width;
+	t.height = height;
+	t.stride = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32, width);
+	t.scale = scale;
+	t.dx = dx;
+	t.dy = dy;
+	t.tiles_x = (width + SVGL_TILE_SIZE - 1) / SVGL_TILE_SIZE;
+	t.tiles_y = (height + SVGL_TILE_SIZE - 1) / SVGL_TILE_SIZE;
+	t.next_tile = 0;
+	t.encoded_strips = 0;
+	t.pending.assign (t.tiles_y, t.tiles_x);
+	t.status = SVG_CAIRO_STATUS_SUCCESS;
+	
+	if (num_threads <= 0)
+		num_threads = std::thread::hardware_concurrency ();
+	num_threads = MIN (num_threads, SVGL_TILED_MAX_THREADS);
+	num_threads = MIN (num_threads, t.tiles_x * t.tiles_y);
+	if (num_threads < 1)
+		num_threads = 1;
+	
+	t.strips = (unsigned char *)malloc ((size_t)SVGL_TILED_WINDOW * SVGL_TILE_SIZE * t.stride);
+	unsigned char *row_buffer = (unsigned char *)malloc ((size_t)width * 4);
+	png_structp png = png_create_write_struct (PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	png_infop info = png ? png_create_info_struct (png) : NULL;
+	
+	svg_cairo_status_t status = SVG_CAIRO_STATUS_NO_MEMORY;
+	
+	/* the PNG is appended to the blob as it is encoded */
+	blob->setBytes (NULL, 0);
+	
+	if (t.strips && row_buffer && info && png_write_begin (png, info, blob, width, height)) {
+		
+		std::vector<svg_cairo_t *> renderers;
+		std::vector<std::thread> workers;
+		
+		/* once, before the first worker starts reading the document;
+		   an image that fails to read reports it again from each
+		   render, as it would without sharing */
+		svg_cairo_prepare_shared (svgc);
+		
+		for (int i = 0; i < num_threads; ++i) {
+			svg_cairo_t *renderer;
+			if (svg_cairo_create_shared (&renderer, svgc))
+				break;
+			renderers.push_back (renderer);
+			try {
+				workers.push_back (std::thread (tiled_render_worker, &t, renderer));
+			} catch (...) {
+				break;
+			}
+		}
+		
+		if (workers.size()) {
+			
+			int ok = 1;
+			
+			for (int row = 0; row < t.tiles_y; ++row) {
+				
+				{
+					std::unique_lock<std::mutex> lock (t.mutex);
+					while (t.pending[row])
+						t.cond.wait (lock);
+				}
+				
+				/* after a failure, keep draining the window so the workers finish */
+				if (ok)
+					ok = png_write_strip (png,
+																t.strips + (size_t)(row % SVGL_TILED_WINDOW) * SVGL_TILE_SIZE * t.stride,
+																t.stride,
+																width,
+																MIN (SVGL_TILE_SIZE, height - row * SVGL_TILE_SIZE),
+																row_buffer);
+				
+				{
+					std::unique_lock<std::mutex> lock (t.mutex);
+					t.encoded_strips = row + 1;
+					t.cond.notify_all ();
+				}
+			}
+			
+			for (size_t i = 0; i < workers.size(); ++i)
+				workers[i].join ();
+			
+			if (ok)
+				ok = png_write_finish (png, info);
+			
+			status = ok ? t.status : SVG_CAIRO_STATUS_NO_MEMORY;
+		}
+		
+		for (size_t i = 0; i < renderers.size(); ++i)
+			svg_cairo_destroy (renderers[i]);
+	}
+	
+	if (png)
+		png_destroy_write_struct (&png, info ? &info : NULL);
+	free (row_buffer);
+	free (t.strips);
+	
+	/* the signature and header went out before the first tile:
+	   don't hand back a truncated PNG */
+	if (status)
+		blob->setBytes (NULL, 0);
+	
+	return status;
+}
+
+void SVGL_Convert_tiled(sLONG_PTR *pResult, PackagePtr pParams)
+{
+	C_PICTURE Param1;
+	C_BLOB Param2;
+	C_LONGINT Param3;
+	C_LONGINT Param4;
+	C_REAL Param5;
+	C_LONGINT Param6;
+	C_LONGINT returnValue;
+
+	Param1.fromParamAtIndex(pParams, 1);
+	Param2.fromParamAtIndex(pParams, 2);
+	Param3.fromParamAtIndex(pParams, 3);
+	Param4.fromParamAtIndex(pParams, 4);
+	Param5.fromParamAtIndex(pParams, 5);
+	Param6.fromParamAtIndex(pParams, 6);
+
+	CUTF8String type = CUTF8String((const uint8_t *)".svg", 4);
+	
+	const uint8_t *p = Param1.getBytesPtr(&type);
+	
+	if(p) {
+		
+		unsigned int svg_width, svg_height;
+		
+		svg_cairo_status_t status;
+		svg_cairo_t *svgc;
+		double dx, dy;
+		
+		double scale = 1;
+		if(Param5.getDoubleValue())
+			scale = Param5.getDoubleValue();
+		
+		int width = Param3.getIntValue();
+		int height = Param4.getIntValue();
+		
+		status = svg_cairo_create (&svgc);
+		
+		if (!status) {
+			
+			apply_options (svgc);
+			
+			status = svg_cairo_parse_buffer (svgc, (const char *)p, Param1.getBytesLength(&type));
+			
+			if (!status) {
+				
+				svg_cairo_get_size (svgc, &svg_width, &svg_height);
+				
+				get_output_size (svg_width, svg_height, &width, &height, &scale, &dx, &dy);
+				
+				if (width <= 0 || height <= 0) {
+					returnValue.setIntValue(SVG_CAIRO_STATUS_INVALID_VALUE);
+				} else {
+					/* before the document is shared with the tiles */
+					simplify_paths (svgc, scale * svg_cairo_get_content_scale (svgc));
+					returnValue.setIntValue(render_tiled_png (svgc, &Param2, width, height, scale, dx, dy, Param6.getIntValue()));
+				}
+				
+			}else{returnValue.setIntValue(status);}
+			
+			get_statistics (svgc);
+			
+			svg_cairo_destroy (svgc);
+			
+		}else{returnValue.setIntValue(status);}
+	}else{returnValue.setIntValue(-2);}
+	
+	Param2.toParamAtIndex(pParams, 2);
+	returnValue.setReturn(pResult);
+}
+
+// ------------------------------------ Options -----------------------------------
+
+void SVGL_SET_OPTION(sLONG_PTR *pResult, PackagePtr pParams)
+{
+	C_LONGINT Param1;
+	C_REAL Param2;
+
+	Param1.fromParamAtIndex(pParams, 1);
+	Param2.fromParamAtIndex(pParams, 2);
+
+	switch (Param1.getIntValue())
+	{
+		case SVGL_OPTION_DETAIL_THRESHOLD:
+			svgl_detail_threshold = Param2.getDoubleValue() > 0 ? Param2.getDoubleValue() : 0;
+			break;
+			
+		case SVGL_OPTION_SIMPLIFY_TOLERANCE:
+			svgl_simplify_tolerance = Param2.getDoubleValue() > 0 ? Param2.getDoubleValue() : 0;
+			break;
+			
+		case SVGL_OPTION_IMAGE_CACHE_SIZE:
+			svg_set_image_cache_size (Param2.getDoubleValue() > 0 ? (size_t) (Param2.getDoubleValue() * 1024 * 1024) : 0);
+			break;
+			
+		case SVGL_OPTION_IMAGE_RESOLUTION:
+			svgl_image_resolution = Param2.getDoubleValue() > 0 ? Param2.getDoubleValue() : 0;
+			break;
+			
+		default:
+			break;
+	}
+}
+
+void SVGL_Get_option(sLONG_PTR *pResult, PackagePtr pParams)
+{
+	C_LONGINT Param1;
+	C_REAL returnValue;
+
+	Param1.fromParamAtIndex(pParams, 1);
+
+	switch (Param1.getIntValue())
+	{
+		case SVGL_OPTION_DETAIL_THRESHOLD:
+			returnValue.setDoubleValue(svgl_detail_threshold);
+			break;
+			
+		case SVGL_OPTION_SIMPLIFY_TOLERANCE:
+			returnValue.setDoubleValue(svgl_simplify_tolerance);
+			break;
+			
+		case SVGL_OPTION_IMAGE_CACHE_SIZE:
+			returnValue.setDoubleValue(svg_get_image_cache_size () / (1024.0 * 1024.0));
+			break;
+			
+		case SVGL_OPTION_IMAGE_RESOLUTION:
+			returnValue.setDoubleValue(svgl_image_resolution);
+			break;
+			
+		case SVGL_OPTION_FONT_LOAD_TIME:
+		{
+			std::lock_guard<std::mutex> lock(svgl_fonts_mutex);
+			returnValue.setDoubleValue(svgl_fonts_load_time);
+		}
+			break;
+			
+		case SVGL_OPTION_ELIDED_STATE_COUNT:
+			returnValue.setDoubleValue(svgl_elided_state_count);
+			break;
+			
+		case SVGL_OPTION_SIMPLIFIED_POINT_COUNT:
+			returnValue.setDoubleValue(svgl_simplified_point_count);
+			break;
+			
+		default:
+			break;
+	}
+	
+	returnValue.setReturn(pResult);
+}
+
+// ------------------------------------- Fonts ------------------------------------
+
+static void load_fonts (std::vector<CUTF8String> families)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	
+	/* without families, the default one: fontconfig still loads its
+	   fonts and cache */
+	if (families.empty())
+		families.push_back(CUTF8String());
+	
+	for (size_t i = 0; i < families.size(); ++i)
+		svg_cairo_font_preload ((const char *)families[i].c_str());
+	
+	std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+	
+	std::lock_guard<std::mutex> lock(svgl_fonts_mutex);
+	svgl_fonts_load_time = elapsed.count();
+}
+
+void SVGL_Load_fonts(sLONG_PTR *pResult, PackagePtr pParams)
+{
+	ARRAY_TEXT Param1;
+	ARRAY_TEXT Param2;
+	C_TEXT Param3;
+	C_LONGINT returnValue;
+
+	Param1.fromParamAtIndex(pParams, 1);
+	Param2.fromParamAtIndex(pParams, 2);
+	Param3.fromParamAtIndex(pParams, 3);
+	
+	std::lock_guard<std::mutex> lock(svgl_fonts_mutex);
+	
+	/* once per process, as fontconfig reads its configuration once */
+	if (svgl_fonts_thread.joinable() || svgl_fonts_load_time) {
+		returnValue.setIntValue(SVG_CAIRO_STATUS_INVALID_CALL);
+	} else {
+		
+		svg_cairo_status_t status = SVG_CAIRO_STATUS_SUCCESS;
+		
+		uint32_t count = Param1.getSize() ? Param1.getSize() - 1 : 0;
+		
+		if (count) {
+			
+			std::vector<CUTF8String> paths(count);
+			std::vector<const char *> directories(count);
+			CUTF8String cache;
+			
+			for(uint32_t i = 1; i <= count; ++i) {
+				Param1.copyPathAtIndex(&paths[i - 1], i);
+				directories[i - 1] = (const char *)paths[i - 1].c_str();
+			}
+			Param3.copyPath(&cache);
+			
+			status = svg_cairo_font_set_directories (&directories[0], count, (const char *)cache.c_str());
+		}
+		
+		if (!status) {
+			
+			std::vector<CUTF8String> families;
+			
+			count = Param2.getSize() ? Param2.getSize() - 1 : 0;
+			
+			for(uint32_t i = 1; i <= count; ++i) {
+				CUTF8String family;
+				Param2.copyUTF8StringAtIndex(&family, i);
+				families.push_back(family);
+			}
+			
+			svgl_fonts_load_time = -1;
+			try {
+				svgl_fonts_thread = std::thread(load_fonts, families);
+			} catch (...) {
+				svgl_fonts_load_time = 0;
+				status = SVG_CAIRO_STATUS_NO_MEMORY;
+			}
+		}
+		
+		returnValue.setIntValue(status);
+	}
+	
+	returnValue.setReturn(pResult);
+}
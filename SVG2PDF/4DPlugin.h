@@ -8,6 +8,17 @@
  #
  # --------------------------------------------------------------------------------*/
 
+#define SVGL_FORMAT_PDF 0
+#define SVGL_FORMAT_PNG 1
+
+#define SVGL_OPTION_DETAIL_THRESHOLD 1
+#define SVGL_OPTION_SIMPLIFY_TOLERANCE 2
+#define SVGL_OPTION_IMAGE_CACHE_SIZE 3
+#define SVGL_OPTION_IMAGE_RESOLUTION 4
+#define SVGL_OPTION_FONT_LOAD_TIME 5
+#define SVGL_OPTION_ELIDED_STATE_COUNT 6
+#define SVGL_OPTION_SIMPLIFIED_POINT_COUNT 7
+
 #ifndef MIN
 #define	MIN(a,b) (((a)<(b))?(a):(b))
 #endif /* MIN */
@@ -20,6 +31,13 @@
 #include <cairo.h>
 #include <cairo-pdf.h>
 #include <svg-cairo.h>
+#include <png.h>
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 #ifdef WIN32
 #include "Shlwapi.h"
@@ -31,3 +49,23 @@ void SVGL_Convert_array(sLONG_PTR *pResult, PackagePtr pParams);
 
 // --- Convert One
 void SVGL_Convert(sLONG_PTR *pResult, PackagePtr pParams);
+
+// --- Compile
+void SVGL_Compile(sLONG_PTR *pResult, PackagePtr pParams);
+void SVGL_Convert_compiled(sLONG_PTR *pResult, PackagePtr pParams);
+
+// --- Convert Multiple
+void SVGL_Convert_multiple(sLONG_PTR *pResult, PackagePtr pParams);
+
+// --- Convert Region
+void SVGL_Convert_region(sLONG_PTR *pResult, PackagePtr pParams);
+
+// --- Convert Tiled
+void SVGL_Convert_tiled(sLONG_PTR *pResult, PackagePtr pParams);
+
+// --- Options
+void SVGL_SET_OPTION(sLONG_PTR *pResult, PackagePtr pParams);
+void SVGL_Get_option(sLONG_PTR *pResult, PackagePtr pParams);
+
+// --- Fonts
+void SVGL_Load_fonts(sLONG_PTR *pResult, PackagePtr pParams);
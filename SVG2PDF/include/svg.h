@@ -220,6 +220,16 @@ typedef struct svg_paint {
     } p;
 } svg_paint_t;
 
+typedef enum svg_bbox_visibility {
+    /* nothing inside the box can reach the output */
+    SVG_BBOX_HIDDEN = 0,
+    SVG_BBOX_VISIBLE = 1,
+    /* too small to be worth drawing in detail: a shape is drawn as a
+       rectangle over its box in its average color, anything else is
+       left out */
+    SVG_BBOX_BELOW_DETAIL = 2
+} svg_bbox_visibility_t;
+
 /* XXX: Here's another piece of the API that needs deep consideration. */
 typedef struct svg_render_engine {
     /* hierarchy */
@@ -308,6 +318,37 @@ typedef struct svg_render_engine {
 				   svg_length_t	 *y,
 				   svg_length_t	 *width,
 				   svg_length_t	 *height);
+    /* culling: may be NULL. Sets *visible to an svg_bbox_visibility_t
+       for the box, given in the current user space. */
+    svg_status_t (* test_bbox) (void *closure,
+				double x1, double y1,
+				double x2, double y2,
+				int *visible);
+    /* encoded images: may be NULL. Offers the file behind the next
+       render_image, of mime_type "image/jpeg", for an engine to embed
+       as is; data lasts until render_image returns. Setting
+       *need_pixels to 0 has render_image called with NULL data,
+       saving the decoding. A NULL mime_type withdraws the offer, the
+       image failing to decode. */
+    svg_status_t (* set_image_source) (void			*closure,
+				       const char		*mime_type,
+				       const unsigned char	*data,
+				       size_t			size,
+				       int			*need_pixels);
+    /* image resolution: may be NULL. Sets *x_pixels and *y_pixels to
+       the most pixels that can show across an image width by height
+       in the current user space, 0 for no limit; images are then
+       decoded no more detailed than that. */
+    svg_status_t (* get_image_resolution) (void		*closure,
+					   svg_length_t	*width,
+					   svg_length_t	*height,
+					   double	*x_pixels,
+					   double	*y_pixels);
+    /* image opacity: may be NULL. Tells whether the pixels of the
+       next render_image are all opaque, a JPEG or a PNG without
+       alpha or transparent color, so that they can be taken as RGB
+       with no alpha to keep. */
+    svg_status_t (* set_image_opaque) (void *closure, int opaque);
 } svg_render_engine_t;
 
 svg_status_t
@@ -337,11 +378,90 @@ svg_render (svg_t		*svg,
 	    svg_render_engine_t	*engine,
 	    void		*closure);
 
+/* Render only what meets the rectangle x, y, width, height, given in
+   the coordinates the root's content is drawn in (its viewBox, if it
+   has one). The root's viewBox and position are left to the caller,
+   who maps the rectangle onto its output. Groups with many children
+   are searched through an R-tree built at parse time. Not available
+   for compiled documents. */
+svg_status_t
+svg_render_region (svg_t		*svg,
+		   svg_render_engine_t	*engine,
+		   void			*closure,
+		   double		x,
+		   double		y,
+		   double		width,
+		   double		height);
+
+/* Read every image file up front and stop keeping render
+   statistics. From then on rendering only reads the document, and
+   several threads may render it at once, each with its own engine
+   closure. Pixels are still decoded by the first render that draws
+   an image, at the resolution it needs, others waiting for it rather
+   than decoding it again. Returns the first image that failed to
+   read; the document is shared regardless. */
+svg_status_t
+svg_prepare_shared (svg_t *svg);
+
+/* Whether svg_prepare_shared was called: only reads the document. */
+int
+svg_is_shared (svg_t *svg);
+
+/* Decoded images are shared by every document of the process that
+   embeds the same data URI, or the same unchanged file, through a
+   cache that keeps at most bytes of pixels (64 MB by default) and
+   drops the least recently used first. 0 turns caching off; images
+   in use stay valid either way. Thread-safe. */
+void
+svg_set_image_cache_size (size_t bytes);
+
+size_t
+svg_get_image_cache_size (void);
+
+/* Simplify the straight runs of every path (polylines, polygons and
+   the line segments of path data) so that no point moves by more
+   than tolerance, given in the root's content space like the region
+   of svg_render_region: exactly collinear points are merged, then
+   Ramer-Douglas-Peucker drops those that don't matter at that
+   tolerance. Call it once after parsing, before svg_prepare_shared;
+   it changes the document for good. Not available for compiled
+   documents. */
+svg_status_t
+svg_simplify_paths (svg_t *svg, double tolerance);
+
 void
 svg_get_size (svg_t *svg,
 	      svg_length_t *width,
 	      svg_length_t *height);
 
+/* The root's viewBox, with an aspect_ratio of
+   SVG_PRESERVE_ASPECT_RATIO_UNKNOWN when it has none. */
+void
+svg_get_view_box (svg_t *svg, svg_view_box_t *view_box);
+
+/* svg_display_list */
+
+/* Write the render engine calls for the document into a flat,
+   relocatable buffer (malloc'ed, free it with free). Documents that
+   use pattern paint return SVG_STATUS_INVALID_CALL. */
+svg_status_t
+svg_compile (svg_t *svg, void **data, size_t *size);
+
+/* Load a buffer written by svg_compile without parsing or copying it;
+   data must stay valid until svg is destroyed. svg_parse_buffer also
+   accepts compiled buffers, but copies them. */
+svg_status_t
+svg_parse_compiled (svg_t *svg, const void *data, size_t size);
+
+/* Number of save/restore pairs and identity transforms that the last
+   svg_render skipped because the element didn't change any state. */
+unsigned long
+svg_get_elided_state_count (svg_t *svg);
+
+/* Number of path points svg_simplify_paths has removed so far. */
+unsigned long
+svg_get_simplified_point_count (svg_t *svg);
+
 /* svg_color */
 
 unsigned int
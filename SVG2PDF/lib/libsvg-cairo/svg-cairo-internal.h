@@ -51,17 +51,23 @@ typedef struct svg_cairo_state {
     double fill_opacity;
     double stroke_opacity;
 
-    char *font_family;
+    /* interned in svg_cairo->font_families, never freed by the state */
+    const char *font_family;
     double font_size;
     svg_font_style_t font_style;
     unsigned int font_weight;
     int font_dirty;
 
+    /* shared with the parent state until set_stroke_dash_array */
     double *dash;
     int num_dashes;
+    int dash_owned;
     double dash_offset;
 
     double opacity;
+    /* set on the state of a group drawn into child_surface; its
+       opacity is applied when compositing, not to the children */
+    int composite_group;
 
     unsigned int viewport_width;
     unsigned int viewport_height;
@@ -73,16 +79,164 @@ typedef struct svg_cairo_state {
     struct svg_cairo_state *next;
 } svg_cairo_state_t;
 
+/* A gradient pattern, built for the viewport and font size it was
+   resolved against. The bbox transform is applied per use. Entries
+   are found through a hash of the gradient. */
+typedef struct svg_cairo_gradient_cache {
+    svg_gradient_t *gradient;
+    unsigned int viewport_width;
+    unsigned int viewport_height;
+    double font_size;
+    cairo_pattern_t *pattern;
+    /* index of the next entry of the bucket, -1 for none */
+    int next_in_bucket;
+} svg_cairo_gradient_cache_t;
+
+#define SVG_CAIRO_GRADIENT_CACHE_BUCKETS 256
+
+/* What the content of a <pattern> inherits from the element painted
+   with it: the state its tile is drawn in. */
+typedef struct svg_cairo_pattern_inherited {
+    svg_color_t color;
+    double fill_opacity;
+    double stroke_opacity;
+    double opacity;
+
+    const char *font_family;
+    double font_size;
+    svg_font_style_t font_style;
+    unsigned int font_weight;
+
+    double *dash;
+    int num_dashes;
+    double dash_offset;
+
+    svg_text_anchor_t text_anchor;
+
+    unsigned int viewport_width;
+    unsigned int viewport_height;
+
+    cairo_fill_rule_t fill_rule;
+    double line_width;
+    cairo_line_cap_t line_cap;
+    cairo_line_join_t line_join;
+    double miter_limit;
+} svg_cairo_pattern_inherited_t;
+
+/* A rendered <pattern> tile. The tile is drawn in device space, so
+   its pixel size and the target it is similar to are the key, along
+   with the state inherited by its content. */
+typedef struct svg_cairo_pattern_cache {
+    svg_element_t *pattern_element;
+    int width;
+    int height;
+    cairo_surface_t *target;
+    /* dash owned by the entry */
+    svg_cairo_pattern_inherited_t inherited;
+    cairo_pattern_t *pattern;
+} svg_cairo_pattern_cache_t;
+
+/* The glyphs of a string in a scaled font, laid out from the origin,
+   and the advance of the string, as cairo_text_extents measures it. */
+typedef struct svg_cairo_glyph_run {
+    cairo_scaled_font_t *scaled_font;
+    char *utf8;
+    unsigned long hash;
+
+    cairo_glyph_t *glyphs;
+    int num_glyphs;
+    /* for a target that keeps the text, such as PDF */
+    cairo_text_cluster_t *clusters;
+    int num_clusters;
+    cairo_text_cluster_flags_t cluster_flags;
+    double x_advance;
+    double y_advance;
+
+    struct svg_cairo_glyph_run *next_in_bucket;
+    /* least recently used order */
+    struct svg_cairo_glyph_run *prev;
+    struct svg_cairo_glyph_run *next;
+} svg_cairo_glyph_run_t;
+
 struct svg_cairo {
     svg_t *svg;
+    /* svg belongs to another svg_cairo_t, see svg_cairo_create_shared */
+    int svg_is_shared;
     cairo_t *cr;
 
     svg_cairo_state_t *state;
+    /* popped states, reused by the next push */
+    svg_cairo_state_t *state_pool;
+
+    char **font_families;
+    int num_font_families;
+    int font_families_size;
 
     unsigned int viewport_width;
     unsigned int viewport_height;
+
+    /* device size below which a shape is drawn as its box, see
+       svg_cairo_set_detail_threshold; 0 for off */
+    double detail_threshold;
+
+    /* image pixels per device unit, see
+       svg_cairo_set_image_resolution; 0 for all */
+    double image_resolution;
+
+    /* only valid during svg_cairo_render */
+    /* the target given is PDF, PostScript or SVG, which groups draw
+       into through recording surfaces */
+    int target_is_vector;
+    /* the JPEG behind the next render_image, see
+       _svg_cairo_set_image_source */
+    const unsigned char *image_source;
+    size_t image_source_size;
+    /* the pixels of the next render_image have no transparency, see
+       _svg_cairo_set_image_opaque */
+    int image_opaque;
+    svg_cairo_gradient_cache_t *gradient_cache;
+    int num_gradient_cache;
+    int gradient_cache_size;
+    /* index of the first entry of each bucket, -1 for none */
+    int gradient_cache_bucket[SVG_CAIRO_GRADIENT_CACHE_BUCKETS];
+    svg_cairo_pattern_cache_t *pattern_cache;
+    int num_pattern_cache;
+    int pattern_cache_size;
+
+    /* glyph runs of the text drawn, kept for the life of the
+       instance, see _svg_cairo_glyph_run_lookup */
+    svg_cairo_glyph_run_t **glyph_run_buckets;
+    /* most recently used first */
+    svg_cairo_glyph_run_t *glyph_run_first;
+    svg_cairo_glyph_run_t *glyph_run_last;
+    int num_glyph_runs;
+    /* a run placed for drawing */
+    cairo_glyph_t *glyphs;
+    int glyphs_size;
 };
 
+/* svg_cairo_font.c */
+
+cairo_font_face_t *
+_svg_cairo_font_face_lookup (const char		*family,
+			     cairo_font_slant_t	slant,
+			     cairo_font_weight_t	weight);
+
+cairo_status_t
+_svg_cairo_glyph_run_lookup (svg_cairo_t		*svg_cairo,
+			     cairo_scaled_font_t	*scaled_font,
+			     const char			*utf8,
+			     svg_cairo_glyph_run_t	**run);
+
+cairo_glyph_t *
+_svg_cairo_glyph_run_place (svg_cairo_t			*svg_cairo,
+			    svg_cairo_glyph_run_t	*run,
+			    double			x,
+			    double			y);
+
+void
+_svg_cairo_glyph_run_cache_destroy (svg_cairo_t *svg_cairo);
+
 /* svg_cairo_sprintf_alloc.c */
 
 int
@@ -109,10 +263,13 @@ svg_cairo_status_t
 _svg_cairo_state_destroy (svg_cairo_state_t *state);
 
 svg_cairo_state_t *
-_svg_cairo_state_push (svg_cairo_state_t *state);
+_svg_cairo_state_push (svg_cairo_state_t *state, svg_cairo_state_t **pool);
 
 svg_cairo_state_t *
-_svg_cairo_state_pop (svg_cairo_state_t *state);
+_svg_cairo_state_pop (svg_cairo_state_t *state, svg_cairo_state_t **pool);
+
+void
+_svg_cairo_state_destroy_pool (svg_cairo_state_t **pool);
 
 
 #endif
@@ -48,6 +48,19 @@ svg_cairo_create (svg_cairo_t **svg_cairo);
 svg_cairo_status_t
 svg_cairo_destroy (svg_cairo_t *svg_cairo);
 
+/* See svg_prepare_shared: call once, before any thread renders the
+   document, and before svg_cairo_create_shared. */
+svg_cairo_status_t
+svg_cairo_prepare_shared (svg_cairo_t *svg_cairo);
+
+/* Another renderer for the document parsed into other, for use on
+   another thread: other's document must be prepared with
+   svg_cairo_prepare_shared, which this doesn't do as other threads
+   may be rendering it already, and must outlive every instance
+   sharing it. */
+svg_cairo_status_t
+svg_cairo_create_shared (svg_cairo_t **svg_cairo, svg_cairo_t *other);
+
 svg_cairo_status_t
 svg_cairo_parse (svg_cairo_t *svg_cairo, const char *filename);
 
@@ -66,9 +79,37 @@ svg_cairo_parse_chunk       (svg_cairo_t *svg_cairo, const char *buf, size_t cou
 svg_cairo_status_t
 svg_cairo_parse_chunk_end   (svg_cairo_t *svg_cairo);
 
+svg_cairo_status_t
+svg_cairo_parse_compiled (svg_cairo_t *svg_cairo, const void *data, size_t size);
+
+svg_cairo_status_t
+svg_cairo_compile (svg_cairo_t *svg_cairo, void **data, size_t *size);
+
 svg_cairo_status_t
 svg_cairo_render (svg_cairo_t *svg_cairo, cairo_t *xrs);
 
+/* Level of detail: shapes whose box covers less than pixels on the
+   device in both directions are drawn as that box, in their average
+   color, and other elements that small are skipped. 0, the default,
+   draws everything in full. */
+void
+svg_cairo_set_detail_threshold (svg_cairo_t *svg_cairo, double pixels);
+
+/* Image resolution: images are decoded with no more than about
+   pixels of theirs per device unit, which spares memory, time and
+   the size of a PDF. 0, the default, keeps all their pixels. The
+   device is the target of svg_cairo_render: don't set this when
+   recording for a replay at another scale. */
+void
+svg_cairo_set_image_resolution (svg_cairo_t *svg_cairo, double pixels);
+
+/* Render the part of the document inside x, y, width, height (see
+   svg_render_region), clipped to it, in the current user space of
+   xrs: the caller sets up the transform onto the output. */
+svg_cairo_status_t
+svg_cairo_render_region (svg_cairo_t *svg_cairo, cairo_t *xrs,
+			 double x, double y, double width, double height);
+
 /* XXX: Ugh... this inconsistent interface needs to be cleaned up. */
 svg_cairo_status_t
 svg_cairo_set_viewport_dimension (svg_cairo_t *svg_cairo, unsigned int width, unsigned int height);
@@ -78,6 +119,44 @@ svg_cairo_get_size (svg_cairo_t  *svg_cairo,
 		    unsigned int *width,
 		    unsigned int *height);
 
+/* Pixels of svg_cairo_get_size per unit of the root's content space,
+   that of svg_cairo_render_region: 1 without a viewBox. */
+double
+svg_cairo_get_content_scale (svg_cairo_t *svg_cairo);
+
+/* See svg_simplify_paths: tolerance is in the root's content space,
+   so divide a tolerance in output pixels by the output scale, and by
+   svg_cairo_get_content_scale unless rendering a region. Call before
+   svg_cairo_prepare_shared. */
+svg_cairo_status_t
+svg_cairo_simplify_paths (svg_cairo_t *svg_cairo, double tolerance);
+
+/* See svg_get_elided_state_count: 0 once shared with
+   svg_cairo_prepare_shared, whose renders don't count. */
+unsigned long
+svg_cairo_get_elided_state_count (svg_cairo_t *svg_cairo);
+
+/* See svg_get_simplified_point_count. */
+unsigned long
+svg_cairo_get_simplified_point_count (svg_cairo_t *svg_cairo);
+
+/* Fonts, for every instance: have fontconfig search the
+   num_directories directories only, instead of the system's, keeping
+   its cache and the configuration written for it in cache_directory.
+   fontconfig reads its configuration once, so call this before any
+   text is drawn. */
+svg_cairo_status_t
+svg_cairo_font_set_directories (const char * const	*directories,
+				int			num_directories,
+				const char		*cache_directory);
+
+/* Resolve the font of family, a font-family list such as "Arial,
+   sans-serif", ahead of the conversions that use it. Can take long on
+   first use, while the system's fonts are scanned: call it from a
+   thread of its own. */
+svg_cairo_status_t
+svg_cairo_font_preload (const char *family);
+
 #ifdef __cplusplus
 }
 #endif
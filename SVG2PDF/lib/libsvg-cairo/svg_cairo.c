@@ -203,6 +203,34 @@ _svg_cairo_render_image (void		*closure,
 			 svg_length_t	*width,
 			 svg_length_t	*height);
 
+static svg_status_t
+_svg_cairo_test_bbox (void	*closure,
+		      double	x1,
+		      double	y1,
+		      double	x2,
+		      double	y2,
+		      int	*visible);
+
+static svg_status_t
+_svg_cairo_set_image_source (void			*closure,
+			     const char			*mime_type,
+			     const unsigned char	*data,
+			     size_t			size,
+			     int			*need_pixels);
+
+static int
+_svg_cairo_target_is_vector (cairo_surface_t *target);
+
+static svg_status_t
+_svg_cairo_get_image_resolution (void		*closure,
+				 svg_length_t	*width,
+				 svg_length_t	*height,
+				 double		*x_pixels,
+				 double		*y_pixels);
+
+static svg_status_t
+_svg_cairo_set_image_opaque (void *closure, int opaque);
+
 static svg_status_t
 _cairo_status_to_svg_status (cairo_status_t xr_status);
 
@@ -216,6 +244,39 @@ _svg_cairo_pop_state (svg_cairo_t *svg_cairo);
 static svg_status_t
 _svg_cairo_length_to_pixel (svg_cairo_t *svg_cairo, svg_length_t *length, double *pixel);
 
+static cairo_pattern_t *
+_svg_cairo_gradient_cache_lookup (svg_cairo_t *svg_cairo, svg_gradient_t *gradient);
+
+static void
+_svg_cairo_gradient_cache_add (svg_cairo_t *svg_cairo, svg_gradient_t *gradient, cairo_pattern_t *pattern);
+
+static void
+_svg_cairo_gradient_cache_clear (svg_cairo_t *svg_cairo);
+
+static int
+_svg_cairo_gradient_cache_hash (svg_gradient_t *gradient);
+
+static const char *
+_svg_cairo_intern_font_family (svg_cairo_t *svg_cairo, const char *family);
+
+static cairo_pattern_t *
+_svg_cairo_pattern_cache_lookup (svg_cairo_t *svg_cairo, svg_element_t *pattern_element,
+				 int width, int height);
+
+static void
+_svg_cairo_pattern_cache_add (svg_cairo_t *svg_cairo, svg_element_t *pattern_element,
+			      int width, int height, cairo_pattern_t *pattern);
+
+static void
+_svg_cairo_pattern_cache_clear (svg_cairo_t *svg_cairo);
+
+static void
+_svg_cairo_pattern_inherited_get (svg_cairo_t *svg_cairo, svg_cairo_pattern_inherited_t *inherited);
+
+static int
+_svg_cairo_pattern_inherited_equal (const svg_cairo_pattern_inherited_t *a,
+				    const svg_cairo_pattern_inherited_t *b);
+
 static svg_render_engine_t SVG_CAIRO_RENDER_ENGINE = {
     /* hierarchy */
     _svg_cairo_begin_group,
@@ -258,7 +319,13 @@ static svg_render_engine_t SVG_CAIRO_RENDER_ENGINE = {
     _svg_cairo_render_ellipse,
     _svg_cairo_render_rect,
     _svg_cairo_render_text,
-    _svg_cairo_render_image
+    _svg_cairo_render_image,
+    /* culling */
+    _svg_cairo_test_bbox,
+    /* encoded images */
+    _svg_cairo_set_image_source,
+    _svg_cairo_get_image_resolution,
+    _svg_cairo_set_image_opaque
 };
 
 svg_cairo_status_t
@@ -271,12 +338,36 @@ svg_cairo_create (svg_cairo_t **svg_cairo)
 	return SVG_CAIRO_STATUS_NO_MEMORY;
     }
 
+    (*svg_cairo)->svg_is_shared = 0;
     (*svg_cairo)->cr = NULL;
     (*svg_cairo)->state = NULL;
+    (*svg_cairo)->state_pool = NULL;
+    (*svg_cairo)->font_families = NULL;
+    (*svg_cairo)->num_font_families = 0;
+    (*svg_cairo)->font_families_size = 0;
     /* XXX: These arbitrary constants don't belong. The viewport
      * handling should be reworked. */
     (*svg_cairo)->viewport_width = 450;
     (*svg_cairo)->viewport_height = 450;
+    (*svg_cairo)->detail_threshold = 0;
+    (*svg_cairo)->image_resolution = 0;
+    (*svg_cairo)->gradient_cache = NULL;
+    (*svg_cairo)->num_gradient_cache = 0;
+    (*svg_cairo)->gradient_cache_size = 0;
+    memset ((*svg_cairo)->gradient_cache_bucket, 0xff, sizeof ((*svg_cairo)->gradient_cache_bucket));
+    (*svg_cairo)->pattern_cache = NULL;
+    (*svg_cairo)->num_pattern_cache = 0;
+    (*svg_cairo)->pattern_cache_size = 0;
+    (*svg_cairo)->glyph_run_buckets = NULL;
+    (*svg_cairo)->glyph_run_first = NULL;
+    (*svg_cairo)->glyph_run_last = NULL;
+    (*svg_cairo)->num_glyph_runs = 0;
+    (*svg_cairo)->glyphs = NULL;
+    (*svg_cairo)->glyphs_size = 0;
+    (*svg_cairo)->target_is_vector = 0;
+    (*svg_cairo)->image_source = NULL;
+    (*svg_cairo)->image_source_size = 0;
+    (*svg_cairo)->image_opaque = 0;
  
     status = (svg_cairo_status_t)svg_create (&(*svg_cairo)->svg);
     if (status)
@@ -287,14 +378,56 @@ svg_cairo_create (svg_cairo_t **svg_cairo)
     return SVG_CAIRO_STATUS_SUCCESS;
 }
 
+svg_cairo_status_t
+svg_cairo_prepare_shared (svg_cairo_t *svg_cairo)
+{
+    return (svg_cairo_status_t)svg_prepare_shared (svg_cairo->svg);
+}
+
+svg_cairo_status_t
+svg_cairo_create_shared (svg_cairo_t **svg_cairo, svg_cairo_t *other)
+{
+    svg_cairo_status_t status;
+
+    if (! svg_is_shared (other->svg))
+	return SVG_CAIRO_STATUS_INVALID_CALL;
+
+    status = svg_cairo_create (svg_cairo);
+    if (status)
+	return status;
+
+    svg_destroy ((*svg_cairo)->svg);
+    (*svg_cairo)->svg = other->svg;
+    (*svg_cairo)->svg_is_shared = 1;
+    (*svg_cairo)->detail_threshold = other->detail_threshold;
+    (*svg_cairo)->image_resolution = other->image_resolution;
+
+    return SVG_CAIRO_STATUS_SUCCESS;
+}
+
 svg_cairo_status_t
 svg_cairo_destroy (svg_cairo_t *svg_cairo)
 {
     svg_cairo_status_t status;
+    int i;
 
     _svg_cairo_pop_state (svg_cairo);
 
-    status = (svg_cairo_status_t)svg_destroy (svg_cairo->svg);
+    _svg_cairo_gradient_cache_clear (svg_cairo);
+    free (svg_cairo->gradient_cache);
+    _svg_cairo_pattern_cache_clear (svg_cairo);
+    free (svg_cairo->pattern_cache);
+    _svg_cairo_glyph_run_cache_destroy (svg_cairo);
+
+    _svg_cairo_state_destroy_pool (&svg_cairo->state_pool);
+    for (i = 0; i < svg_cairo->num_font_families; i++)
+	free (svg_cairo->font_families[i]);
+    free (svg_cairo->font_families);
+
+    if (svg_cairo->svg_is_shared)
+	status = SVG_CAIRO_STATUS_SUCCESS;
+    else
+	status = (svg_cairo_status_t)svg_destroy (svg_cairo->svg);
 
     free (svg_cairo);
 
@@ -337,11 +470,68 @@ svg_cairo_parse_chunk_end (svg_cairo_t *svg_cairo)
     return (svg_cairo_status_t)svg_parse_chunk_end (svg_cairo->svg);
 }
 
+svg_cairo_status_t
+svg_cairo_parse_compiled (svg_cairo_t *svg_cairo, const void *data, size_t size)
+{
+    return (svg_cairo_status_t)svg_parse_compiled (svg_cairo->svg, data, size);
+}
+
+svg_cairo_status_t
+svg_cairo_compile (svg_cairo_t *svg_cairo, void **data, size_t *size)
+{
+    return (svg_cairo_status_t)svg_compile (svg_cairo->svg, data, size);
+}
+
 svg_cairo_status_t
 svg_cairo_render (svg_cairo_t *svg_cairo, cairo_t *cr)
 {
+    svg_status_t status;
+
     svg_cairo->cr = cr;
-    return (svg_cairo_status_t)svg_render (svg_cairo->svg, &SVG_CAIRO_RENDER_ENGINE, svg_cairo);
+    svg_cairo->target_is_vector = _svg_cairo_target_is_vector (cairo_get_target (cr));
+    status = svg_render (svg_cairo->svg, &SVG_CAIRO_RENDER_ENGINE, svg_cairo);
+
+    /* The caches are keyed on pointers (gradients, the target
+       surface), which are not guaranteed to outlive the render. */
+    _svg_cairo_gradient_cache_clear (svg_cairo);
+    _svg_cairo_pattern_cache_clear (svg_cairo);
+
+    return (svg_cairo_status_t)status;
+}
+
+void
+svg_cairo_set_detail_threshold (svg_cairo_t *svg_cairo, double pixels)
+{
+    svg_cairo->detail_threshold = pixels > 0 ? pixels : 0;
+}
+
+void
+svg_cairo_set_image_resolution (svg_cairo_t *svg_cairo, double pixels)
+{
+    svg_cairo->image_resolution = pixels > 0 ? pixels : 0;
+}
+
+svg_cairo_status_t
+svg_cairo_render_region (svg_cairo_t *svg_cairo, cairo_t *cr,
+			 double x, double y, double width, double height)
+{
+    svg_status_t status;
+
+    cairo_save (cr);
+    cairo_rectangle (cr, x, y, width, height);
+    cairo_clip (cr);
+
+    svg_cairo->cr = cr;
+    svg_cairo->target_is_vector = _svg_cairo_target_is_vector (cairo_get_target (cr));
+    status = svg_render_region (svg_cairo->svg, &SVG_CAIRO_RENDER_ENGINE, svg_cairo,
+				x, y, width, height);
+
+    _svg_cairo_gradient_cache_clear (svg_cairo);
+    _svg_cairo_pattern_cache_clear (svg_cairo);
+
+    cairo_restore (cr);
+
+    return (svg_cairo_status_t)status;
 }
 
 static svg_status_t
@@ -387,23 +577,113 @@ svg_cairo_get_size (svg_cairo_t  *svg_cairo,
     *height = (unsigned int) (height_d + 0.5);
 }
 
+/* Same choice of scale as _svg_cairo_apply_view_box; for a viewBox
+   that isn't scaled uniformly, the larger of the two. */
+double
+svg_cairo_get_content_scale (svg_cairo_t *svg_cairo)
+{
+    svg_length_t width_len, height_len;
+    svg_view_box_t view_box;
+    double phys_width, phys_height;
+    double sx, sy;
+
+    svg_get_view_box (svg_cairo->svg, &view_box);
+    if (view_box.aspect_ratio == SVG_PRESERVE_ASPECT_RATIO_UNKNOWN ||
+	view_box.box.width <= 0 || view_box.box.height <= 0)
+	return 1.0;
+
+    svg_get_size (svg_cairo->svg, &width_len, &height_len);
+    _svg_cairo_length_to_pixel (svg_cairo, &width_len, &phys_width);
+    _svg_cairo_length_to_pixel (svg_cairo, &height_len, &phys_height);
+    if (phys_width <= 0 || phys_height <= 0)
+	return 1.0;
+
+    sx = phys_width / view_box.box.width;
+    sy = phys_height / view_box.box.height;
+
+    if (view_box.aspect_ratio == SVG_PRESERVE_ASPECT_RATIO_NONE)
+	return sx > sy ? sx : sy;
+
+    if ((view_box.box.width / view_box.box.height < phys_width / phys_height &&
+	 view_box.meet_or_slice == SVG_MEET_OR_SLICE_MEET) ||
+	(view_box.box.width / view_box.box.height >= phys_width / phys_height &&
+	 view_box.meet_or_slice == SVG_MEET_OR_SLICE_SLICE))
+	return sy;
+
+    return sx;
+}
+
+svg_cairo_status_t
+svg_cairo_simplify_paths (svg_cairo_t *svg_cairo, double tolerance)
+{
+    return (svg_cairo_status_t) svg_simplify_paths (svg_cairo->svg, tolerance);
+}
+
+unsigned long
+svg_cairo_get_elided_state_count (svg_cairo_t *svg_cairo)
+{
+    return svg_get_elided_state_count (svg_cairo->svg);
+}
+
+unsigned long
+svg_cairo_get_simplified_point_count (svg_cairo_t *svg_cairo)
+{
+    return svg_get_simplified_point_count (svg_cairo->svg);
+}
+
+/* A group with opacity is drawn into an unbounded recording surface
+ * rather than a viewport-sized image: nothing is rasterized until
+ * end_group, which composites it clipped to the ink extents of what
+ * was actually drawn. libsvg already folds the opacity into the
+ * paint of single-child groups where that is equivalent.
+ *
+ * The recording is clipped to the device pixels of the parent's
+ * clip, which nothing outside could show through, so that
+ * test_bbox still culls the children of the group. */
 static svg_status_t
 _svg_cairo_begin_group (void *closure, double opacity)
 {
     svg_cairo_t *svg_cairo = (svg_cairo_t *)closure;
     cairo_surface_t *child_surface = NULL;
+    cairo_matrix_t ctm;
+    double x1, y1, x2, y2;
+    svg_status_t status;
 
     cairo_save (svg_cairo->cr);
 
     if (opacity != 1.0) {
-	child_surface = cairo_surface_create_similar (cairo_get_target (svg_cairo->cr),
-						      (cairo_content_t)CAIRO_FORMAT_ARGB32,
-						      svg_cairo->state->viewport_width,
-						      svg_cairo->state->viewport_height);
+	cairo_get_matrix (svg_cairo->cr, &ctm);
+	cairo_identity_matrix (svg_cairo->cr);
+	cairo_clip_extents (svg_cairo->cr, &x1, &y1, &x2, &y2);
+	cairo_set_matrix (svg_cairo->cr, &ctm);
+
+	child_surface = cairo_recording_surface_create (CAIRO_CONTENT_COLOR_ALPHA, NULL);
 	svg_cairo->state->child_surface = child_surface;
     }
 
-    _svg_cairo_push_state (svg_cairo, child_surface);
+    status = _svg_cairo_push_state (svg_cairo, child_surface);
+    if (status)
+	return status;
+
+    if (child_surface) {
+	svg_cairo->state->composite_group = 1;
+
+	/* infinite when the parent is itself unbounded */
+	if (x1 > -HUGE_VAL && y1 > -HUGE_VAL && x2 < HUGE_VAL && y2 < HUGE_VAL) {
+	    /* whole pixels, so the parent's antialiased edge isn't
+	     * applied twice */
+	    x1 = floor (x1);
+	    y1 = floor (y1);
+	    x2 = ceil (x2);
+	    y2 = ceil (y2);
+
+	    cairo_get_matrix (svg_cairo->cr, &ctm);
+	    cairo_identity_matrix (svg_cairo->cr);
+	    cairo_rectangle (svg_cairo->cr, x1, y1, x2 - x1, y2 - y1);
+	    cairo_clip (svg_cairo->cr);
+	    cairo_set_matrix (svg_cairo->cr, &ctm);
+	}
+    }
 
     return _cairo_status_to_svg_status (cairo_status (svg_cairo->cr));
 }
@@ -443,12 +723,22 @@ _svg_cairo_end_group (void *closure, double opacity)
 
     cairo_restore (svg_cairo->cr);
 
-    if (opacity != 1.0) {
-	cairo_save (svg_cairo->cr);
-	cairo_identity_matrix (svg_cairo->cr);
-	cairo_set_source_surface (svg_cairo->cr, svg_cairo->state->child_surface, 0, 0);
-	cairo_paint_with_alpha (svg_cairo->cr, opacity);
-	cairo_restore (svg_cairo->cr);
+    if (opacity != 1.0 && svg_cairo->state->child_surface) {
+	double x, y, width, height;
+
+	cairo_recording_surface_ink_extents (svg_cairo->state->child_surface,
+					     &x, &y, &width, &height);
+	if (width > 0 && height > 0) {
+	    cairo_save (svg_cairo->cr);
+	    cairo_identity_matrix (svg_cairo->cr);
+	    /* Without the clip, replaying the recording onto an image
+	     * target would allocate a temporary of the whole target. */
+	    cairo_rectangle (svg_cairo->cr, x, y, width, height);
+	    cairo_clip (svg_cairo->cr);
+	    cairo_set_source_surface (svg_cairo->cr, svg_cairo->state->child_surface, 0, 0);
+	    cairo_paint_with_alpha (svg_cairo->cr, opacity);
+	    cairo_restore (svg_cairo->cr);
+	}
 	cairo_surface_destroy (svg_cairo->state->child_surface);
 	svg_cairo->state->child_surface = NULL;
     }
@@ -577,55 +867,60 @@ _svg_cairo_set_gradient (svg_cairo_t *svg_cairo,
     } break;
     }
     
-    switch (gradient->type) {
-    case SVG_GRADIENT_LINEAR:
-    {
-	double x1, y1, x2, y2;
-      
-	_svg_cairo_length_to_pixel (svg_cairo, &gradient->u.linear.x1, &x1);
-	_svg_cairo_length_to_pixel (svg_cairo, &gradient->u.linear.y1, &y1);
-	_svg_cairo_length_to_pixel (svg_cairo, &gradient->u.linear.x2, &x2);
-	_svg_cairo_length_to_pixel (svg_cairo, &gradient->u.linear.y2, &y2);
+    pattern = _svg_cairo_gradient_cache_lookup (svg_cairo, gradient);
+    if (pattern == NULL) {
+	switch (gradient->type) {
+	case SVG_GRADIENT_LINEAR:
+	{
+	    double x1, y1, x2, y2;
 
-	pattern = cairo_pattern_create_linear (x1, y1, x2, y2);
-    }
-    break;
-    case SVG_GRADIENT_RADIAL:
-    {
-	double cx, cy, r, fx, fy;
-      
-	_svg_cairo_length_to_pixel (svg_cairo, &gradient->u.radial.cx, &cx);
-	_svg_cairo_length_to_pixel (svg_cairo, &gradient->u.radial.cy, &cy);
-	_svg_cairo_length_to_pixel (svg_cairo, &gradient->u.radial.r, &r);
-	_svg_cairo_length_to_pixel (svg_cairo, &gradient->u.radial.fx, &fx);
-	_svg_cairo_length_to_pixel (svg_cairo, &gradient->u.radial.fy, &fy);
-
-	pattern = cairo_pattern_create_radial (fx, fy, 0.0, cx, cy, r);
-    } break;
-    }
-    
-    for (i = 0; i < gradient->num_stops; i++) {
-	stop = &gradient->stops[i];
-	cairo_pattern_add_color_stop_rgba (pattern, stop->offset,
-					   svg_color_get_red (&stop->color) / 255.0,
-					   svg_color_get_green (&stop->color) / 255.0,
-					   svg_color_get_blue (&stop->color) / 255.0,
-					   stop->opacity);
-    }
-	    
-    switch (gradient->spread) {
-    case SVG_GRADIENT_SPREAD_REPEAT:
-	cairo_pattern_set_extend (pattern, CAIRO_EXTEND_REPEAT);
-	break;
-    case SVG_GRADIENT_SPREAD_REFLECT:
-	cairo_pattern_set_extend (pattern, CAIRO_EXTEND_REFLECT);
-	break;
-    default:
-	cairo_pattern_set_extend (pattern, CAIRO_EXTEND_NONE);
+	    _svg_cairo_length_to_pixel (svg_cairo, &gradient->u.linear.x1, &x1);
+	    _svg_cairo_length_to_pixel (svg_cairo, &gradient->u.linear.y1, &y1);
+	    _svg_cairo_length_to_pixel (svg_cairo, &gradient->u.linear.x2, &x2);
+	    _svg_cairo_length_to_pixel (svg_cairo, &gradient->u.linear.y2, &y2);
+
+	    pattern = cairo_pattern_create_linear (x1, y1, x2, y2);
+	}
 	break;
+	case SVG_GRADIENT_RADIAL:
+	{
+	    double cx, cy, r, fx, fy;
+
+	    _svg_cairo_length_to_pixel (svg_cairo, &gradient->u.radial.cx, &cx);
+	    _svg_cairo_length_to_pixel (svg_cairo, &gradient->u.radial.cy, &cy);
+	    _svg_cairo_length_to_pixel (svg_cairo, &gradient->u.radial.r, &r);
+	    _svg_cairo_length_to_pixel (svg_cairo, &gradient->u.radial.fx, &fx);
+	    _svg_cairo_length_to_pixel (svg_cairo, &gradient->u.radial.fy, &fy);
+
+	    pattern = cairo_pattern_create_radial (fx, fy, 0.0, cx, cy, r);
+	} break;
+	}
+
+	for (i = 0; i < gradient->num_stops; i++) {
+	    stop = &gradient->stops[i];
+	    cairo_pattern_add_color_stop_rgba (pattern, stop->offset,
+					       svg_color_get_red (&stop->color) / 255.0,
+					       svg_color_get_green (&stop->color) / 255.0,
+					       svg_color_get_blue (&stop->color) / 255.0,
+					       stop->opacity);
+	}
+
+	switch (gradient->spread) {
+	case SVG_GRADIENT_SPREAD_REPEAT:
+	    cairo_pattern_set_extend (pattern, CAIRO_EXTEND_REPEAT);
+	    break;
+	case SVG_GRADIENT_SPREAD_REFLECT:
+	    cairo_pattern_set_extend (pattern, CAIRO_EXTEND_REFLECT);
+	    break;
+	default:
+	    cairo_pattern_set_extend (pattern, CAIRO_EXTEND_NONE);
+	    break;
+	}
+
+	cairo_pattern_set_filter (pattern, CAIRO_FILTER_BILINEAR);
+
+	_svg_cairo_gradient_cache_add (svg_cairo, gradient, pattern);
     }
-    
-    cairo_pattern_set_filter (pattern, CAIRO_FILTER_BILINEAR);
 
     cairo_matrix_init (&gradient_matrix,
 		       gradient->transform[0], gradient->transform[1],
@@ -643,6 +938,209 @@ _svg_cairo_set_gradient (svg_cairo_t *svg_cairo,
     return SVG_STATUS_SUCCESS;
 }
 
+/* Returns a new reference to the pattern built for gradient, if its
+   lengths resolved the same way, or NULL. The pattern matrix is
+   overwritten by every user; cairo copies patterns it keeps around
+   (recording, PDF), so that is safe. */
+static cairo_pattern_t *
+_svg_cairo_gradient_cache_lookup (svg_cairo_t *svg_cairo, svg_gradient_t *gradient)
+{
+    svg_cairo_gradient_cache_t *entry;
+    int i;
+
+    for (i = svg_cairo->gradient_cache_bucket[_svg_cairo_gradient_cache_hash (gradient)];
+	 i >= 0; i = entry->next_in_bucket) {
+	entry = &svg_cairo->gradient_cache[i];
+	if (entry->gradient == gradient
+	    && entry->viewport_width == svg_cairo->state->viewport_width
+	    && entry->viewport_height == svg_cairo->state->viewport_height
+	    && entry->font_size == svg_cairo->state->font_size)
+	    return cairo_pattern_reference (entry->pattern);
+    }
+
+    return NULL;
+}
+
+static void
+_svg_cairo_gradient_cache_add (svg_cairo_t *svg_cairo, svg_gradient_t *gradient, cairo_pattern_t *pattern)
+{
+    svg_cairo_gradient_cache_t *new_cache, *entry;
+    int hash;
+
+    if (svg_cairo->num_gradient_cache >= svg_cairo->gradient_cache_size) {
+	int new_size = svg_cairo->gradient_cache_size ? svg_cairo->gradient_cache_size * 2 : 8;
+	new_cache = (svg_cairo_gradient_cache_t *)realloc (svg_cairo->gradient_cache,
+				new_size * sizeof (svg_cairo_gradient_cache_t));
+	/* Not caching is not an error */
+	if (new_cache == NULL)
+	    return;
+	svg_cairo->gradient_cache = new_cache;
+	svg_cairo->gradient_cache_size = new_size;
+    }
+
+    hash = _svg_cairo_gradient_cache_hash (gradient);
+
+    entry = &svg_cairo->gradient_cache[svg_cairo->num_gradient_cache];
+    entry->gradient = gradient;
+    entry->viewport_width = svg_cairo->state->viewport_width;
+    entry->viewport_height = svg_cairo->state->viewport_height;
+    entry->font_size = svg_cairo->state->font_size;
+    entry->pattern = cairo_pattern_reference (pattern);
+    entry->next_in_bucket = svg_cairo->gradient_cache_bucket[hash];
+    svg_cairo->gradient_cache_bucket[hash] = svg_cairo->num_gradient_cache++;
+}
+
+static void
+_svg_cairo_gradient_cache_clear (svg_cairo_t *svg_cairo)
+{
+    int i;
+
+    for (i = 0; i < svg_cairo->num_gradient_cache; i++)
+	cairo_pattern_destroy (svg_cairo->gradient_cache[i].pattern);
+    svg_cairo->num_gradient_cache = 0;
+    memset (svg_cairo->gradient_cache_bucket, 0xff, sizeof (svg_cairo->gradient_cache_bucket));
+}
+
+/* gradients are allocated, their low bits are alike */
+static int
+_svg_cairo_gradient_cache_hash (svg_gradient_t *gradient)
+{
+    return (int) (((size_t) gradient >> 4) % SVG_CAIRO_GRADIENT_CACHE_BUCKETS);
+}
+
+static cairo_pattern_t *
+_svg_cairo_pattern_cache_lookup (svg_cairo_t *svg_cairo, svg_element_t *pattern_element,
+				 int width, int height)
+{
+    svg_cairo_pattern_cache_t *entry;
+    svg_cairo_pattern_inherited_t inherited;
+    int i;
+
+    _svg_cairo_pattern_inherited_get (svg_cairo, &inherited);
+
+    for (i = 0; i < svg_cairo->num_pattern_cache; i++) {
+	entry = &svg_cairo->pattern_cache[i];
+	if (entry->pattern_element == pattern_element
+	    && entry->width == width
+	    && entry->height == height
+	    && entry->target == cairo_get_target (svg_cairo->cr)
+	    && _svg_cairo_pattern_inherited_equal (&entry->inherited, &inherited))
+	    return cairo_pattern_reference (entry->pattern);
+    }
+
+    return NULL;
+}
+
+static void
+_svg_cairo_pattern_cache_add (svg_cairo_t *svg_cairo, svg_element_t *pattern_element,
+			      int width, int height, cairo_pattern_t *pattern)
+{
+    svg_cairo_pattern_cache_t *new_cache, *entry;
+    svg_cairo_pattern_inherited_t inherited;
+    double *dash = NULL;
+
+    _svg_cairo_pattern_inherited_get (svg_cairo, &inherited);
+    if (inherited.num_dashes) {
+	dash = (double *)malloc (inherited.num_dashes * sizeof (double));
+	if (dash == NULL)
+	    return;
+	memcpy (dash, inherited.dash, inherited.num_dashes * sizeof (double));
+    }
+    inherited.dash = dash;
+
+    if (svg_cairo->num_pattern_cache >= svg_cairo->pattern_cache_size) {
+	int new_size = svg_cairo->pattern_cache_size ? svg_cairo->pattern_cache_size * 2 : 8;
+	new_cache = (svg_cairo_pattern_cache_t *)realloc (svg_cairo->pattern_cache,
+				new_size * sizeof (svg_cairo_pattern_cache_t));
+	if (new_cache == NULL) {
+	    free (dash);
+	    return;
+	}
+	svg_cairo->pattern_cache = new_cache;
+	svg_cairo->pattern_cache_size = new_size;
+    }
+
+    entry = &svg_cairo->pattern_cache[svg_cairo->num_pattern_cache++];
+    entry->pattern_element = pattern_element;
+    entry->width = width;
+    entry->height = height;
+    entry->target = cairo_get_target (svg_cairo->cr);
+    entry->inherited = inherited;
+    entry->pattern = cairo_pattern_reference (pattern);
+}
+
+static void
+_svg_cairo_pattern_cache_clear (svg_cairo_t *svg_cairo)
+{
+    int i;
+
+    for (i = 0; i < svg_cairo->num_pattern_cache; i++) {
+	cairo_pattern_destroy (svg_cairo->pattern_cache[i].pattern);
+	free (svg_cairo->pattern_cache[i].inherited.dash);
+    }
+    svg_cairo->num_pattern_cache = 0;
+}
+
+/* The dash is the state's, not a copy. */
+static void
+_svg_cairo_pattern_inherited_get (svg_cairo_t *svg_cairo, svg_cairo_pattern_inherited_t *inherited)
+{
+    svg_cairo_state_t *state = svg_cairo->state;
+
+    inherited->color = state->color;
+    inherited->fill_opacity = state->fill_opacity;
+    inherited->stroke_opacity = state->stroke_opacity;
+    inherited->opacity = state->opacity;
+
+    inherited->font_family = state->font_family;
+    inherited->font_size = state->font_size;
+    inherited->font_style = state->font_style;
+    inherited->font_weight = state->font_weight;
+
+    inherited->dash = state->dash;
+    inherited->num_dashes = state->num_dashes;
+    inherited->dash_offset = state->dash_offset;
+
+    inherited->text_anchor = state->text_anchor;
+
+    inherited->viewport_width = state->viewport_width;
+    inherited->viewport_height = state->viewport_height;
+
+    inherited->fill_rule = cairo_get_fill_rule (svg_cairo->cr);
+    inherited->line_width = cairo_get_line_width (svg_cairo->cr);
+    inherited->line_cap = cairo_get_line_cap (svg_cairo->cr);
+    inherited->line_join = cairo_get_line_join (svg_cairo->cr);
+    inherited->miter_limit = cairo_get_miter_limit (svg_cairo->cr);
+}
+
+static int
+_svg_cairo_pattern_inherited_equal (const svg_cairo_pattern_inherited_t *a,
+				    const svg_cairo_pattern_inherited_t *b)
+{
+    /* font families are interned: the same name is the same pointer */
+    return a->color.is_current_color == b->color.is_current_color
+	&& a->color.rgb == b->color.rgb
+	&& a->fill_opacity == b->fill_opacity
+	&& a->stroke_opacity == b->stroke_opacity
+	&& a->opacity == b->opacity
+	&& a->font_family == b->font_family
+	&& a->font_size == b->font_size
+	&& a->font_style == b->font_style
+	&& a->font_weight == b->font_weight
+	&& a->num_dashes == b->num_dashes
+	&& (a->num_dashes == 0
+	    || memcmp (a->dash, b->dash, a->num_dashes * sizeof (double)) == 0)
+	&& a->dash_offset == b->dash_offset
+	&& a->text_anchor == b->text_anchor
+	&& a->viewport_width == b->viewport_width
+	&& a->viewport_height == b->viewport_height
+	&& a->fill_rule == b->fill_rule
+	&& a->line_width == b->line_width
+	&& a->line_cap == b->line_cap
+	&& a->line_join == b->line_join
+	&& a->miter_limit == b->miter_limit;
+}
+
 static svg_status_t
 _svg_cairo_set_pattern (svg_cairo_t *svg_cairo,
 			svg_element_t *pattern_element,
@@ -652,6 +1150,7 @@ _svg_cairo_set_pattern (svg_cairo_t *svg_cairo,
     cairo_surface_t *pattern_surface;
     cairo_pattern_t *surface_pattern;
     double x_px, y_px, width_px, height_px;
+    int width, height;
     cairo_path_t *path;
 
     _svg_cairo_length_to_pixel (svg_cairo, &pattern->x, &x_px);
@@ -659,6 +1158,20 @@ _svg_cairo_set_pattern (svg_cairo_t *svg_cairo,
     _svg_cairo_length_to_pixel (svg_cairo, &pattern->width, &width_px);
     _svg_cairo_length_to_pixel (svg_cairo, &pattern->height, &height_px);
 
+    width = (int) (width_px + 0.5);
+    height = (int) (height_px + 0.5);
+
+    /* The tile depends on its size and on the state its content
+     * inherits, so hatching many shapes alike with the same pattern
+     * renders it once. */
+    surface_pattern = _svg_cairo_pattern_cache_lookup (svg_cairo, pattern_element,
+						       width, height);
+    if (surface_pattern) {
+	cairo_set_source (svg_cairo->cr, surface_pattern);
+	cairo_pattern_destroy (surface_pattern);
+	return SVG_STATUS_SUCCESS;
+    }
+
     /* OK. We've got the final path to be filled/stroked inside the
      * cairo context right now. But we're also going to re-use that
      * same context to draw the pattern. And since the path is no
@@ -677,8 +1190,7 @@ _svg_cairo_set_pattern (svg_cairo_t *svg_cairo,
 
     pattern_surface = cairo_surface_create_similar (cairo_get_target (svg_cairo->cr),
 						    (cairo_content_t)CAIRO_FORMAT_ARGB32,
-						    (int) (width_px + 0.5),
-						    (int) (height_px + 0.5));
+						    width, height);
 
     _svg_cairo_push_state (svg_cairo, pattern_surface);
     cairo_identity_matrix (svg_cairo->cr);
@@ -698,6 +1210,9 @@ _svg_cairo_set_pattern (svg_cairo_t *svg_cairo,
     cairo_surface_destroy (pattern_surface);
     
     cairo_pattern_set_extend (surface_pattern, CAIRO_EXTEND_REPEAT);
+
+    _svg_cairo_pattern_cache_add (svg_cairo, pattern_element,
+				  width, height, surface_pattern);
     
     cairo_set_source (svg_cairo->cr, surface_pattern);
     
@@ -778,11 +1293,12 @@ _svg_cairo_set_fill_rule (void *closure, svg_fill_rule_t fill_rule)
 static svg_status_t
 _svg_cairo_select_font (svg_cairo_t *svg_cairo)
 {
-    char *family = svg_cairo->state->font_family;
+    const char *family = svg_cairo->state->font_family;
     unsigned int font_weight = svg_cairo->state->font_weight;
     cairo_font_weight_t weight;
     svg_font_style_t font_style = svg_cairo->state->font_style;
     cairo_font_slant_t slant;
+    cairo_font_face_t *font_face;
 
     if (! svg_cairo->state->font_dirty)
 	return SVG_STATUS_SUCCESS;
@@ -804,7 +1320,11 @@ _svg_cairo_select_font (svg_cairo_t *svg_cairo)
 	break;
     }
 
-    cairo_select_font_face (svg_cairo->cr, family, slant, weight);
+    font_face = _svg_cairo_font_face_lookup (family, slant, weight);
+    if (font_face == NULL)
+	return SVG_STATUS_NO_MEMORY;
+    cairo_set_font_face (svg_cairo->cr, font_face);
+    cairo_font_face_destroy (font_face);
     cairo_set_font_size (svg_cairo->cr, svg_cairo->state->font_size);
     svg_cairo->state->font_dirty = 0;
 
@@ -815,12 +1335,16 @@ static svg_status_t
 _svg_cairo_set_font_family (void *closure, const char *family)
 {
     svg_cairo_t *svg_cairo = (svg_cairo_t *)closure;
+    const char *interned;
 
-    if (svg_cairo->state->font_family)
-	free (svg_cairo->state->font_family);
+    interned = _svg_cairo_intern_font_family (svg_cairo, family);
+    if (interned == NULL)
+	return SVG_STATUS_NO_MEMORY;
 
-    svg_cairo->state->font_family = strdup (family);
-    svg_cairo->state->font_dirty = 1;
+    if (interned != svg_cairo->state->font_family) {
+	svg_cairo->state->font_family = interned;
+	svg_cairo->state->font_dirty = 1;
+    }
 
     return _cairo_status_to_svg_status (cairo_status (svg_cairo->cr));
 }
@@ -863,7 +1387,11 @@ _svg_cairo_set_opacity (void *closure, double opacity)
 {
     svg_cairo_t *svg_cairo = (svg_cairo_t *)closure;
 
-    svg_cairo->state->opacity = opacity;
+    /* A composited group applies its opacity in end_group. Otherwise
+       it is multiplied into what was inherited, which is not 1.0 when
+       libsvg folded a group's opacity down to its only child. */
+    if (!svg_cairo->state->composite_group)
+	svg_cairo->state->opacity *= opacity;
 
     return _cairo_status_to_svg_status (cairo_status (svg_cairo->cr));    
 }
@@ -873,8 +1401,11 @@ _svg_cairo_set_stroke_dash_array (void *closure, double *dash, int num_dashes)
 {
     svg_cairo_t *svg_cairo = (svg_cairo_t *)closure;
 
-    free (svg_cairo->state->dash);
+    /* Copy on write: the array may still be the parent's */
+    if (svg_cairo->state->dash_owned)
+	free (svg_cairo->state->dash);
     svg_cairo->state->dash = NULL;
+    svg_cairo->state->dash_owned = 0;
 
     svg_cairo->state->num_dashes = num_dashes;
 
@@ -882,6 +1413,7 @@ _svg_cairo_set_stroke_dash_array (void *closure, double *dash, int num_dashes)
 	svg_cairo->state->dash = (double *)malloc(svg_cairo->state->num_dashes * sizeof(double));
 	if (svg_cairo->state->dash == NULL)
 	    return SVG_STATUS_NO_MEMORY;
+	svg_cairo->state->dash_owned = 1;
 
 	memcpy(svg_cairo->state->dash, dash, svg_cairo->state->num_dashes * sizeof(double));
 
@@ -1172,36 +1704,57 @@ _svg_cairo_render_text (void *closure,
     double x, y;
     svg_status_t status;
     svg_paint_t *fill_paint, *stroke_paint;
+    svg_cairo_glyph_run_t *run;
+    cairo_glyph_t *glyphs;
+    cairo_status_t xr_status;
 
     fill_paint = &svg_cairo->state->fill_paint;
     stroke_paint = &svg_cairo->state->stroke_paint;
 
-    _svg_cairo_select_font (svg_cairo);
+    status = _svg_cairo_select_font (svg_cairo);
+    if (status)
+	return status;
+
+    if (utf8 == NULL)
+	return SVG_STATUS_SUCCESS;
 
     _svg_cairo_length_to_pixel (svg_cairo, x_len, &x);
     _svg_cairo_length_to_pixel (svg_cairo, y_len, &y);
 
-    status = _svg_cairo_move_to (svg_cairo, x, y);
-    if (status)
-	return status;
-
-    if (svg_cairo->state->text_anchor != SVG_TEXT_ANCHOR_START) {
-	cairo_text_extents_t extents;
-	cairo_text_extents (svg_cairo->cr, utf8, &extents);
+    /* the glyphs of the text, as cairo_show_text would find them,
+       once per string in this font, size and transform */
+    xr_status = _svg_cairo_glyph_run_lookup (svg_cairo, cairo_get_scaled_font (svg_cairo->cr),
+					     utf8, &run);
+    if (xr_status)
+	return _cairo_status_to_svg_status (xr_status);
+    if (run->num_glyphs == 0)
+	return SVG_STATUS_SUCCESS;
 
-	if (svg_cairo->state->text_anchor == SVG_TEXT_ANCHOR_END)
-	    cairo_rel_move_to (svg_cairo->cr, -extents.x_advance, -extents.y_advance);
-	else if (svg_cairo->state->text_anchor == SVG_TEXT_ANCHOR_MIDDLE)
-	    cairo_rel_move_to (svg_cairo->cr, -extents.x_advance / 2.0, -extents.y_advance / 2.0);
+    if (svg_cairo->state->text_anchor == SVG_TEXT_ANCHOR_END) {
+	x -= run->x_advance;
+	y -= run->y_advance;
+    } else if (svg_cairo->state->text_anchor == SVG_TEXT_ANCHOR_MIDDLE) {
+	x -= run->x_advance / 2.0;
+	y -= run->y_advance / 2.0;
     }
 
+    glyphs = _svg_cairo_glyph_run_place (svg_cairo, run, x, y);
+    if (glyphs == NULL)
+	return SVG_STATUS_NO_MEMORY;
+
     if (fill_paint->type) {
 	if (stroke_paint->type)
 	    cairo_save (svg_cairo->cr);
 	_svg_cairo_set_paint_and_opacity (svg_cairo, fill_paint,
 					  svg_cairo->state->fill_opacity,
 					  SVG_CAIRO_RENDER_TYPE_FILL);
-	cairo_show_text (svg_cairo->cr, utf8);
+	/* a PDF keeps the text, for search and copy */
+	if (cairo_surface_has_show_text_glyphs (cairo_get_target (svg_cairo->cr)))
+	    cairo_show_text_glyphs (svg_cairo->cr, utf8, -1,
+				    glyphs, run->num_glyphs,
+				    run->clusters, run->num_clusters, run->cluster_flags);
+	else
+	    cairo_show_glyphs (svg_cairo->cr, glyphs, run->num_glyphs);
 	if (stroke_paint->type)
 	    cairo_restore (svg_cairo->cr);
     }
@@ -1210,7 +1763,7 @@ _svg_cairo_render_text (void *closure,
 	_svg_cairo_set_paint_and_opacity (svg_cairo, stroke_paint,
 					  svg_cairo->state->stroke_opacity,
 					  SVG_CAIRO_RENDER_TYPE_STROKE);
-	cairo_text_path (svg_cairo->cr, utf8);
+	cairo_glyph_path (svg_cairo->cr, glyphs, run->num_glyphs);
 	cairo_stroke (svg_cairo->cr);
     }
 
@@ -1238,8 +1791,34 @@ _svg_cairo_render_image (void		*closure,
     _svg_cairo_length_to_pixel (svg_cairo, width_len, &width);
     _svg_cairo_length_to_pixel (svg_cairo, height_len, &height);
 
-    surface = cairo_image_surface_create_for_data ((unsigned char *)data, CAIRO_FORMAT_ARGB32,
-						   data_width, data_height, data_width *4);
+    /* Without pixels, for a vector target, the surface is only there
+       to carry the JPEG: left blank, which costs pages never touched,
+       opaque so that cairo doesn't take it for clear and skip it.
+       Opaque pixels go in as RGB24, the same layout with the alpha
+       byte ignored, which spares the PDF backend scanning them for
+       transparency and writing a soft mask. */
+    if (data)
+	surface = cairo_image_surface_create_for_data ((unsigned char *)data,
+						       svg_cairo->image_opaque ? CAIRO_FORMAT_RGB24 : CAIRO_FORMAT_ARGB32,
+						       data_width, data_height, data_width *4);
+    else
+	surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24, data_width, data_height);
+    svg_cairo->image_opaque = 0;
+
+    /* The PDF backend embeds the JPEG as is (DCTDecode) instead of
+       compressing the pixels again; it holds on to the surface until
+       the page is written, so it gets its own copy. */
+    if (svg_cairo->image_source) {
+	unsigned char *jpeg = (unsigned char *)malloc (svg_cairo->image_source_size);
+	if (jpeg) {
+	    memcpy (jpeg, svg_cairo->image_source, svg_cairo->image_source_size);
+	    if (cairo_surface_set_mime_data (surface, CAIRO_MIME_TYPE_JPEG,
+					     jpeg, svg_cairo->image_source_size,
+					     free, jpeg))
+		free (jpeg);
+	}
+	svg_cairo->image_source = NULL;
+    }
     cairo_translate (svg_cairo->cr, x, y);
     cairo_scale (svg_cairo->cr, width / data_width, height / data_height);
 
@@ -1253,6 +1832,149 @@ _svg_cairo_render_image (void		*closure,
     return _cairo_status_to_svg_status (cairo_status (svg_cairo->cr));
 }
 
+static svg_status_t
+_svg_cairo_set_image_source (void			*closure,
+			     const char			*mime_type,
+			     const unsigned char	*data,
+			     size_t			size,
+			     int			*need_pixels)
+{
+    svg_cairo_t *svg_cairo = (svg_cairo_t *)closure;
+    cairo_surface_t *target = cairo_get_target (svg_cairo->cr);
+
+    if (mime_type == NULL || strcmp (mime_type, "image/jpeg") != 0) {
+	svg_cairo->image_source = NULL;
+	return SVG_STATUS_SUCCESS;
+    }
+
+    svg_cairo->image_source = data;
+    svg_cairo->image_source_size = size;
+
+    /* A recording surface ends up wherever it is replayed: in the
+       target of an opacity group, the target given, otherwise
+       anywhere (SVGL Convert multiple), and pixels are needed. */
+    if (cairo_surface_get_type (target) == CAIRO_SURFACE_TYPE_RECORDING)
+	*need_pixels = ! svg_cairo->target_is_vector;
+    else
+	*need_pixels = ! _svg_cairo_target_is_vector (target);
+
+    return SVG_STATUS_SUCCESS;
+}
+
+static int
+_svg_cairo_target_is_vector (cairo_surface_t *target)
+{
+    switch (cairo_surface_get_type (target)) {
+    case CAIRO_SURFACE_TYPE_PDF:
+    case CAIRO_SURFACE_TYPE_PS:
+    case CAIRO_SURFACE_TYPE_SVG:
+	return 1;
+    default:
+	return 0;
+    }
+}
+
+/* The device lengths of the sides of the image, rotated or skewed
+   as they may be, times the resolution asked for */
+static svg_status_t
+_svg_cairo_get_image_resolution (void		*closure,
+				 svg_length_t	*width_len,
+				 svg_length_t	*height_len,
+				 double		*x_pixels,
+				 double		*y_pixels)
+{
+    svg_cairo_t *svg_cairo = (svg_cairo_t *)closure;
+    double width, height, dx, dy;
+
+    *x_pixels = *y_pixels = 0;
+    if (svg_cairo->image_resolution == 0)
+	return SVG_STATUS_SUCCESS;
+
+    _svg_cairo_length_to_pixel (svg_cairo, width_len, &width);
+    _svg_cairo_length_to_pixel (svg_cairo, height_len, &height);
+
+    dx = width;
+    dy = 0;
+    cairo_user_to_device_distance (svg_cairo->cr, &dx, &dy);
+    *x_pixels = sqrt (dx * dx + dy * dy) * svg_cairo->image_resolution;
+
+    dx = 0;
+    dy = height;
+    cairo_user_to_device_distance (svg_cairo->cr, &dx, &dy);
+    *y_pixels = sqrt (dx * dx + dy * dy) * svg_cairo->image_resolution;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+static svg_status_t
+_svg_cairo_set_image_opaque (void *closure, int opaque)
+{
+    svg_cairo_t *svg_cairo = (svg_cairo_t *)closure;
+
+    svg_cairo->image_opaque = opaque;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+/* cairo_clip_extents is in user space, so this also covers a zoomed
+   or translated page. Unbounded targets (the recording surfaces of
+   opacity groups) report infinite extents and never cull. */
+static svg_status_t
+_svg_cairo_test_bbox (void	*closure,
+		      double	x1,
+		      double	y1,
+		      double	x2,
+		      double	y2,
+		      int	*visible)
+{
+    svg_cairo_t *svg_cairo = (svg_cairo_t *)closure;
+    double clip_x1, clip_y1, clip_x2, clip_y2;
+    double x[4], y[4], min_x, min_y, max_x, max_y;
+    int i;
+
+    *visible = SVG_BBOX_VISIBLE;
+
+    if (cairo_status (svg_cairo->cr))
+	return SVG_STATUS_SUCCESS;
+
+    cairo_clip_extents (svg_cairo->cr, &clip_x1, &clip_y1, &clip_x2, &clip_y2);
+
+    if (x2 < clip_x1 || x1 > clip_x2 || y2 < clip_y1 || y1 > clip_y2) {
+	*visible = SVG_BBOX_HIDDEN;
+	return SVG_STATUS_SUCCESS;
+    }
+
+    if (svg_cairo->detail_threshold <= 0)
+	return SVG_STATUS_SUCCESS;
+
+    /* the box's extent on the device, whatever the rotation */
+    x[0] = x1; y[0] = y1;
+    x[1] = x2; y[1] = y1;
+    x[2] = x1; y[2] = y2;
+    x[3] = x2; y[3] = y2;
+    for (i = 0; i < 4; i++)
+	cairo_user_to_device (svg_cairo->cr, &x[i], &y[i]);
+
+    min_x = max_x = x[0];
+    min_y = max_y = y[0];
+    for (i = 1; i < 4; i++) {
+	if (x[i] < min_x)
+	    min_x = x[i];
+	if (x[i] > max_x)
+	    max_x = x[i];
+	if (y[i] < min_y)
+	    min_y = y[i];
+	if (y[i] > max_y)
+	    max_y = y[i];
+    }
+
+    if (max_x - min_x < svg_cairo->detail_threshold
+	&& max_y - min_y < svg_cairo->detail_threshold)
+	*visible = SVG_BBOX_BELOW_DETAIL;
+
+    return SVG_STATUS_SUCCESS;
+}
+
 static svg_status_t
 _cairo_status_to_svg_status (cairo_status_t xr_status)
 {
@@ -1287,6 +2009,16 @@ _svg_cairo_copy_cairo_state (svg_cairo_t *svg_cairo,
     cairo_set_line_join (new_cr, cairo_get_line_join (old_cr));
     cairo_set_miter_limit (new_cr, cairo_get_miter_limit (old_cr));
 
+    /* The state's font_dirty is inherited, so the selected font has
+     * to come along too. */
+    {
+	cairo_matrix_t font_matrix;
+
+	cairo_set_font_face (new_cr, cairo_get_font_face (old_cr));
+	cairo_get_font_matrix (old_cr, &font_matrix);
+	cairo_set_font_matrix (new_cr, &font_matrix);
+    }
+
     /* There is no cairo_get_dash, but we already have a copy ourselves */
     cairo_set_dash (new_cr,
 		    svg_cairo->state->dash, svg_cairo->state->num_dashes, svg_cairo->state->dash_offset);
@@ -1298,7 +2030,7 @@ _svg_cairo_push_state (svg_cairo_t     *svg_cairo,
 {
     if (!svg_cairo->state)
     {
-	svg_cairo->state = _svg_cairo_state_push (svg_cairo->state);
+	svg_cairo->state = _svg_cairo_state_push (svg_cairo->state, &svg_cairo->state_pool);
 	svg_cairo->state->viewport_width = svg_cairo->viewport_width;
 	svg_cairo->state->viewport_height = svg_cairo->viewport_height;
     }
@@ -1315,7 +2047,7 @@ _svg_cairo_push_state (svg_cairo_t     *svg_cairo,
 	    
 	    _svg_cairo_copy_cairo_state (svg_cairo, svg_cairo->state->saved_cr, svg_cairo->cr);
 	}
-	svg_cairo->state = _svg_cairo_state_push (svg_cairo->state);
+	svg_cairo->state = _svg_cairo_state_push (svg_cairo->state, &svg_cairo->state_pool);
     }
 
     
@@ -1328,7 +2060,7 @@ _svg_cairo_push_state (svg_cairo_t     *svg_cairo,
 static svg_status_t
 _svg_cairo_pop_state (svg_cairo_t *svg_cairo)
 {
-    svg_cairo->state = _svg_cairo_state_pop (svg_cairo->state);
+    svg_cairo->state = _svg_cairo_state_pop (svg_cairo->state, &svg_cairo->state_pool);
 
     if (svg_cairo->state && svg_cairo->state->saved_cr) {
 	cairo_destroy (svg_cairo->cr);
@@ -1339,6 +2071,38 @@ _svg_cairo_pop_state (svg_cairo_t *svg_cairo)
     return SVG_STATUS_SUCCESS;
 }
 
+/* States only point at font families, so that pushing a state never
+ * copies one. A document uses a handful of families, a linear search
+ * is fine. */
+static const char *
+_svg_cairo_intern_font_family (svg_cairo_t *svg_cairo, const char *family)
+{
+    char **new_families;
+    char *copy;
+    int i;
+
+    for (i = 0; i < svg_cairo->num_font_families; i++)
+	if (strcmp (svg_cairo->font_families[i], family) == 0)
+	    return svg_cairo->font_families[i];
+
+    if (svg_cairo->num_font_families >= svg_cairo->font_families_size) {
+	int new_size = svg_cairo->font_families_size ? svg_cairo->font_families_size * 2 : 4;
+	new_families = (char **)realloc (svg_cairo->font_families, new_size * sizeof (char *));
+	if (new_families == NULL)
+	    return NULL;
+	svg_cairo->font_families = new_families;
+	svg_cairo->font_families_size = new_size;
+    }
+
+    copy = strdup (family);
+    if (copy == NULL)
+	return NULL;
+
+    svg_cairo->font_families[svg_cairo->num_font_families++] = copy;
+
+    return copy;
+}
+
 #define	DPI	100.0 // This is NOT what we want. How to reach global DPI? (Rob)
 
 static svg_status_t
@@ -0,0 +1,646 @@
+/* libsvg-cairo - Render SVG documents using the cairo library
+ *
+ * Copyright � 2002 University of Southern California
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ * Author: Carl D. Worth <cworth@isi.edu>
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "svg-cairo-internal.h"
+
+#include <mutex>
+
+#ifdef _WIN32
+#include <windows.h>
+
+/* cairo matches its toy faces with fontconfig here. Its headers are
+   not among ours: the few calls made to it are declared as in
+   fontconfig.h. */
+extern "C" {
+typedef struct _FcPattern FcPattern;
+typedef struct _FcObjectSet FcObjectSet;
+typedef struct _FcConfig FcConfig;
+typedef struct _FcFontSet {
+    int nfont;
+    int sfont;
+    FcPattern **fonts;
+} FcFontSet;
+
+FcPattern *FcPatternCreate (void);
+int FcPatternAddString (FcPattern *p, const char *object, const unsigned char *s);
+void FcPatternDestroy (FcPattern *p);
+FcObjectSet *FcObjectSetBuild (const char *first, ...);
+void FcObjectSetDestroy (FcObjectSet *os);
+FcFontSet *FcFontList (FcConfig *config, FcPattern *p, FcObjectSet *os);
+void FcFontSetDestroy (FcFontSet *s);
+}
+#endif
+
+/* Font faces are kept for the life of the process, for every
+   document and thread, by their font-family as written, slant and
+   weight. Each is the face of the first family in the list that the
+   platform has, so the list is gone through once. A face that stays
+   referenced keeps the font it resolved to, and cairo's scaled fonts
+   for it, so fontconfig matches a family once rather than whenever a
+   font is selected. When the
+   cache is full the oldest entry makes room; faces in use live on
+   through their own references. */
+
+#define SVG_CAIRO_FONT_CACHE_SIZE 64
+
+typedef struct svg_cairo_font_cache_entry {
+    char *family;
+    cairo_font_slant_t slant;
+    cairo_font_weight_t weight;
+    cairo_font_face_t *font_face;
+} svg_cairo_font_cache_entry_t;
+
+typedef struct svg_cairo_font_cache {
+    std::mutex mutex;
+
+    svg_cairo_font_cache_entry_t entry[SVG_CAIRO_FONT_CACHE_SIZE];
+    int num_entries;
+    /* next to make room, oldest first */
+    int next;
+} svg_cairo_font_cache_t;
+
+static svg_cairo_font_cache_t svg_cairo_font_cache;
+
+static svg_cairo_status_t
+_svg_cairo_font_family_next (const char **list, char **name);
+
+static int
+_svg_cairo_font_family_is_generic (const char *name);
+
+static int
+_svg_cairo_font_family_exists (const char *name);
+
+static int
+_svg_cairo_font_is_space (char c);
+
+static void
+_svg_cairo_font_write_xml (FILE *file, const char *text);
+
+static int
+_svg_cairo_font_setenv (const char *name, const char *value);
+
+static unsigned long
+_svg_cairo_glyph_run_hash (cairo_scaled_font_t *scaled_font, const char *utf8);
+
+static void
+_svg_cairo_glyph_run_unlink (svg_cairo_t *svg_cairo, svg_cairo_glyph_run_t *run);
+
+static void
+_svg_cairo_glyph_run_destroy (svg_cairo_glyph_run_t *run);
+
+/* A new reference to the face for family, a CSS list of families,
+   at slant and weight; NULL without memory. */
+cairo_font_face_t *
+_svg_cairo_font_face_lookup (const char		*family,
+			     cairo_font_slant_t	slant,
+			     cairo_font_weight_t	weight)
+{
+    std::lock_guard<std::mutex> lock (svg_cairo_font_cache.mutex);
+    svg_cairo_font_cache_entry_t *entry;
+    cairo_font_face_t *font_face;
+    const char *list = family;
+    char *name, *copy;
+    int i;
+
+    for (i = 0; i < svg_cairo_font_cache.num_entries; i++) {
+	entry = &svg_cairo_font_cache.entry[i];
+	if (entry->slant == slant && entry->weight == weight
+	    && strcmp (entry->family, family) == 0)
+	    return cairo_font_face_reference (entry->font_face);
+    }
+
+    /* the first family of the list that the platform has */
+    for (;;) {
+	if (_svg_cairo_font_family_next (&list, &name))
+	    return NULL;
+	if (name == NULL)
+	    break;
+	if (_svg_cairo_font_family_is_generic (name)
+	    || _svg_cairo_font_family_exists (name))
+	    break;
+	free (name);
+    }
+
+    if (name == NULL)
+	name = strdup (SVG_CAIRO_FONT_FAMILY_DEFAULT);
+    copy = strdup (family);
+    if (name == NULL || copy == NULL) {
+	free (name);
+	free (copy);
+	return NULL;
+    }
+
+    font_face = cairo_toy_font_face_create (name, slant, weight);
+    free (name);
+    if (cairo_font_face_status (font_face)) {
+	free (copy);
+	cairo_font_face_destroy (font_face);
+	return NULL;
+    }
+
+    if (svg_cairo_font_cache.num_entries < SVG_CAIRO_FONT_CACHE_SIZE) {
+	entry = &svg_cairo_font_cache.entry[svg_cairo_font_cache.num_entries++];
+    } else {
+	entry = &svg_cairo_font_cache.entry[svg_cairo_font_cache.next];
+	svg_cairo_font_cache.next = (svg_cairo_font_cache.next + 1) % SVG_CAIRO_FONT_CACHE_SIZE;
+	free (entry->family);
+	cairo_font_face_destroy (entry->font_face);
+    }
+    entry->family = copy;
+    entry->slant = slant;
+    entry->weight = weight;
+    entry->font_face = font_face;
+
+    return cairo_font_face_reference (font_face);
+}
+
+/* The next family of a CSS font-family list, such as "'Times New
+   Roman', Times, serif", moving *list past it: unquoted, or with runs
+   of spaces in it made one. *name is NULL at the end of the list. */
+static svg_cairo_status_t
+_svg_cairo_font_family_next (const char **list, char **name_ret)
+{
+    const char *p = *list;
+    char *name, *q;
+    char quote;
+
+    for (;;) {
+	while (_svg_cairo_font_is_space (*p) || *p == ',')
+	    p++;
+	if (*p == '\0') {
+	    *list = p;
+	    *name_ret = NULL;
+	    return SVG_CAIRO_STATUS_SUCCESS;
+	}
+
+	name = (char *)malloc (strlen (p) + 1);
+	if (name == NULL)
+	    return SVG_CAIRO_STATUS_NO_MEMORY;
+	q = name;
+
+	if (*p == '"' || *p == '\'') {
+	    quote = *p++;
+	    while (*p && *p != quote)
+		*q++ = *p++;
+	    if (*p)
+		p++;
+	} else {
+	    while (*p && *p != ',') {
+		if (_svg_cairo_font_is_space (*p)) {
+		    while (_svg_cairo_font_is_space (*p))
+			p++;
+		    if (*p && *p != ',')
+			*q++ = ' ';
+		} else {
+		    *q++ = *p++;
+		}
+	    }
+	}
+	*q = '\0';
+
+	if (*name) {
+	    *list = p;
+	    *name_ret = name;
+	    return SVG_CAIRO_STATUS_SUCCESS;
+	}
+	free (name);
+    }
+}
+
+/* Generic families are left to cairo, which maps them to a font on
+   every platform. */
+static int
+_svg_cairo_font_family_is_generic (const char *name)
+{
+    static const char *generic[] = {
+	"serif", "sans-serif", "monospace", "cursive", "fantasy"
+    };
+    const char *p, *q;
+    size_t i;
+
+    /* keywords are ASCII, matched regardless of case */
+    for (i = 0; i < sizeof (generic) / sizeof (generic[0]); i++) {
+	for (p = name, q = generic[i]; *q; p++, q++)
+	    if (tolower ((unsigned char) *p) != *q)
+		break;
+	if (*p == '\0' && *q == '\0')
+	    return 1;
+    }
+
+    return 0;
+}
+
+/* Whether cairo's toy face for name would find it rather than fall
+   back to a font of the platform's choice: asked the way cairo asks. */
+static int
+_svg_cairo_font_family_exists (const char *name)
+{
+#ifdef _WIN32
+    FcPattern *pattern;
+    FcObjectSet *object_set;
+    FcFontSet *font_set = NULL;
+    int exists;
+
+    pattern = FcPatternCreate ();
+    object_set = FcObjectSetBuild ("family", (char *) NULL);
+    if (pattern && object_set
+	&& FcPatternAddString (pattern, "family", (const unsigned char *) name))
+	font_set = FcFontList (NULL, pattern, object_set);
+
+    exists = font_set && font_set->nfont > 0;
+
+    if (font_set)
+	FcFontSetDestroy (font_set);
+    if (object_set)
+	FcObjectSetDestroy (object_set);
+    if (pattern)
+	FcPatternDestroy (pattern);
+
+    return exists;
+#else
+    CFStringRef cf_name;
+    CGFontRef cg_font;
+
+    cf_name = CFStringCreateWithCString (kCFAllocatorDefault, name, kCFStringEncodingUTF8);
+    if (cf_name == NULL)
+	return 0;
+
+    cg_font = CGFontCreateWithFontName (cf_name);
+    CFRelease (cf_name);
+    if (cg_font == NULL)
+	return 0;
+
+    CGFontRelease (cg_font);
+
+    return 1;
+#endif
+}
+
+static int
+_svg_cairo_font_is_space (char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+/* fontconfig reads the file named by FONTCONFIG_FILE, once, when it
+   is first used: a configuration of our own replaces the system's,
+   with its long list of directories, by the ones given. Fonts found
+   there are kept in cache_directory, which fontconfig brings up to
+   date when a directory changes. */
+svg_cairo_status_t
+svg_cairo_font_set_directories (const char * const	*directories,
+				int			num_directories,
+				const char		*cache_directory)
+{
+    char *filename;
+    FILE *file;
+    int i, error;
+
+    if (num_directories <= 0 || cache_directory == NULL || *cache_directory == '\0')
+	return SVG_CAIRO_STATUS_INVALID_VALUE;
+
+    if (_svg_cairo_sprintf_alloc (&filename, "%s/fonts.conf", cache_directory) < 0)
+	return SVG_CAIRO_STATUS_NO_MEMORY;
+
+    file = fopen (filename, "wb");
+    if (file == NULL) {
+	free (filename);
+	return SVG_CAIRO_STATUS_IO_ERROR;
+    }
+
+    fputs ("<?xml version=\"1.0\"?>\n"
+	   "<!DOCTYPE fontconfig SYSTEM \"fonts.dtd\">\n"
+	   "<fontconfig>\n", file);
+    for (i = 0; i < num_directories; i++) {
+	fputs ("\t<dir>", file);
+	_svg_cairo_font_write_xml (file, directories[i]);
+	fputs ("</dir>\n", file);
+    }
+    fputs ("\t<cachedir>", file);
+    _svg_cairo_font_write_xml (file, cache_directory);
+    fputs ("</cachedir>\n", file);
+    /* a server's fonts don't come and go: don't look for changes
+       while converting */
+    fputs ("\t<config><rescan><int>0</int></rescan></config>\n"
+	   "</fontconfig>\n", file);
+
+    error = ferror (file);
+    if (fclose (file) != 0)
+	error = 1;
+
+    if (! error)
+	error = _svg_cairo_font_setenv ("FONTCONFIG_FILE", filename);
+    free (filename);
+
+    return error ? SVG_CAIRO_STATUS_IO_ERROR : SVG_CAIRO_STATUS_SUCCESS;
+}
+
+/* Resolve the face of family, a font-family list, in the slants and
+   weights text is drawn in, down to the font file and its glyphs,
+   for the conversions that follow. */
+svg_cairo_status_t
+svg_cairo_font_preload (const char *family)
+{
+    static const cairo_font_slant_t slants[] = {
+	CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_SLANT_ITALIC
+    };
+    static const cairo_font_weight_t weights[] = {
+	CAIRO_FONT_WEIGHT_NORMAL, CAIRO_FONT_WEIGHT_BOLD
+    };
+    cairo_font_face_t *font_face;
+    cairo_font_options_t *options;
+    cairo_scaled_font_t *scaled_font;
+    cairo_text_extents_t extents;
+    cairo_matrix_t matrix;
+    cairo_status_t status = CAIRO_STATUS_SUCCESS;
+    int i, j;
+
+    options = cairo_font_options_create ();
+    cairo_matrix_init_identity (&matrix);
+
+    for (i = 0; i < 2 && ! status; i++) {
+	for (j = 0; j < 2 && ! status; j++) {
+	    font_face = _svg_cairo_font_face_lookup (family, slants[i], weights[j]);
+	    if (font_face == NULL) {
+		status = CAIRO_STATUS_NO_MEMORY;
+		break;
+	    }
+
+	    /* matching happens when the face is first scaled */
+	    scaled_font = cairo_scaled_font_create (font_face, &matrix, &matrix, options);
+	    cairo_scaled_font_text_extents (scaled_font, "a", &extents);
+	    status = cairo_scaled_font_status (scaled_font);
+
+	    cairo_scaled_font_destroy (scaled_font);
+	    cairo_font_face_destroy (font_face);
+	}
+    }
+
+    cairo_font_options_destroy (options);
+
+    return status == CAIRO_STATUS_NO_MEMORY ? SVG_CAIRO_STATUS_NO_MEMORY : SVG_CAIRO_STATUS_SUCCESS;
+}
+
+/* Glyph runs: the labels of a table or a map come back many times,
+   in the same few fonts. Converting their text to glyphs, and
+   measuring it for text-anchor, is done once per scaled font and
+   string, the scaled font staying referenced by its runs. The least
+   recently drawn run makes room when there are too many. */
+
+#define SVG_CAIRO_GLYPH_RUN_CACHE_SIZE 1024
+#define SVG_CAIRO_GLYPH_RUN_BUCKETS 1024
+
+/* The run of utf8 in scaled_font, owned by svg_cairo's cache and
+   valid until the next lookup. */
+cairo_status_t
+_svg_cairo_glyph_run_lookup (svg_cairo_t		*svg_cairo,
+			     cairo_scaled_font_t	*scaled_font,
+			     const char			*utf8,
+			     svg_cairo_glyph_run_t	**run)
+{
+    svg_cairo_glyph_run_t *r, **bucket;
+    cairo_text_extents_t extents;
+    cairo_status_t status;
+    unsigned long hash;
+
+    if (svg_cairo->glyph_run_buckets == NULL) {
+	svg_cairo->glyph_run_buckets = (svg_cairo_glyph_run_t **)calloc (SVG_CAIRO_GLYPH_RUN_BUCKETS,
+									 sizeof (svg_cairo_glyph_run_t *));
+	if (svg_cairo->glyph_run_buckets == NULL)
+	    return CAIRO_STATUS_NO_MEMORY;
+    }
+
+    hash = _svg_cairo_glyph_run_hash (scaled_font, utf8);
+    bucket = &svg_cairo->glyph_run_buckets[hash % SVG_CAIRO_GLYPH_RUN_BUCKETS];
+
+    for (r = *bucket; r; r = r->next_in_bucket) {
+	if (r->hash == hash && r->scaled_font == scaled_font
+	    && strcmp (r->utf8, utf8) == 0)
+	    break;
+    }
+
+    if (r) {
+	if (r != svg_cairo->glyph_run_first) {
+	    _svg_cairo_glyph_run_unlink (svg_cairo, r);
+	    r->prev = NULL;
+	    r->next = svg_cairo->glyph_run_first;
+	    svg_cairo->glyph_run_first->prev = r;
+	    svg_cairo->glyph_run_first = r;
+	}
+	*run = r;
+	return CAIRO_STATUS_SUCCESS;
+    }
+
+    r = (svg_cairo_glyph_run_t *)calloc (1, sizeof (svg_cairo_glyph_run_t));
+    if (r == NULL)
+	return CAIRO_STATUS_NO_MEMORY;
+    r->utf8 = strdup (utf8);
+    if (r->utf8 == NULL) {
+	free (r);
+	return CAIRO_STATUS_NO_MEMORY;
+    }
+
+    status = cairo_scaled_font_text_to_glyphs (scaled_font, 0, 0, utf8, -1,
+					       &r->glyphs, &r->num_glyphs,
+					       &r->clusters, &r->num_clusters,
+					       &r->cluster_flags);
+    if (status) {
+	/* left NULL by cairo on error */
+	free (r->utf8);
+	free (r);
+	return status;
+    }
+
+    if (r->num_glyphs) {
+	cairo_scaled_font_glyph_extents (scaled_font, r->glyphs, r->num_glyphs, &extents);
+	r->x_advance = extents.x_advance;
+	r->y_advance = extents.y_advance;
+    }
+
+    if (svg_cairo->num_glyph_runs >= SVG_CAIRO_GLYPH_RUN_CACHE_SIZE) {
+	svg_cairo_glyph_run_t *last = svg_cairo->glyph_run_last, **p;
+
+	for (p = &svg_cairo->glyph_run_buckets[last->hash % SVG_CAIRO_GLYPH_RUN_BUCKETS];
+	     *p != last; p = &(*p)->next_in_bucket)
+	    ;
+	*p = last->next_in_bucket;
+	_svg_cairo_glyph_run_unlink (svg_cairo, last);
+	_svg_cairo_glyph_run_destroy (last);
+	svg_cairo->num_glyph_runs--;
+    }
+
+    r->scaled_font = cairo_scaled_font_reference (scaled_font);
+    r->hash = hash;
+    r->next_in_bucket = *bucket;
+    *bucket = r;
+
+    r->prev = NULL;
+    r->next = svg_cairo->glyph_run_first;
+    if (svg_cairo->glyph_run_first)
+	svg_cairo->glyph_run_first->prev = r;
+    else
+	svg_cairo->glyph_run_last = r;
+    svg_cairo->glyph_run_first = r;
+    svg_cairo->num_glyph_runs++;
+
+    *run = r;
+    return CAIRO_STATUS_SUCCESS;
+}
+
+/* The glyphs of run moved to start at x, y, in a buffer of
+   svg_cairo's; NULL without memory. */
+cairo_glyph_t *
+_svg_cairo_glyph_run_place (svg_cairo_t			*svg_cairo,
+			    svg_cairo_glyph_run_t	*run,
+			    double			x,
+			    double			y)
+{
+    cairo_glyph_t *glyphs;
+    int i;
+
+    if (run->num_glyphs > svg_cairo->glyphs_size) {
+	glyphs = (cairo_glyph_t *)realloc (svg_cairo->glyphs, run->num_glyphs * sizeof (cairo_glyph_t));
+	if (glyphs == NULL)
+	    return NULL;
+	svg_cairo->glyphs = glyphs;
+	svg_cairo->glyphs_size = run->num_glyphs;
+    }
+
+    for (i = 0; i < run->num_glyphs; i++) {
+	svg_cairo->glyphs[i].index = run->glyphs[i].index;
+	svg_cairo->glyphs[i].x = run->glyphs[i].x + x;
+	svg_cairo->glyphs[i].y = run->glyphs[i].y + y;
+    }
+
+    return svg_cairo->glyphs;
+}
+
+void
+_svg_cairo_glyph_run_cache_destroy (svg_cairo_t *svg_cairo)
+{
+    svg_cairo_glyph_run_t *run, *next;
+
+    for (run = svg_cairo->glyph_run_first; run; run = next) {
+	next = run->next;
+	_svg_cairo_glyph_run_destroy (run);
+    }
+    free (svg_cairo->glyph_run_buckets);
+    free (svg_cairo->glyphs);
+
+    svg_cairo->glyph_run_buckets = NULL;
+    svg_cairo->glyph_run_first = NULL;
+    svg_cairo->glyph_run_last = NULL;
+    svg_cairo->num_glyph_runs = 0;
+    svg_cairo->glyphs = NULL;
+    svg_cairo->glyphs_size = 0;
+}
+
+/* FNV-1a over the string, from the font */
+static unsigned long
+_svg_cairo_glyph_run_hash (cairo_scaled_font_t *scaled_font, const char *utf8)
+{
+    unsigned long hash = 2166136261UL ^ (unsigned long) (size_t) scaled_font;
+
+    for (; *utf8; utf8++) {
+	hash ^= (unsigned char) *utf8;
+	hash *= 16777619UL;
+    }
+
+    return hash;
+}
+
+/* out of the used order, not of its bucket */
+static void
+_svg_cairo_glyph_run_unlink (svg_cairo_t *svg_cairo, svg_cairo_glyph_run_t *run)
+{
+    if (run->prev)
+	run->prev->next = run->next;
+    else
+	svg_cairo->glyph_run_first = run->next;
+
+    if (run->next)
+	run->next->prev = run->prev;
+    else
+	svg_cairo->glyph_run_last = run->prev;
+}
+
+static void
+_svg_cairo_glyph_run_destroy (svg_cairo_glyph_run_t *run)
+{
+    cairo_scaled_font_destroy (run->scaled_font);
+    cairo_glyph_free (run->glyphs);
+    cairo_text_cluster_free (run->clusters);
+    free (run->utf8);
+    free (run);
+}
+
+static void
+_svg_cairo_font_write_xml (FILE *file, const char *text)
+{
+    for (; *text; text++) {
+	switch (*text) {
+	case '&':
+	    fputs ("&amp;", file);
+	    break;
+	case '<':
+	    fputs ("&lt;", file);
+	    break;
+	case '>':
+	    fputs ("&gt;", file);
+	    break;
+	default:
+	    fputc (*text, file);
+	    break;
+	}
+    }
+}
+
+static int
+_svg_cairo_font_setenv (const char *name, const char *value)
+{
+#ifdef _WIN32
+    /* A fontconfig built with MinGW reads the environment of
+       msvcrt.dll, a copy that ours doesn't update. */
+    typedef int (__cdecl *putenv_func_t) (const char *);
+    HMODULE msvcrt = GetModuleHandleA ("msvcrt.dll");
+    putenv_func_t msvcrt_putenv;
+    char *assignment;
+
+    if (msvcrt) {
+	msvcrt_putenv = (putenv_func_t) GetProcAddress (msvcrt, "_putenv");
+	if (msvcrt_putenv) {
+	    if (_svg_cairo_sprintf_alloc (&assignment, "%s=%s", name, value) < 0)
+		return -1;
+	    msvcrt_putenv (assignment);
+	    free (assignment);
+	}
+    }
+
+    return _putenv_s (name, value);
+#else
+    return setenv (name, value, 1);
+#endif
+}
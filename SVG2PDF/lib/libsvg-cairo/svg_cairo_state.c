@@ -48,9 +48,7 @@ _svg_cairo_state_init (svg_cairo_state_t *state)
     state->child_surface = NULL;
     state->saved_cr = NULL;
 
-    state->font_family = strdup (SVG_CAIRO_FONT_FAMILY_DEFAULT);
-    if (state->font_family == NULL)
-	return SVG_CAIRO_STATUS_NO_MEMORY;
+    state->font_family = SVG_CAIRO_FONT_FAMILY_DEFAULT;
 
     state->font_size = 1.0;
     state->font_style = SVG_FONT_STYLE_NORMAL;
@@ -59,9 +57,11 @@ _svg_cairo_state_init (svg_cairo_state_t *state)
 
     state->dash = NULL;
     state->num_dashes = 0;
+    state->dash_owned = 0;
     state->dash_offset = 0;
 
     state->opacity = 1.0;
+    state->composite_group = 0;
 
     state->bbox = 0;
 
@@ -85,19 +85,13 @@ _svg_cairo_state_init_copy (svg_cairo_state_t *state, const svg_cairo_state_t *o
     /* We don't need our own child_surface or saved cr at this point. */
     state->child_surface = NULL;
     state->saved_cr = NULL;
-
-    if (other->font_family)
-	state->font_family = strdup ((char *) other->font_family);
+    state->composite_group = 0;
 
     state->viewport_width = other->viewport_width;
     state->viewport_height = other->viewport_height;
 
-    if (other->dash) {
-	state->dash = (double *)malloc (state->num_dashes * sizeof(double));
-	if (state->dash == NULL)
-	    return SVG_CAIRO_STATUS_NO_MEMORY;
-	memcpy (state->dash, other->dash, state->num_dashes * sizeof(double));
-    }
+    /* The parent outlives us, so its dash array can be shared. */
+    state->dash_owned = 0;
 
     return SVG_CAIRO_STATUS_SUCCESS;
 }
@@ -115,15 +109,12 @@ _svg_cairo_state_deinit (svg_cairo_state_t *state)
 	state->saved_cr = NULL;
     }
 
-    if (state->font_family) {
-	free (state->font_family);
-	state->font_family = NULL;
-    }
+    state->font_family = NULL;
 
-    if (state->dash) {
+    if (state->dash_owned)
 	free (state->dash);
-	state->dash = NULL;
-    }
+    state->dash = NULL;
+    state->dash_owned = 0;
 
     state->next = NULL;
 
@@ -141,13 +132,18 @@ _svg_cairo_state_destroy (svg_cairo_state_t *state)
 }
 
 svg_cairo_state_t *
-_svg_cairo_state_push (svg_cairo_state_t *state)
+_svg_cairo_state_push (svg_cairo_state_t *state, svg_cairo_state_t **pool)
 {
     svg_cairo_state_t *n;
 
-    _svg_cairo_state_create (&n);
-    if (n == NULL)
-	return NULL;
+    if (*pool) {
+	n = *pool;
+	*pool = n->next;
+    } else {
+	_svg_cairo_state_create (&n);
+	if (n == NULL)
+	    return NULL;
+    }
 
     _svg_cairo_state_init_copy (n, state);
 
@@ -157,7 +153,7 @@ _svg_cairo_state_push (svg_cairo_state_t *state)
 }
 
 svg_cairo_state_t *
-_svg_cairo_state_pop (svg_cairo_state_t *state)
+_svg_cairo_state_pop (svg_cairo_state_t *state, svg_cairo_state_t **pool)
 {
     svg_cairo_state_t *next;
 
@@ -166,7 +162,22 @@ _svg_cairo_state_pop (svg_cairo_state_t *state)
 
     next = state->next;
 
-    _svg_cairo_state_destroy (state);
+    _svg_cairo_state_deinit (state);
+
+    state->next = *pool;
+    *pool = state;
 
     return next;
 }
+
+void
+_svg_cairo_state_destroy_pool (svg_cairo_state_t **pool)
+{
+    svg_cairo_state_t *state;
+
+    while (*pool) {
+	state = *pool;
+	*pool = state->next;
+	free (state);
+    }
+}
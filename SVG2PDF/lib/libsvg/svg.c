@@ -35,6 +35,9 @@
 static svg_status_t
 _svg_init (svg_t *svg);
 
+static svg_status_t
+_svg_parse_gzip_buffer (svg_t *svg, const char *buf, size_t count);
+
 svg_status_t
 svg_create (svg_t **svg)
 {
@@ -61,6 +64,20 @@ _svg_init (svg_t *svg)
 
     svg->element_ids = _svg_xml_hash_create (100);
 
+    svg->display_list = NULL;
+    svg->display_list_size = 0;
+    svg->display_list_copy = NULL;
+
+    svg->elided_state_count = 0;
+    svg->simplified_point_count = 0;
+    svg->shared = 0;
+
+    svg->styles = NULL;
+    svg->num_styles = 0;
+    svg->styles_size = 0;
+    svg->style_hash = NULL;
+    svg->style_hash_size = 0;
+
     return SVG_STATUS_SUCCESS;
 }
 
@@ -79,6 +96,12 @@ _svg_deinit (svg_t *svg)
 
     _svg_xml_hash_free (svg->element_ids);
 
+    free (svg->display_list_copy);
+    svg->display_list_copy = NULL;
+    svg->display_list = NULL;
+
+    _svg_style_table_clear (svg);
+
     return SVG_STATUS_SUCCESS;
 }
 
@@ -176,6 +199,27 @@ svg_parse_buffer (svg_t *svg, const char *buf, size_t count)
 {
     svg_status_t status;
 
+    /* svgz: gzip member header starts with 0x1f 0x8b */
+    if (count >= 2
+	&& (unsigned char) buf[0] == 0x1f
+	&& (unsigned char) buf[1] == 0x8b)
+	return _svg_parse_gzip_buffer (svg, buf, count);
+
+    /* svg_compile output; copied, as buf need not outlive the call */
+    if (_svg_display_list_is_compiled (buf, count)) {
+	char *copy = (char *)malloc (count);
+	if (copy == NULL)
+	    return SVG_STATUS_NO_MEMORY;
+	memcpy (copy, buf, count);
+	status = svg_parse_compiled (svg, copy, count);
+	if (status) {
+	    free (copy);
+	    return status;
+	}
+	svg->display_list_copy = copy;
+	return SVG_STATUS_SUCCESS;
+    }
+
     status = svg_parse_chunk_begin (svg);
     if (status)
 	return status;
@@ -189,6 +233,65 @@ svg_parse_buffer (svg_t *svg, const char *buf, size_t count)
     return status;
 }
 
+/* Inflate a gzip buffer in SVG_PARSE_BUFFER_SIZE pieces straight into
+   the push parser, so the uncompressed document is never held in
+   memory as a whole. */
+static svg_status_t
+_svg_parse_gzip_buffer (svg_t *svg, const char *buf, size_t count)
+{
+    svg_status_t status = SVG_STATUS_SUCCESS;
+    z_stream strm;
+    char out[SVG_PARSE_BUFFER_SIZE];
+    int zstatus = Z_OK;
+
+    memset (&strm, 0, sizeof (strm));
+    /* 15 window bits + 16: expect a gzip wrapper, not raw zlib */
+    zstatus = inflateInit2 (&strm, 15 + 16);
+    if (zstatus != Z_OK)
+	return zstatus == Z_MEM_ERROR ? SVG_STATUS_NO_MEMORY : SVG_STATUS_IO_ERROR;
+
+    status = svg_parse_chunk_begin (svg);
+    if (status)
+	goto CLEANUP;
+
+    strm.next_in = (Bytef *) buf;
+
+    while (zstatus != Z_STREAM_END) {
+	/* avail_in is a uInt; feed very large inputs in slices */
+	if (strm.avail_in == 0 && count) {
+	    strm.avail_in = count > 0x40000000 ? 0x40000000 : (uInt) count;
+	    count -= strm.avail_in;
+	}
+
+	strm.next_out = (Bytef *) out;
+	strm.avail_out = SVG_PARSE_BUFFER_SIZE;
+
+	zstatus = inflate (&strm, Z_NO_FLUSH);
+	if (zstatus == Z_MEM_ERROR) {
+	    status = SVG_STATUS_NO_MEMORY;
+	    goto CLEANUP;
+	}
+	if (zstatus != Z_OK && zstatus != Z_STREAM_END) {
+	    /* Z_BUF_ERROR here means the input was truncated */
+	    status = SVG_STATUS_IO_ERROR;
+	    goto CLEANUP;
+	}
+
+	if (strm.avail_out < SVG_PARSE_BUFFER_SIZE) {
+	    status = svg_parse_chunk (svg, out,
+				      SVG_PARSE_BUFFER_SIZE - strm.avail_out);
+	    if (status)
+		goto CLEANUP;
+	}
+    }
+
+    status = svg_parse_chunk_end (svg);
+
+ CLEANUP:
+    inflateEnd (&strm);
+    return status;
+}
+
 svg_status_t
 svg_parse_chunk_begin (svg_t *svg)
 {
@@ -204,7 +307,20 @@ svg_parse_chunk (svg_t *svg, const char *buf, size_t count)
 svg_status_t
 svg_parse_chunk_end (svg_t *svg)
 {
-    return _svg_parser_end (&svg->parser);
+    svg_status_t status;
+
+    status = _svg_parser_end (&svg->parser);
+    if (status)
+	return status;
+
+    if (svg->group_element == NULL)
+	return SVG_STATUS_SUCCESS;
+
+    status = _svg_element_resolve_style (svg->group_element, NULL);
+    if (status)
+	return status;
+
+    return _svg_element_update_bbox (svg->group_element);
 }
 
 svg_status_t
@@ -215,6 +331,12 @@ svg_render (svg_t		*svg,
     svg_status_t status;
     //char orig_dir[MAXPATHLEN];
 
+    if (! svg->shared)
+	svg->elided_state_count = 0;
+
+    if (svg->display_list)
+	return _svg_display_list_render (svg, engine, closure);
+
     if (svg->group_element == NULL)
 	return SVG_STATUS_SUCCESS;
 
@@ -233,6 +355,72 @@ svg_render (svg_t		*svg,
     return status;
 }
 
+svg_status_t
+svg_render_region (svg_t		*svg,
+		   svg_render_engine_t	*engine,
+		   void			*closure,
+		   double		x,
+		   double		y,
+		   double		width,
+		   double		height)
+{
+    svg_bbox_t region;
+
+    if (! svg->shared)
+	svg->elided_state_count = 0;
+
+    /* the display list has no boxes to search */
+    if (svg->display_list)
+	return SVG_STATUS_INVALID_CALL;
+
+    if (svg->group_element == NULL)
+	return SVG_STATUS_SUCCESS;
+
+    region.x1 = x;
+    region.y1 = y;
+    region.x2 = x + width;
+    region.y2 = y + height;
+
+    return _svg_element_render_region (svg->group_element, engine, closure, &region);
+}
+
+svg_status_t
+svg_prepare_shared (svg_t *svg)
+{
+    svg_status_t status = SVG_STATUS_SUCCESS;
+
+    /* a display list only carries decoded pixels */
+    if (svg->group_element)
+	status = _svg_element_read_images (svg->group_element);
+
+    svg->elided_state_count = 0;
+    svg->shared = 1;
+
+    return status;
+}
+
+int
+svg_is_shared (svg_t *svg)
+{
+    return svg->shared;
+}
+
+svg_status_t
+svg_simplify_paths (svg_t *svg, double tolerance)
+{
+    /* the display list is already flattened to engine calls */
+    if (svg->display_list)
+	return SVG_STATUS_INVALID_CALL;
+
+    if (svg->shared)
+	return SVG_STATUS_INVALID_CALL;
+
+    if (tolerance <= 0 || svg->group_element == NULL)
+	return SVG_STATUS_SUCCESS;
+
+    return _svg_element_simplify_paths (svg->group_element, tolerance);
+}
+
 svg_status_t
 _svg_store_element_by_id (svg_t *svg, svg_element_t *element)
 {
@@ -254,10 +442,36 @@ _svg_fetch_element_by_id (svg_t *svg, const char *id, svg_element_t **element_re
 void
 svg_get_size (svg_t *svg, svg_length_t *width, svg_length_t *height)
 {
-    if (svg->group_element) {
+    if (svg->display_list) {
+	_svg_display_list_get_size (svg, width, height);
+    } else if (svg->group_element) {
 	_svg_group_get_size (&svg->group_element->e.group, width, height);
     } else {
 	_svg_length_init (width, 0.0);
 	_svg_length_init (height, 0.0);
     }
 }
+
+void
+svg_get_view_box (svg_t *svg, svg_view_box_t *view_box)
+{
+    if (svg->group_element && ! svg->display_list) {
+	*view_box = svg->group_element->e.group.view_box;
+    } else {
+	memset (view_box, 0, sizeof (svg_view_box_t));
+	view_box->aspect_ratio = SVG_PRESERVE_ASPECT_RATIO_UNKNOWN;
+	view_box->meet_or_slice = SVG_MEET_OR_SLICE_UNKNOWN;
+    }
+}
+
+unsigned long
+svg_get_elided_state_count (svg_t *svg)
+{
+    return svg->elided_state_count;
+}
+
+unsigned long
+svg_get_simplified_point_count (svg_t *svg)
+{
+    return svg->simplified_point_count;
+}
@@ -0,0 +1,115 @@
+/* svg_bbox.c: Axis-aligned bounding boxes for SVG elements
+
+   Copyright � 2002 USC/Information Sciences Institute
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public
+   License along with this program; if not, write to the
+   Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+   Boston, MA 02111-1307, USA.
+
+   Author: Carl Worth <cworth@isi.edu>
+*/
+
+#include <math.h>
+
+#include "svgint.h"
+
+/* A box is empty when x1 > x2, which is how it starts, and unbounded
+   when its sides are infinite. Both fall out of the min/max below
+   without special cases, except when transforming. */
+
+void
+_svg_bbox_init_empty (svg_bbox_t *bbox)
+{
+    bbox->x1 = bbox->y1 = HUGE_VAL;
+    bbox->x2 = bbox->y2 = -HUGE_VAL;
+}
+
+void
+_svg_bbox_init_unbounded (svg_bbox_t *bbox)
+{
+    bbox->x1 = bbox->y1 = -HUGE_VAL;
+    bbox->x2 = bbox->y2 = HUGE_VAL;
+}
+
+int
+_svg_bbox_is_empty (const svg_bbox_t *bbox)
+{
+    return bbox->x1 > bbox->x2 || bbox->y1 > bbox->y2;
+}
+
+int
+_svg_bbox_is_bounded (const svg_bbox_t *bbox)
+{
+    return bbox->x1 > -HUGE_VAL && bbox->y1 > -HUGE_VAL
+	&& bbox->x2 < HUGE_VAL && bbox->y2 < HUGE_VAL;
+}
+
+void
+_svg_bbox_add_point (svg_bbox_t *bbox, double x, double y)
+{
+    if (x < bbox->x1)
+	bbox->x1 = x;
+    if (x > bbox->x2)
+	bbox->x2 = x;
+    if (y < bbox->y1)
+	bbox->y1 = y;
+    if (y > bbox->y2)
+	bbox->y2 = y;
+}
+
+void
+_svg_bbox_union (svg_bbox_t *bbox, const svg_bbox_t *other)
+{
+    if (_svg_bbox_is_empty (other))
+	return;
+
+    _svg_bbox_add_point (bbox, other->x1, other->y1);
+    _svg_bbox_add_point (bbox, other->x2, other->y2);
+}
+
+void
+_svg_bbox_grow (svg_bbox_t *bbox, double distance)
+{
+    if (_svg_bbox_is_empty (bbox))
+	return;
+
+    bbox->x1 -= distance;
+    bbox->y1 -= distance;
+    bbox->x2 += distance;
+    bbox->y2 += distance;
+}
+
+/* Replaces bbox with the bounds of its four corners mapped through
+   transform, the same mapping svg_transform_render hands to the
+   engine. */
+void
+_svg_bbox_transform (svg_bbox_t *bbox, const svg_transform_t *transform)
+{
+    double x[4], y[4];
+    int i;
+
+    if (_svg_bbox_is_empty (bbox) || ! _svg_bbox_is_bounded (bbox))
+	return;
+
+    x[0] = bbox->x1; y[0] = bbox->y1;
+    x[1] = bbox->x2; y[1] = bbox->y1;
+    x[2] = bbox->x1; y[2] = bbox->y2;
+    x[3] = bbox->x2; y[3] = bbox->y2;
+
+    _svg_bbox_init_empty (bbox);
+    for (i = 0; i < 4; i++)
+	_svg_bbox_add_point (bbox,
+			     transform->m[0][0] * x[i] + transform->m[1][0] * y[i] + transform->m[2][0],
+			     transform->m[0][1] * x[i] + transform->m[1][1] * y[i] + transform->m[2][1]);
+}
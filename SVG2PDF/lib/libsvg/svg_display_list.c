@@ -0,0 +1,1480 @@
+/* svg_display_list.c: Compiled (pre-parsed) form of SVG documents
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public
+   License along with this program; if not, write to the
+   Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+   Boston, MA 02111-1307, USA.
+*/
+
+/* A display list is the sequence of render engine calls that
+   svg_render makes for a document, written out as a flat, versioned
+   buffer:
+
+     header | record | record | ...
+
+   Every record starts with a {op, size} pair and is followed by
+   8-byte slots (doubles or integers), then optional raw bytes
+   (strings, decoded image pixels), padded so the next
+   record is 8-byte aligned again. Nothing in the buffer is a pointer,
+   so it can be stored, read back or mapped into memory and replayed
+   in place. Strings, dash arrays and pixels are handed to the render
+   engine straight out of the buffer; the only allocations on replay
+   are one block for the gradient table and the stack of open
+   begin_* records.
+
+   Gradients are written once, as a record of their own, the first
+   time they are used as paint, and are referred to by index after
+   that. Pattern paint needs the element tree at render time, so
+   documents using <pattern> cannot be compiled. */
+
+#include <stdarg.h>
+#include <string.h>
+
+#include "svgint.h"
+
+#define SVG_DISPLAY_LIST_MAGIC "SVGC"
+#define SVG_DISPLAY_LIST_VERSION 1
+#define SVG_DISPLAY_LIST_BYTE_ORDER 0x01020304
+
+typedef union svg_dl_slot {
+    double	d;
+    int64_t	i;
+} svg_dl_slot_t;
+
+typedef struct svg_dl_header {
+    char	magic[4];
+    uint32_t	version;
+    uint32_t	byte_order;
+    uint32_t	num_gradients;
+    uint32_t	num_stops;
+    int32_t	render_status;
+    svg_dl_slot_t width[2];
+    svg_dl_slot_t height[2];
+} svg_dl_header_t;
+
+typedef struct svg_dl_record {
+    uint32_t	op;
+    uint32_t	size;
+} svg_dl_record_t;
+
+/* One op per render engine call, plus the gradient definition */
+typedef enum svg_dl_op {
+    SVG_DL_OP_BEGIN_GROUP,
+    SVG_DL_OP_BEGIN_ELEMENT,
+    SVG_DL_OP_END_ELEMENT,
+    SVG_DL_OP_END_GROUP,
+    SVG_DL_OP_MOVE_TO,
+    SVG_DL_OP_LINE_TO,
+    SVG_DL_OP_CURVE_TO,
+    SVG_DL_OP_QUADRATIC_CURVE_TO,
+    SVG_DL_OP_ARC_TO,
+    SVG_DL_OP_CLOSE_PATH,
+    SVG_DL_OP_SET_COLOR,
+    SVG_DL_OP_SET_FILL_OPACITY,
+    SVG_DL_OP_SET_FILL_PAINT,
+    SVG_DL_OP_SET_FILL_RULE,
+    SVG_DL_OP_SET_FONT_FAMILY,
+    SVG_DL_OP_SET_FONT_SIZE,
+    SVG_DL_OP_SET_FONT_STYLE,
+    SVG_DL_OP_SET_FONT_WEIGHT,
+    SVG_DL_OP_SET_OPACITY,
+    SVG_DL_OP_SET_STROKE_DASH_ARRAY,
+    SVG_DL_OP_SET_STROKE_DASH_OFFSET,
+    SVG_DL_OP_SET_STROKE_LINE_CAP,
+    SVG_DL_OP_SET_STROKE_LINE_JOIN,
+    SVG_DL_OP_SET_STROKE_MITER_LIMIT,
+    SVG_DL_OP_SET_STROKE_OPACITY,
+    SVG_DL_OP_SET_STROKE_PAINT,
+    SVG_DL_OP_SET_STROKE_WIDTH,
+    SVG_DL_OP_SET_TEXT_ANCHOR,
+    SVG_DL_OP_TRANSFORM,
+    SVG_DL_OP_APPLY_VIEW_BOX,
+    SVG_DL_OP_SET_VIEWPORT_DIMENSION,
+    SVG_DL_OP_RENDER_LINE,
+    SVG_DL_OP_RENDER_PATH,
+    SVG_DL_OP_RENDER_ELLIPSE,
+    SVG_DL_OP_RENDER_RECT,
+    SVG_DL_OP_RENDER_TEXT,
+    SVG_DL_OP_RENDER_IMAGE,
+    SVG_DL_OP_GRADIENT,
+    SVG_DL_OP_SET_IMAGE_OPAQUE,
+    SVG_DL_OP_LAST
+} svg_dl_op_t;
+
+/* Minimum number of slots in a record of each op, checked on replay */
+static const int SVG_DL_OP_SLOTS[SVG_DL_OP_LAST] = {
+    1, 0, 0, 1,			/* hierarchy */
+    2, 2, 6, 4, 7, 0,		/* path creation */
+    2, 1, 1, 1, 1, 1, 1, 1, 1,	/* style */
+    1, 2, 1, 1, 1, 1, 1, 2, 1,
+    6, 10, 4,			/* transform */
+    8, 0, 8, 12, 5, 10,		/* drawing */
+    21,				/* gradient */
+    1				/* image opacity */
+};
+
+#define SVG_DL_GRADIENT_STOP_SLOTS 4
+
+typedef struct svg_dl_compiler {
+    char		*data;
+    size_t		size;
+    size_t		data_size;
+
+    const svg_gradient_t **gradients;
+    int			num_gradients;
+    int			gradients_size;
+    int			num_stops;
+
+    svg_status_t	status;
+} svg_dl_compiler_t;
+
+static svg_status_t
+_svg_dl_reserve (svg_dl_compiler_t *dl, size_t size);
+
+static svg_dl_slot_t *
+_svg_dl_begin_record (svg_dl_compiler_t *dl, svg_dl_op_t op, int num_slots, size_t num_bytes);
+
+static void
+_svg_dl_put_length (svg_dl_slot_t *slot, const svg_length_t *length);
+
+static void
+_svg_dl_get_length (const svg_dl_slot_t *slot, svg_length_t *length);
+
+static svg_status_t
+_svg_dl_push_open (const svg_dl_record_t ***open, size_t *num_open, size_t *open_size,
+		   const svg_dl_record_t *record);
+
+static svg_status_t
+_svg_dl_record_slots (svg_dl_compiler_t *dl, svg_dl_op_t op, int num_slots, ...);
+
+static svg_status_t
+_svg_dl_record_int (svg_dl_compiler_t *dl, svg_dl_op_t op, int64_t value);
+
+static svg_status_t
+_svg_dl_record_lengths (svg_dl_compiler_t *dl, svg_dl_op_t op,
+			int num_lengths, svg_length_t **lengths);
+
+static svg_status_t
+_svg_dl_record_string (svg_dl_compiler_t *dl, svg_dl_op_t op,
+		       int num_slots, const svg_dl_slot_t *slots,
+		       const char *str);
+
+static svg_status_t
+_svg_dl_record_paint (svg_dl_compiler_t *dl, svg_dl_op_t op, const svg_paint_t *paint);
+
+static svg_status_t
+_svg_dl_record_gradient (svg_dl_compiler_t *dl, const svg_gradient_t *gradient, int *index);
+
+static svg_status_t
+_svg_dl_begin_group (void *closure, double opacity);
+
+static svg_status_t
+_svg_dl_begin_element (void *closure);
+
+static svg_status_t
+_svg_dl_end_element (void *closure);
+
+static svg_status_t
+_svg_dl_end_group (void *closure, double opacity);
+
+static svg_status_t
+_svg_dl_move_to (void *closure, double x, double y);
+
+static svg_status_t
+_svg_dl_line_to (void *closure, double x, double y);
+
+static svg_status_t
+_svg_dl_curve_to (void *closure,
+		  double x1, double y1,
+		  double x2, double y2,
+		  double x3, double y3);
+
+static svg_status_t
+_svg_dl_quadratic_curve_to (void *closure,
+			    double x1, double y1,
+			    double x2, double y2);
+
+static svg_status_t
+_svg_dl_arc_to (void	       *closure,
+		double		rx,
+		double		ry,
+		double		x_axis_rotation,
+		int		large_arc_flag,
+		int		sweep_flag,
+		double		x,
+		double		y);
+
+static svg_status_t
+_svg_dl_close_path (void *closure);
+
+static svg_status_t
+_svg_dl_set_color (void *closure, const svg_color_t *color);
+
+static svg_status_t
+_svg_dl_set_fill_opacity (void *closure, double fill_opacity);
+
+static svg_status_t
+_svg_dl_set_fill_paint (void *closure, const svg_paint_t *paint);
+
+static svg_status_t
+_svg_dl_set_fill_rule (void *closure, svg_fill_rule_t fill_rule);
+
+static svg_status_t
+_svg_dl_set_font_family (void *closure, const char *family);
+
+static svg_status_t
+_svg_dl_set_font_size (void *closure, double size);
+
+static svg_status_t
+_svg_dl_set_font_style (void *closure, svg_font_style_t font_style);
+
+static svg_status_t
+_svg_dl_set_font_weight (void *closure, unsigned int weight);
+
+static svg_status_t
+_svg_dl_set_opacity (void *closure, double opacity);
+
+static svg_status_t
+_svg_dl_set_stroke_dash_array (void *closure, double *dash, int num_dashes);
+
+static svg_status_t
+_svg_dl_set_stroke_dash_offset (void *closure, svg_length_t *offset);
+
+static svg_status_t
+_svg_dl_set_stroke_line_cap (void *closure, svg_stroke_line_cap_t line_cap);
+
+static svg_status_t
+_svg_dl_set_stroke_line_join (void *closure, svg_stroke_line_join_t line_join);
+
+static svg_status_t
+_svg_dl_set_stroke_miter_limit (void *closure, double limit);
+
+static svg_status_t
+_svg_dl_set_stroke_opacity (void *closure, double stroke_opacity);
+
+static svg_status_t
+_svg_dl_set_stroke_paint (void *closure, const svg_paint_t *paint);
+
+static svg_status_t
+_svg_dl_set_stroke_width (void *closure, svg_length_t *width);
+
+static svg_status_t
+_svg_dl_set_text_anchor (void *closure, svg_text_anchor_t text_anchor);
+
+static svg_status_t
+_svg_dl_transform (void *closure,
+		   double a, double b,
+		   double c, double d,
+		   double e, double f);
+
+static svg_status_t
+_svg_dl_apply_view_box (void *closure,
+			svg_view_box_t view_box,
+			svg_length_t *width,
+			svg_length_t *height);
+
+static svg_status_t
+_svg_dl_set_viewport_dimension (void *closure,
+				svg_length_t *width,
+				svg_length_t *height);
+
+static svg_status_t
+_svg_dl_render_line (void *closure,
+		     svg_length_t *x1, svg_length_t *y1,
+		     svg_length_t *x2, svg_length_t *y2);
+
+static svg_status_t
+_svg_dl_render_path (void *closure);
+
+static svg_status_t
+_svg_dl_render_ellipse (void *closure,
+			svg_length_t *cx, svg_length_t *cy,
+			svg_length_t *rx, svg_length_t *ry);
+
+static svg_status_t
+_svg_dl_render_rect (void 	     *closure,
+		     svg_length_t *x, svg_length_t *y,
+		     svg_length_t *width, svg_length_t *height,
+		     svg_length_t *rx, svg_length_t *ry);
+
+static svg_status_t
+_svg_dl_render_text (void 	      *closure,
+		     svg_length_t *x,
+		     svg_length_t *y,
+		     const char   *utf8);
+
+static svg_status_t
+_svg_dl_render_image (void		*closure,
+		      unsigned char	*data,
+		      unsigned int	data_width,
+		      unsigned int	data_height,
+		      svg_length_t	*x,
+		      svg_length_t	*y,
+		      svg_length_t	*width,
+		      svg_length_t	*height);
+
+static svg_status_t
+_svg_dl_set_image_opaque (void *closure, int opaque);
+
+static svg_render_engine_t SVG_DISPLAY_LIST_RECORD_ENGINE = {
+    /* hierarchy */
+    _svg_dl_begin_group,
+    _svg_dl_begin_element,
+    _svg_dl_end_element,
+    _svg_dl_end_group,
+    /* path creation */
+    _svg_dl_move_to,
+    _svg_dl_line_to,
+    _svg_dl_curve_to,
+    _svg_dl_quadratic_curve_to,
+    _svg_dl_arc_to,
+    _svg_dl_close_path,
+    /* style */
+    _svg_dl_set_color,
+    _svg_dl_set_fill_opacity,
+    _svg_dl_set_fill_paint,
+    _svg_dl_set_fill_rule,
+    _svg_dl_set_font_family,
+    _svg_dl_set_font_size,
+    _svg_dl_set_font_style,
+    _svg_dl_set_font_weight,
+    _svg_dl_set_opacity,
+    _svg_dl_set_stroke_dash_array,
+    _svg_dl_set_stroke_dash_offset,
+    _svg_dl_set_stroke_line_cap,
+    _svg_dl_set_stroke_line_join,
+    _svg_dl_set_stroke_miter_limit,
+    _svg_dl_set_stroke_opacity,
+    _svg_dl_set_stroke_paint,
+    _svg_dl_set_stroke_width,
+    _svg_dl_set_text_anchor,
+    /* transform */
+    _svg_dl_transform,
+    _svg_dl_apply_view_box,
+    _svg_dl_set_viewport_dimension,
+    /* drawing */
+    _svg_dl_render_line,
+    _svg_dl_render_path,
+    _svg_dl_render_ellipse,
+    _svg_dl_render_rect,
+    _svg_dl_render_text,
+    _svg_dl_render_image,
+    /* culling: a compiled list is replayed at any size, keep it all */
+    NULL,
+    /* encoded images: the list records pixels */
+    NULL,
+    /* image resolution: all of it, for any size */
+    NULL,
+    /* image opacity */
+    _svg_dl_set_image_opaque
+};
+
+#define SVG_DL_ALIGN(n) (((n) + 7) & ~((size_t) 7))
+
+svg_status_t
+svg_compile (svg_t *svg, void **data, size_t *size)
+{
+    svg_dl_compiler_t dl;
+    svg_dl_header_t header;
+    svg_length_t width, height;
+    svg_status_t render_status;
+
+    *data = NULL;
+    *size = 0;
+
+    /* Already compiled, hand out a copy */
+    if (svg->display_list) {
+	*data = malloc (svg->display_list_size);
+	if (*data == NULL)
+	    return SVG_STATUS_NO_MEMORY;
+	memcpy (*data, svg->display_list, svg->display_list_size);
+	*size = svg->display_list_size;
+	return SVG_STATUS_SUCCESS;
+    }
+
+    dl.data = NULL;
+    dl.size = 0;
+    dl.data_size = 0;
+    dl.gradients = NULL;
+    dl.num_gradients = 0;
+    dl.gradients_size = 0;
+    dl.num_stops = 0;
+    dl.status = SVG_STATUS_SUCCESS;
+
+    dl.status = _svg_dl_reserve (&dl, sizeof (svg_dl_header_t));
+    if (dl.status)
+	return dl.status;
+    dl.size = sizeof (svg_dl_header_t);
+
+    /* The tree walk reports non-fatal conditions (display="none",
+       images without data, ...) through its return value. Those are
+       kept in the header and handed back by every replay, anything
+       that went wrong while recording is in dl.status. */
+    render_status = svg_render (svg, &SVG_DISPLAY_LIST_RECORD_ENGINE, &dl);
+
+    free (dl.gradients);
+
+    if (dl.status) {
+	free (dl.data);
+	return dl.status;
+    }
+
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, SVG_DISPLAY_LIST_MAGIC, 4);
+    header.version = SVG_DISPLAY_LIST_VERSION;
+    header.byte_order = SVG_DISPLAY_LIST_BYTE_ORDER;
+    header.num_gradients = dl.num_gradients;
+    header.num_stops = dl.num_stops;
+    header.render_status = render_status;
+    svg_get_size (svg, &width, &height);
+    _svg_dl_put_length (header.width, &width);
+    _svg_dl_put_length (header.height, &height);
+    memcpy (dl.data, &header, sizeof (header));
+
+    *data = dl.data;
+    *size = dl.size;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+svg_status_t
+svg_parse_compiled (svg_t *svg, const void *data, size_t size)
+{
+    char *copy;
+
+    if (! _svg_display_list_is_compiled ((const char *) data, size))
+	return SVG_STATUS_INVALID_VALUE;
+
+    free (svg->display_list_copy);
+    svg->display_list_copy = NULL;
+
+    /* Slots are read in place, so the buffer has to be 8-byte
+       aligned. Anything from malloc or mmap is, a misaligned buffer
+       gets copied once. */
+    if ((size_t) data & 7) {
+	copy = (char *)malloc (size);
+	if (copy == NULL)
+	    return SVG_STATUS_NO_MEMORY;
+	memcpy (copy, data, size);
+	svg->display_list_copy = copy;
+	data = copy;
+    }
+
+    svg->display_list = (const char *) data;
+    svg->display_list_size = size;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+int
+_svg_display_list_is_compiled (const char *buf, size_t count)
+{
+    svg_dl_header_t header;
+
+    if (count < sizeof (svg_dl_header_t))
+	return 0;
+
+    memcpy (&header, buf, sizeof (header));
+
+    return memcmp (header.magic, SVG_DISPLAY_LIST_MAGIC, 4) == 0
+	&& header.version == SVG_DISPLAY_LIST_VERSION
+	&& header.byte_order == SVG_DISPLAY_LIST_BYTE_ORDER;
+}
+
+void
+_svg_display_list_get_size (svg_t *svg, svg_length_t *width, svg_length_t *height)
+{
+    const svg_dl_header_t *header = (const svg_dl_header_t *) svg->display_list;
+
+    _svg_dl_get_length (header->width, width);
+    _svg_dl_get_length (header->height, height);
+}
+
+svg_status_t
+_svg_display_list_render (svg_t			*svg,
+			  svg_render_engine_t	*engine,
+			  void			*closure)
+{
+    const svg_dl_header_t *header = (const svg_dl_header_t *) svg->display_list;
+    const char *p = svg->display_list + sizeof (svg_dl_header_t);
+    const char *end = svg->display_list + svg->display_list_size;
+    svg_gradient_t *gradients = NULL;
+    svg_gradient_stop_t *stops = NULL;
+    unsigned int next_stop = 0;
+    svg_status_t status, return_status = SVG_STATUS_SUCCESS;
+    svg_length_t l[6];
+    svg_color_t color;
+    svg_paint_t paint;
+    svg_view_box_t view_box;
+    const svg_dl_record_t *record;
+    const svg_dl_record_t **open = NULL;
+    size_t num_open = 0, open_size = 0;
+    const svg_dl_slot_t *s;
+    const char *bytes;
+    size_t num_slots, num_bytes;
+    int64_t n;
+    int i;
+
+    if (header->num_gradients) {
+	gradients = (svg_gradient_t *)calloc (1, header->num_gradients * sizeof (svg_gradient_t)
+					      + header->num_stops * sizeof (svg_gradient_stop_t));
+	if (gradients == NULL)
+	    return SVG_STATUS_NO_MEMORY;
+	stops = (svg_gradient_stop_t *) (gradients + header->num_gradients);
+    }
+
+    while (p < end) {
+	if ((size_t) (end - p) < sizeof (svg_dl_record_t))
+	    goto CORRUPT;
+	record = (const svg_dl_record_t *) p;
+	if (record->size < sizeof (svg_dl_record_t)
+	    || record->size & 7
+	    || record->size > (size_t) (end - p)
+	    || record->op >= SVG_DL_OP_LAST)
+	    goto CORRUPT;
+
+	s = (const svg_dl_slot_t *) (p + sizeof (svg_dl_record_t));
+	num_slots = (record->size - sizeof (svg_dl_record_t)) / sizeof (svg_dl_slot_t);
+	if (num_slots < (size_t) SVG_DL_OP_SLOTS[record->op])
+	    goto CORRUPT;
+	/* raw bytes, if any, follow the fixed slots of the op */
+	bytes = (const char *) (s + SVG_DL_OP_SLOTS[record->op]);
+	num_bytes = (num_slots - SVG_DL_OP_SLOTS[record->op]) * sizeof (svg_dl_slot_t);
+
+	p += record->size;
+
+	switch (record->op) {
+	case SVG_DL_OP_BEGIN_GROUP:
+	case SVG_DL_OP_BEGIN_ELEMENT:
+	    status = _svg_dl_push_open (&open, &num_open, &open_size, record);
+	    if (status)
+		goto UNWIND;
+	    if (record->op == SVG_DL_OP_BEGIN_GROUP)
+		status = (engine->begin_group) (closure, s[0].d);
+	    else
+		status = (engine->begin_element) (closure);
+	    break;
+	case SVG_DL_OP_END_ELEMENT:
+	case SVG_DL_OP_END_GROUP:
+	    if (num_open == 0
+		|| open[num_open - 1]->op != (record->op == SVG_DL_OP_END_GROUP
+					      ? SVG_DL_OP_BEGIN_GROUP
+					      : SVG_DL_OP_BEGIN_ELEMENT))
+		goto CORRUPT;
+	    num_open--;
+	    if (record->op == SVG_DL_OP_END_GROUP)
+		status = (engine->end_group) (closure, s[0].d);
+	    else
+		status = (engine->end_element) (closure);
+	    break;
+	case SVG_DL_OP_MOVE_TO:
+	    status = (engine->move_to) (closure, s[0].d, s[1].d);
+	    break;
+	case SVG_DL_OP_LINE_TO:
+	    status = (engine->line_to) (closure, s[0].d, s[1].d);
+	    break;
+	case SVG_DL_OP_CURVE_TO:
+	    status = (engine->curve_to) (closure,
+					 s[0].d, s[1].d,
+					 s[2].d, s[3].d,
+					 s[4].d, s[5].d);
+	    break;
+	case SVG_DL_OP_QUADRATIC_CURVE_TO:
+	    status = (engine->quadratic_curve_to) (closure,
+						   s[0].d, s[1].d,
+						   s[2].d, s[3].d);
+	    break;
+	case SVG_DL_OP_ARC_TO:
+	    status = (engine->arc_to) (closure,
+				       s[0].d, s[1].d, s[2].d,
+				       (int) s[3].i, (int) s[4].i,
+				       s[5].d, s[6].d);
+	    break;
+	case SVG_DL_OP_CLOSE_PATH:
+	    status = (engine->close_path) (closure);
+	    break;
+	case SVG_DL_OP_SET_COLOR:
+	    color.is_current_color = (int) s[0].i;
+	    color.rgb = (unsigned int) s[1].i;
+	    status = (engine->set_color) (closure, &color);
+	    break;
+	case SVG_DL_OP_SET_FILL_OPACITY:
+	    status = (engine->set_fill_opacity) (closure, s[0].d);
+	    break;
+	case SVG_DL_OP_SET_FILL_PAINT:
+	case SVG_DL_OP_SET_STROKE_PAINT:
+	    paint.type = (svg_paint_type_t) s[0].i;
+	    switch (paint.type) {
+	    case SVG_PAINT_TYPE_NONE:
+		break;
+	    case SVG_PAINT_TYPE_COLOR:
+		if (num_slots < 3)
+		    goto CORRUPT;
+		paint.p.color.is_current_color = (int) s[1].i;
+		paint.p.color.rgb = (unsigned int) s[2].i;
+		break;
+	    case SVG_PAINT_TYPE_GRADIENT:
+		if (num_slots < 2
+		    || s[1].i < 0 || s[1].i >= header->num_gradients
+		    || gradients[s[1].i].stops == NULL)
+		    goto CORRUPT;
+		paint.p.gradient = &gradients[s[1].i];
+		break;
+	    default:
+		goto CORRUPT;
+	    }
+	    if (record->op == SVG_DL_OP_SET_FILL_PAINT)
+		status = (engine->set_fill_paint) (closure, &paint);
+	    else
+		status = (engine->set_stroke_paint) (closure, &paint);
+	    break;
+	case SVG_DL_OP_SET_FILL_RULE:
+	    status = (engine->set_fill_rule) (closure, (svg_fill_rule_t) s[0].i);
+	    break;
+	case SVG_DL_OP_SET_FONT_FAMILY:
+	case SVG_DL_OP_RENDER_TEXT:
+	    /* length of the string, or -1 for NULL, is the last fixed slot */
+	    n = s[SVG_DL_OP_SLOTS[record->op] - 1].i;
+	    if (n >= (int64_t) num_bytes || (n >= 0 && bytes[n] != '\0'))
+		goto CORRUPT;
+	    if (record->op == SVG_DL_OP_SET_FONT_FAMILY) {
+		status = (engine->set_font_family) (closure, n < 0 ? NULL : bytes);
+	    } else {
+		_svg_dl_get_length (&s[0], &l[0]);
+		_svg_dl_get_length (&s[2], &l[1]);
+		status = (engine->render_text) (closure, &l[0], &l[1], n < 0 ? NULL : bytes);
+	    }
+	    break;
+	case SVG_DL_OP_SET_FONT_SIZE:
+	    status = (engine->set_font_size) (closure, s[0].d);
+	    break;
+	case SVG_DL_OP_SET_FONT_STYLE:
+	    status = (engine->set_font_style) (closure, (svg_font_style_t) s[0].i);
+	    break;
+	case SVG_DL_OP_SET_FONT_WEIGHT:
+	    status = (engine->set_font_weight) (closure, (unsigned int) s[0].i);
+	    break;
+	case SVG_DL_OP_SET_OPACITY:
+	    status = (engine->set_opacity) (closure, s[0].d);
+	    break;
+	case SVG_DL_OP_SET_STROKE_DASH_ARRAY:
+	    n = s[0].i;
+	    if (n < 0 || n > (int64_t) (num_slots - 1))
+		goto CORRUPT;
+	    status = (engine->set_stroke_dash_array) (closure,
+						      n ? (double *) &s[1].d : NULL,
+						      (int) n);
+	    break;
+	case SVG_DL_OP_SET_STROKE_DASH_OFFSET:
+	    _svg_dl_get_length (&s[0], &l[0]);
+	    status = (engine->set_stroke_dash_offset) (closure, &l[0]);
+	    break;
+	case SVG_DL_OP_SET_STROKE_LINE_CAP:
+	    status = (engine->set_stroke_line_cap) (closure, (svg_stroke_line_cap_t) s[0].i);
+	    break;
+	case SVG_DL_OP_SET_STROKE_LINE_JOIN:
+	    status = (engine->set_stroke_line_join) (closure, (svg_stroke_line_join_t) s[0].i);
+	    break;
+	case SVG_DL_OP_SET_STROKE_MITER_LIMIT:
+	    status = (engine->set_stroke_miter_limit) (closure, s[0].d);
+	    break;
+	case SVG_DL_OP_SET_STROKE_OPACITY:
+	    status = (engine->set_stroke_opacity) (closure, s[0].d);
+	    break;
+	case SVG_DL_OP_SET_STROKE_WIDTH:
+	    _svg_dl_get_length (&s[0], &l[0]);
+	    status = (engine->set_stroke_width) (closure, &l[0]);
+	    break;
+	case SVG_DL_OP_SET_TEXT_ANCHOR:
+	    status = (engine->set_text_anchor) (closure, (svg_text_anchor_t) s[0].i);
+	    break;
+	case SVG_DL_OP_TRANSFORM:
+	    status = (engine->transform) (closure,
+					  s[0].d, s[1].d,
+					  s[2].d, s[3].d,
+					  s[4].d, s[5].d);
+	    break;
+	case SVG_DL_OP_APPLY_VIEW_BOX:
+	    view_box.box.x = s[0].d;
+	    view_box.box.y = s[1].d;
+	    view_box.box.width = s[2].d;
+	    view_box.box.height = s[3].d;
+	    view_box.aspect_ratio = (svg_preserve_aspect_ratio_t) s[4].i;
+	    view_box.meet_or_slice = (svg_meet_or_slice_t) s[5].i;
+	    _svg_dl_get_length (&s[6], &l[0]);
+	    _svg_dl_get_length (&s[8], &l[1]);
+	    status = (engine->apply_view_box) (closure, view_box, &l[0], &l[1]);
+	    break;
+	case SVG_DL_OP_SET_VIEWPORT_DIMENSION:
+	    _svg_dl_get_length (&s[0], &l[0]);
+	    _svg_dl_get_length (&s[2], &l[1]);
+	    status = (engine->set_viewport_dimension) (closure, &l[0], &l[1]);
+	    break;
+	case SVG_DL_OP_RENDER_LINE:
+	case SVG_DL_OP_RENDER_ELLIPSE:
+	case SVG_DL_OP_RENDER_RECT:
+	    for (i = 0; i < SVG_DL_OP_SLOTS[record->op] / 2; i++)
+		_svg_dl_get_length (&s[2 * i], &l[i]);
+	    if (record->op == SVG_DL_OP_RENDER_LINE)
+		status = (engine->render_line) (closure, &l[0], &l[1], &l[2], &l[3]);
+	    else if (record->op == SVG_DL_OP_RENDER_ELLIPSE)
+		status = (engine->render_ellipse) (closure, &l[0], &l[1], &l[2], &l[3]);
+	    else
+		status = (engine->render_rect) (closure, &l[0], &l[1], &l[2], &l[3], &l[4], &l[5]);
+	    break;
+	case SVG_DL_OP_RENDER_PATH:
+	    status = (engine->render_path) (closure);
+	    break;
+	case SVG_DL_OP_RENDER_IMAGE:
+	    if (s[0].i < 0 || s[1].i < 0
+		|| (uint64_t) s[0].i * (uint64_t) s[1].i * 4 > num_bytes)
+		goto CORRUPT;
+	    for (i = 0; i < 4; i++)
+		_svg_dl_get_length (&s[2 + 2 * i], &l[i]);
+	    status = (engine->render_image) (closure,
+					     (unsigned char *) bytes,
+					     (unsigned int) s[0].i,
+					     (unsigned int) s[1].i,
+					     &l[0], &l[1], &l[2], &l[3]);
+	    break;
+	case SVG_DL_OP_SET_IMAGE_OPAQUE:
+	    if (engine->set_image_opaque)
+		status = (engine->set_image_opaque) (closure, (int) s[0].i);
+	    else
+		status = SVG_STATUS_SUCCESS;
+	    break;
+	case SVG_DL_OP_GRADIENT:
+	{
+	    svg_gradient_t *gradient;
+
+	    n = s[20].i;
+	    if (s[0].i < 0 || s[0].i >= header->num_gradients
+		|| n < 0 || n > header->num_stops - next_stop
+		|| num_slots < 21 + (size_t) n * SVG_DL_GRADIENT_STOP_SLOTS)
+		goto CORRUPT;
+
+	    gradient = &gradients[s[0].i];
+	    gradient->type = (svg_gradient_type_t) s[1].i;
+	    gradient->units = (svg_gradient_units_t) s[2].i;
+	    gradient->spread = (svg_gradient_spread_t) s[3].i;
+	    for (i = 0; i < 6; i++)
+		gradient->transform[i] = s[4 + i].d;
+	    if (gradient->type == SVG_GRADIENT_LINEAR) {
+		_svg_dl_get_length (&s[10], &gradient->u.linear.x1);
+		_svg_dl_get_length (&s[12], &gradient->u.linear.y1);
+		_svg_dl_get_length (&s[14], &gradient->u.linear.x2);
+		_svg_dl_get_length (&s[16], &gradient->u.linear.y2);
+	    } else {
+		_svg_dl_get_length (&s[10], &gradient->u.radial.cx);
+		_svg_dl_get_length (&s[12], &gradient->u.radial.cy);
+		_svg_dl_get_length (&s[14], &gradient->u.radial.r);
+		_svg_dl_get_length (&s[16], &gradient->u.radial.fx);
+		_svg_dl_get_length (&s[18], &gradient->u.radial.fy);
+	    }
+	    gradient->stops = &stops[next_stop];
+	    gradient->num_stops = (int) n;
+	    gradient->stops_size = (int) n;
+	    for (i = 0; i < n; i++) {
+		const svg_dl_slot_t *stop = &s[21 + i * SVG_DL_GRADIENT_STOP_SLOTS];
+		gradient->stops[i].offset = stop[0].d;
+		gradient->stops[i].opacity = stop[1].d;
+		gradient->stops[i].color.is_current_color = (int) stop[2].i;
+		gradient->stops[i].color.rgb = (unsigned int) stop[3].i;
+	    }
+	    next_stop += (unsigned int) n;
+	    status = SVG_STATUS_SUCCESS;
+	    break;
+	}
+	default:
+	    goto CORRUPT;
+	}
+
+	/* Keep going after an error, like the tree walk does, so that
+	   every begin_* still gets its end_* */
+	if (status && !return_status)
+	    return_status = status;
+    }
+
+    /* a stream cut short between records */
+    if (num_open)
+	goto CORRUPT;
+
+    free (open);
+    free (gradients);
+
+    if (return_status)
+	return return_status;
+
+    return (svg_status_t) header->render_status;
+
+  CORRUPT:
+    status = SVG_STATUS_PARSE_ERROR;
+
+    /* Close what was opened before the bad record, innermost first,
+       so the engine is left as balanced as after a complete replay */
+  UNWIND:
+    while (num_open) {
+	record = open[--num_open];
+	if (record->op == SVG_DL_OP_BEGIN_GROUP)
+	    (engine->end_group) (closure, ((const svg_dl_slot_t *) (record + 1))[0].d);
+	else
+	    (engine->end_element) (closure);
+    }
+
+    free (open);
+    free (gradients);
+    return status;
+}
+
+static svg_status_t
+_svg_dl_reserve (svg_dl_compiler_t *dl, size_t size)
+{
+    char *new_data;
+    size_t new_size;
+
+    if (dl->size + size <= dl->data_size)
+	return SVG_STATUS_SUCCESS;
+
+    new_size = dl->data_size ? dl->data_size : 4096;
+    while (new_size < dl->size + size)
+	new_size *= 2;
+
+    new_data = (char *)realloc (dl->data, new_size);
+    if (new_data == NULL)
+	return SVG_STATUS_NO_MEMORY;
+
+    dl->data = new_data;
+    dl->data_size = new_size;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+/* Append a zero-filled record and return its slots, raw bytes start
+   right after the last slot. The pointer is only good until the next
+   record is started. */
+static svg_dl_slot_t *
+_svg_dl_begin_record (svg_dl_compiler_t *dl, svg_dl_op_t op, int num_slots, size_t num_bytes)
+{
+    svg_dl_record_t *record;
+    size_t size;
+
+    /* Once recording has failed, stay failed */
+    if (dl->status)
+	return NULL;
+
+    size = sizeof (svg_dl_record_t) + num_slots * sizeof (svg_dl_slot_t) + SVG_DL_ALIGN (num_bytes);
+    if ((uint64_t) size > 0xffffffffu) {
+	dl->status = SVG_STATUS_INVALID_VALUE;
+	return NULL;
+    }
+
+    dl->status = _svg_dl_reserve (dl, size);
+    if (dl->status)
+	return NULL;
+
+    record = (svg_dl_record_t *) (dl->data + dl->size);
+    memset (record, 0, size);
+    record->op = op;
+    record->size = (uint32_t) size;
+    dl->size += size;
+
+    return (svg_dl_slot_t *) (record + 1);
+}
+
+static void
+_svg_dl_put_length (svg_dl_slot_t *slot, const svg_length_t *length)
+{
+    slot[0].d = length->value;
+    slot[1].i = length->unit | (length->orientation << 8);
+}
+
+static void
+_svg_dl_get_length (const svg_dl_slot_t *slot, svg_length_t *length)
+{
+    length->value = slot[0].d;
+    length->unit = (svg_length_unit_t) (slot[1].i & 0xff);
+    length->orientation = (svg_length_orientation_t) ((slot[1].i >> 8) & 0xff);
+}
+
+/* Remember a begin_* record replayed, for the matching end_* check
+   and for unwinding */
+static svg_status_t
+_svg_dl_push_open (const svg_dl_record_t ***open, size_t *num_open, size_t *open_size,
+		   const svg_dl_record_t *record)
+{
+    const svg_dl_record_t **new_open;
+    size_t new_size;
+
+    if (*num_open == *open_size) {
+	new_size = *open_size ? *open_size * 2 : 32;
+	new_open = (const svg_dl_record_t **)realloc (*open, new_size * sizeof (svg_dl_record_t *));
+	if (new_open == NULL)
+	    return SVG_STATUS_NO_MEMORY;
+	*open = new_open;
+	*open_size = new_size;
+    }
+
+    (*open)[(*num_open)++] = record;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+/* Record an op whose slots are all doubles */
+static svg_status_t
+_svg_dl_record_slots (svg_dl_compiler_t *dl, svg_dl_op_t op, int num_slots, ...)
+{
+    svg_dl_slot_t *slot;
+    va_list ap;
+    int i;
+
+    slot = _svg_dl_begin_record (dl, op, num_slots, 0);
+    if (slot == NULL)
+	return dl->status;
+
+    va_start (ap, num_slots);
+    for (i = 0; i < num_slots; i++)
+	slot[i].d = va_arg (ap, double);
+    va_end (ap);
+
+    return SVG_STATUS_SUCCESS;
+}
+
+/* Record an op whose last fixed slot is the length of a trailing
+   NUL-terminated string */
+static svg_status_t
+_svg_dl_record_string (svg_dl_compiler_t *dl, svg_dl_op_t op,
+		       int num_slots, const svg_dl_slot_t *slots,
+		       const char *str)
+{
+    svg_dl_slot_t *slot;
+    size_t len = str ? strlen (str) : 0;
+
+    slot = _svg_dl_begin_record (dl, op, num_slots, str ? len + 1 : 0);
+    if (slot == NULL)
+	return dl->status;
+
+    if (num_slots > 1)
+	memcpy (slot, slots, (num_slots - 1) * sizeof (svg_dl_slot_t));
+    slot[num_slots - 1].i = str ? (int64_t) len : -1;
+    if (str)
+	memcpy (slot + num_slots, str, len + 1);
+
+    return SVG_STATUS_SUCCESS;
+}
+
+static svg_status_t
+_svg_dl_record_paint (svg_dl_compiler_t *dl, svg_dl_op_t op, const svg_paint_t *paint)
+{
+    svg_dl_slot_t *slot;
+    int index;
+
+    if (dl->status)
+	return dl->status;
+
+    switch (paint->type) {
+    case SVG_PAINT_TYPE_NONE:
+	slot = _svg_dl_begin_record (dl, op, 1, 0);
+	if (slot == NULL)
+	    return dl->status;
+	slot[0].i = paint->type;
+	break;
+    case SVG_PAINT_TYPE_COLOR:
+	slot = _svg_dl_begin_record (dl, op, 3, 0);
+	if (slot == NULL)
+	    return dl->status;
+	slot[0].i = paint->type;
+	slot[1].i = paint->p.color.is_current_color;
+	slot[2].i = paint->p.color.rgb;
+	break;
+    case SVG_PAINT_TYPE_GRADIENT:
+	dl->status = _svg_dl_record_gradient (dl, paint->p.gradient, &index);
+	if (dl->status)
+	    return dl->status;
+	slot = _svg_dl_begin_record (dl, op, 2, 0);
+	if (slot == NULL)
+	    return dl->status;
+	slot[0].i = paint->type;
+	slot[1].i = index;
+	break;
+    case SVG_PAINT_TYPE_PATTERN:
+    default:
+	/* XXX: Pattern tiles are rendered from the element tree. */
+	dl->status = SVG_STATUS_INVALID_CALL;
+	return dl->status;
+    }
+
+    return SVG_STATUS_SUCCESS;
+}
+
+static svg_status_t
+_svg_dl_record_gradient (svg_dl_compiler_t *dl, const svg_gradient_t *gradient, int *index)
+{
+    const svg_gradient_t **new_gradients;
+    svg_dl_slot_t *slot;
+    int i;
+
+    for (i = 0; i < dl->num_gradients; i++) {
+	if (dl->gradients[i] == gradient) {
+	    *index = i;
+	    return SVG_STATUS_SUCCESS;
+	}
+    }
+
+    if (dl->num_gradients >= dl->gradients_size) {
+	int old_size = dl->gradients_size;
+	if (dl->gradients_size)
+	    dl->gradients_size *= 2;
+	else
+	    dl->gradients_size = 4;
+	new_gradients = (const svg_gradient_t **)realloc (dl->gradients,
+				dl->gradients_size * sizeof (svg_gradient_t *));
+	if (new_gradients == NULL) {
+	    dl->gradients_size = old_size;
+	    return SVG_STATUS_NO_MEMORY;
+	}
+	dl->gradients = new_gradients;
+    }
+
+    slot = _svg_dl_begin_record (dl, SVG_DL_OP_GRADIENT,
+				 21 + gradient->num_stops * SVG_DL_GRADIENT_STOP_SLOTS, 0);
+    if (slot == NULL)
+	return dl->status;
+
+    slot[0].i = dl->num_gradients;
+    slot[1].i = gradient->type;
+    slot[2].i = gradient->units;
+    slot[3].i = gradient->spread;
+    for (i = 0; i < 6; i++)
+	slot[4 + i].d = gradient->transform[i];
+    if (gradient->type == SVG_GRADIENT_LINEAR) {
+	_svg_dl_put_length (&slot[10], &gradient->u.linear.x1);
+	_svg_dl_put_length (&slot[12], &gradient->u.linear.y1);
+	_svg_dl_put_length (&slot[14], &gradient->u.linear.x2);
+	_svg_dl_put_length (&slot[16], &gradient->u.linear.y2);
+    } else {
+	_svg_dl_put_length (&slot[10], &gradient->u.radial.cx);
+	_svg_dl_put_length (&slot[12], &gradient->u.radial.cy);
+	_svg_dl_put_length (&slot[14], &gradient->u.radial.r);
+	_svg_dl_put_length (&slot[16], &gradient->u.radial.fx);
+	_svg_dl_put_length (&slot[18], &gradient->u.radial.fy);
+    }
+    slot[20].i = gradient->num_stops;
+    for (i = 0; i < gradient->num_stops; i++) {
+	svg_dl_slot_t *stop = &slot[21 + i * SVG_DL_GRADIENT_STOP_SLOTS];
+	stop[0].d = gradient->stops[i].offset;
+	stop[1].d = gradient->stops[i].opacity;
+	stop[2].i = gradient->stops[i].color.is_current_color;
+	stop[3].i = gradient->stops[i].color.rgb;
+    }
+
+    *index = dl->num_gradients;
+    dl->gradients[dl->num_gradients++] = gradient;
+    dl->num_stops += gradient->num_stops;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+static svg_status_t
+_svg_dl_begin_group (void *closure, double opacity)
+{
+    return _svg_dl_record_slots ((svg_dl_compiler_t *) closure, SVG_DL_OP_BEGIN_GROUP, 1, opacity);
+}
+
+static svg_status_t
+_svg_dl_begin_element (void *closure)
+{
+    return _svg_dl_record_slots ((svg_dl_compiler_t *) closure, SVG_DL_OP_BEGIN_ELEMENT, 0);
+}
+
+static svg_status_t
+_svg_dl_end_element (void *closure)
+{
+    return _svg_dl_record_slots ((svg_dl_compiler_t *) closure, SVG_DL_OP_END_ELEMENT, 0);
+}
+
+static svg_status_t
+_svg_dl_end_group (void *closure, double opacity)
+{
+    return _svg_dl_record_slots ((svg_dl_compiler_t *) closure, SVG_DL_OP_END_GROUP, 1, opacity);
+}
+
+static svg_status_t
+_svg_dl_move_to (void *closure, double x, double y)
+{
+    return _svg_dl_record_slots ((svg_dl_compiler_t *) closure, SVG_DL_OP_MOVE_TO, 2, x, y);
+}
+
+static svg_status_t
+_svg_dl_line_to (void *closure, double x, double y)
+{
+    return _svg_dl_record_slots ((svg_dl_compiler_t *) closure, SVG_DL_OP_LINE_TO, 2, x, y);
+}
+
+static svg_status_t
+_svg_dl_curve_to (void *closure,
+		  double x1, double y1,
+		  double x2, double y2,
+		  double x3, double y3)
+{
+    return _svg_dl_record_slots ((svg_dl_compiler_t *) closure, SVG_DL_OP_CURVE_TO, 6,
+				 x1, y1, x2, y2, x3, y3);
+}
+
+static svg_status_t
+_svg_dl_quadratic_curve_to (void *closure,
+			    double x1, double y1,
+			    double x2, double y2)
+{
+    return _svg_dl_record_slots ((svg_dl_compiler_t *) closure, SVG_DL_OP_QUADRATIC_CURVE_TO, 4,
+				 x1, y1, x2, y2);
+}
+
+static svg_status_t
+_svg_dl_arc_to (void	       *closure,
+		double		rx,
+		double		ry,
+		double		x_axis_rotation,
+		int		large_arc_flag,
+		int		sweep_flag,
+		double		x,
+		double		y)
+{
+    svg_dl_compiler_t *dl = (svg_dl_compiler_t *) closure;
+    svg_dl_slot_t *slot;
+
+    slot = _svg_dl_begin_record (dl, SVG_DL_OP_ARC_TO, 7, 0);
+    if (slot == NULL)
+	return dl->status;
+
+    slot[0].d = rx;
+    slot[1].d = ry;
+    slot[2].d = x_axis_rotation;
+    slot[3].i = large_arc_flag;
+    slot[4].i = sweep_flag;
+    slot[5].d = x;
+    slot[6].d = y;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+static svg_status_t
+_svg_dl_close_path (void *closure)
+{
+    return _svg_dl_record_slots ((svg_dl_compiler_t *) closure, SVG_DL_OP_CLOSE_PATH, 0);
+}
+
+/* Record an op with a single integer slot */
+static svg_status_t
+_svg_dl_record_int (svg_dl_compiler_t *dl, svg_dl_op_t op, int64_t value)
+{
+    svg_dl_slot_t *slot;
+
+    slot = _svg_dl_begin_record (dl, op, 1, 0);
+    if (slot == NULL)
+	return dl->status;
+
+    slot[0].i = value;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+/* Record an op with lengths only */
+static svg_status_t
+_svg_dl_record_lengths (svg_dl_compiler_t *dl, svg_dl_op_t op,
+			int num_lengths, svg_length_t **lengths)
+{
+    svg_dl_slot_t *slot;
+    int i;
+
+    slot = _svg_dl_begin_record (dl, op, 2 * num_lengths, 0);
+    if (slot == NULL)
+	return dl->status;
+
+    for (i = 0; i < num_lengths; i++)
+	_svg_dl_put_length (&slot[2 * i], lengths[i]);
+
+    return SVG_STATUS_SUCCESS;
+}
+
+static svg_status_t
+_svg_dl_set_color (void *closure, const svg_color_t *color)
+{
+    svg_dl_compiler_t *dl = (svg_dl_compiler_t *) closure;
+    svg_dl_slot_t *slot;
+
+    slot = _svg_dl_begin_record (dl, SVG_DL_OP_SET_COLOR, 2, 0);
+    if (slot == NULL)
+	return dl->status;
+
+    slot[0].i = color->is_current_color;
+    slot[1].i = color->rgb;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+static svg_status_t
+_svg_dl_set_fill_opacity (void *closure, double fill_opacity)
+{
+    return _svg_dl_record_slots ((svg_dl_compiler_t *) closure, SVG_DL_OP_SET_FILL_OPACITY, 1, fill_opacity);
+}
+
+static svg_status_t
+_svg_dl_set_fill_paint (void *closure, const svg_paint_t *paint)
+{
+    return _svg_dl_record_paint ((svg_dl_compiler_t *) closure, SVG_DL_OP_SET_FILL_PAINT, paint);
+}
+
+static svg_status_t
+_svg_dl_set_fill_rule (void *closure, svg_fill_rule_t fill_rule)
+{
+    return _svg_dl_record_int ((svg_dl_compiler_t *) closure, SVG_DL_OP_SET_FILL_RULE, fill_rule);
+}
+
+static svg_status_t
+_svg_dl_set_font_family (void *closure, const char *family)
+{
+    return _svg_dl_record_string ((svg_dl_compiler_t *) closure, SVG_DL_OP_SET_FONT_FAMILY,
+				  1, NULL, family);
+}
+
+static svg_status_t
+_svg_dl_set_font_size (void *closure, double size)
+{
+    return _svg_dl_record_slots ((svg_dl_compiler_t *) closure, SVG_DL_OP_SET_FONT_SIZE, 1, size);
+}
+
+static svg_status_t
+_svg_dl_set_font_style (void *closure, svg_font_style_t font_style)
+{
+    return _svg_dl_record_int ((svg_dl_compiler_t *) closure, SVG_DL_OP_SET_FONT_STYLE, font_style);
+}
+
+static svg_status_t
+_svg_dl_set_font_weight (void *closure, unsigned int weight)
+{
+    return _svg_dl_record_int ((svg_dl_compiler_t *) closure, SVG_DL_OP_SET_FONT_WEIGHT, weight);
+}
+
+static svg_status_t
+_svg_dl_set_opacity (void *closure, double opacity)
+{
+    return _svg_dl_record_slots ((svg_dl_compiler_t *) closure, SVG_DL_OP_SET_OPACITY, 1, opacity);
+}
+
+static svg_status_t
+_svg_dl_set_stroke_dash_array (void *closure, double *dash, int num_dashes)
+{
+    svg_dl_compiler_t *dl = (svg_dl_compiler_t *) closure;
+    svg_dl_slot_t *slot;
+    int i;
+
+    if (dash == NULL)
+	num_dashes = 0;
+
+    slot = _svg_dl_begin_record (dl, SVG_DL_OP_SET_STROKE_DASH_ARRAY, 1 + num_dashes, 0);
+    if (slot == NULL)
+	return dl->status;
+
+    slot[0].i = num_dashes;
+    for (i = 0; i < num_dashes; i++)
+	slot[1 + i].d = dash[i];
+
+    return SVG_STATUS_SUCCESS;
+}
+
+static svg_status_t
+_svg_dl_set_stroke_dash_offset (void *closure, svg_length_t *offset)
+{
+    return _svg_dl_record_lengths ((svg_dl_compiler_t *) closure, SVG_DL_OP_SET_STROKE_DASH_OFFSET,
+				   1, &offset);
+}
+
+static svg_status_t
+_svg_dl_set_stroke_line_cap (void *closure, svg_stroke_line_cap_t line_cap)
+{
+    return _svg_dl_record_int ((svg_dl_compiler_t *) closure, SVG_DL_OP_SET_STROKE_LINE_CAP, line_cap);
+}
+
+static svg_status_t
+_svg_dl_set_stroke_line_join (void *closure, svg_stroke_line_join_t line_join)
+{
+    return _svg_dl_record_int ((svg_dl_compiler_t *) closure, SVG_DL_OP_SET_STROKE_LINE_JOIN, line_join);
+}
+
+static svg_status_t
+_svg_dl_set_stroke_miter_limit (void *closure, double limit)
+{
+    return _svg_dl_record_slots ((svg_dl_compiler_t *) closure, SVG_DL_OP_SET_STROKE_MITER_LIMIT, 1, limit);
+}
+
+static svg_status_t
+_svg_dl_set_stroke_opacity (void *closure, double stroke_opacity)
+{
+    return _svg_dl_record_slots ((svg_dl_compiler_t *) closure, SVG_DL_OP_SET_STROKE_OPACITY, 1, stroke_opacity);
+}
+
+static svg_status_t
+_svg_dl_set_stroke_paint (void *closure, const svg_paint_t *paint)
+{
+    return _svg_dl_record_paint ((svg_dl_compiler_t *) closure, SVG_DL_OP_SET_STROKE_PAINT, paint);
+}
+
+static svg_status_t
+_svg_dl_set_stroke_width (void *closure, svg_length_t *width)
+{
+    return _svg_dl_record_lengths ((svg_dl_compiler_t *) closure, SVG_DL_OP_SET_STROKE_WIDTH,
+				   1, &width);
+}
+
+static svg_status_t
+_svg_dl_set_text_anchor (void *closure, svg_text_anchor_t text_anchor)
+{
+    return _svg_dl_record_int ((svg_dl_compiler_t *) closure, SVG_DL_OP_SET_TEXT_ANCHOR, text_anchor);
+}
+
+static svg_status_t
+_svg_dl_transform (void *closure,
+		   double a, double b,
+		   double c, double d,
+		   double e, double f)
+{
+    return _svg_dl_record_slots ((svg_dl_compiler_t *) closure, SVG_DL_OP_TRANSFORM, 6,
+				 a, b, c, d, e, f);
+}
+
+static svg_status_t
+_svg_dl_apply_view_box (void *closure,
+			svg_view_box_t view_box,
+			svg_length_t *width,
+			svg_length_t *height)
+{
+    svg_dl_compiler_t *dl = (svg_dl_compiler_t *) closure;
+    svg_dl_slot_t *slot;
+
+    slot = _svg_dl_begin_record (dl, SVG_DL_OP_APPLY_VIEW_BOX, 10, 0);
+    if (slot == NULL)
+	return dl->status;
+
+    slot[0].d = view_box.box.x;
+    slot[1].d = view_box.box.y;
+    slot[2].d = view_box.box.width;
+    slot[3].d = view_box.box.height;
+    slot[4].i = view_box.aspect_ratio;
+    slot[5].i = view_box.meet_or_slice;
+    _svg_dl_put_length (&slot[6], width);
+    _svg_dl_put_length (&slot[8], height);
+
+    return SVG_STATUS_SUCCESS;
+}
+
+static svg_status_t
+_svg_dl_set_viewport_dimension (void *closure,
+				svg_length_t *width,
+				svg_length_t *height)
+{
+    svg_length_t *lengths[2] = { width, height };
+
+    return _svg_dl_record_lengths ((svg_dl_compiler_t *) closure, SVG_DL_OP_SET_VIEWPORT_DIMENSION,
+				   2, lengths);
+}
+
+static svg_status_t
+_svg_dl_render_line (void *closure,
+		     svg_length_t *x1, svg_length_t *y1,
+		     svg_length_t *x2, svg_length_t *y2)
+{
+    svg_length_t *lengths[4] = { x1, y1, x2, y2 };
+
+    return _svg_dl_record_lengths ((svg_dl_compiler_t *) closure, SVG_DL_OP_RENDER_LINE,
+				   4, lengths);
+}
+
+static svg_status_t
+_svg_dl_render_path (void *closure)
+{
+    return _svg_dl_record_slots ((svg_dl_compiler_t *) closure, SVG_DL_OP_RENDER_PATH, 0);
+}
+
+static svg_status_t
+_svg_dl_render_ellipse (void *closure,
+			svg_length_t *cx, svg_length_t *cy,
+			svg_length_t *rx, svg_length_t *ry)
+{
+    svg_length_t *lengths[4] = { cx, cy, rx, ry };
+
+    return _svg_dl_record_lengths ((svg_dl_compiler_t *) closure, SVG_DL_OP_RENDER_ELLIPSE,
+				   4, lengths);
+}
+
+static svg_status_t
+_svg_dl_render_rect (void 	     *closure,
+		     svg_length_t *x, svg_length_t *y,
+		     svg_length_t *width, svg_length_t *height,
+		     svg_length_t *rx, svg_length_t *ry)
+{
+    svg_length_t *lengths[6] = { x, y, width, height, rx, ry };
+
+    return _svg_dl_record_lengths ((svg_dl_compiler_t *) closure, SVG_DL_OP_RENDER_RECT,
+				   6, lengths);
+}
+
+static svg_status_t
+_svg_dl_render_text (void 	      *closure,
+		     svg_length_t *x,
+		     svg_length_t *y,
+		     const char   *utf8)
+{
+    svg_dl_slot_t slots[4];
+
+    _svg_dl_put_length (&slots[0], x);
+    _svg_dl_put_length (&slots[2], y);
+
+    return _svg_dl_record_string ((svg_dl_compiler_t *) closure, SVG_DL_OP_RENDER_TEXT,
+				  5, slots, utf8);
+}
+
+static svg_status_t
+_svg_dl_render_image (void		*closure,
+		      unsigned char	*data,
+		      unsigned int	data_width,
+		      unsigned int	data_height,
+		      svg_length_t	*x,
+		      svg_length_t	*y,
+		      svg_length_t	*width,
+		      svg_length_t	*height)
+{
+    svg_dl_compiler_t *dl = (svg_dl_compiler_t *) closure;
+    svg_dl_slot_t *slot;
+    size_t num_bytes = (size_t) data_width * data_height * 4;
+
+    slot = _svg_dl_begin_record (dl, SVG_DL_OP_RENDER_IMAGE, 10, num_bytes);
+    if (slot == NULL)
+	return dl->status;
+
+    slot[0].i = data_width;
+    slot[1].i = data_height;
+    _svg_dl_put_length (&slot[2], x);
+    _svg_dl_put_length (&slot[4], y);
+    _svg_dl_put_length (&slot[6], width);
+    _svg_dl_put_length (&slot[8], height);
+    if (num_bytes)
+	memcpy (slot + 10, data, num_bytes);
+
+    return SVG_STATUS_SUCCESS;
+}
+
+static svg_status_t
+_svg_dl_set_image_opaque (void *closure, int opaque)
+{
+    return _svg_dl_record_int ((svg_dl_compiler_t *) closure, SVG_DL_OP_SET_IMAGE_OPAQUE, opaque);
+}
@@ -20,23 +20,107 @@
    Author: Carl Worth <cworth@isi.edu>
 */
 
+#include <math.h>
+#include <stddef.h>
 #include <string.h>
 
 #include "svgint.h"
 
+#ifdef _WIN32
+#define M_SQRT2     1.41421356237309504880168872420969808   /* sqrt(2) */
+#endif
+
+static size_t
+_svg_element_size (svg_element_type_t type);
+
+static int
+_svg_element_can_fold_opacity (svg_element_t *element);
+
+static int
+_svg_element_needs_state (svg_element_t *element);
+
+static int
+_svg_element_get_visibility (svg_element_t		*element,
+			     svg_render_engine_t	*engine,
+			     void			*closure,
+			     const svg_bbox_t		*region);
+
+static svg_status_t
+_svg_element_render_below_detail (svg_element_t		*element,
+				  svg_render_engine_t	*engine,
+				  void			*closure);
+
+static void
+_svg_element_get_local_transform (svg_element_t *element, svg_transform_t *transform);
+
+static const svg_bbox_t *
+_svg_element_get_child_region (svg_element_t	*element,
+			       const svg_bbox_t	*region,
+			       svg_bbox_t	*child_region);
+
 svgint_status_t
 _svg_element_create (svg_element_t	**element,
 		     svg_element_type_t	type,
 		     svg_element_t	*parent,
 		     svg_t		*doc)
 {
-    *element = (svg_element_t *)malloc( sizeof (svg_element_t));
+    *element = (svg_element_t *)malloc (_svg_element_size (type));
     if (*element == NULL)
 	return (svgint_status_t)SVG_STATUS_NO_MEMORY;
 
     return (svgint_status_t)_svg_element_init (*element, type, parent, doc);
 }
 
+/* Elements are allocated only as large as the member of e their type
+   uses, so a line doesn't pay for a gradient's stops. */
+static size_t
+_svg_element_size (svg_element_type_t type)
+{
+    size_t size;
+
+    switch (type) {
+    case SVG_ELEMENT_TYPE_SVG_GROUP:
+    case SVG_ELEMENT_TYPE_GROUP:
+    case SVG_ELEMENT_TYPE_DEFS:
+    case SVG_ELEMENT_TYPE_USE:
+    case SVG_ELEMENT_TYPE_SYMBOL:
+	size = sizeof (svg_group_t);
+	break;
+    case SVG_ELEMENT_TYPE_PATH:
+	size = sizeof (svg_path_t);
+	break;
+    case SVG_ELEMENT_TYPE_CIRCLE:
+    case SVG_ELEMENT_TYPE_ELLIPSE:
+	size = sizeof (svg_ellipse_t);
+	break;
+    case SVG_ELEMENT_TYPE_LINE:
+	size = sizeof (svg_line_t);
+	break;
+    case SVG_ELEMENT_TYPE_RECT:
+	size = sizeof (svg_rect_element_t);
+	break;
+    case SVG_ELEMENT_TYPE_TEXT:
+	size = sizeof (svg_text_t);
+	break;
+    case SVG_ELEMENT_TYPE_IMAGE:
+	size = sizeof (svg_image_t);
+	break;
+    case SVG_ELEMENT_TYPE_GRADIENT:
+	/* the parser also adds children to gradients as if they
+	   were groups */
+	size = sizeof (svg_gradient_t) > sizeof (svg_group_t)
+	    ? sizeof (svg_gradient_t) : sizeof (svg_group_t);
+	break;
+    case SVG_ELEMENT_TYPE_PATTERN:
+	size = sizeof (svg_pattern_t);
+	break;
+    default:
+	return sizeof (svg_element_t);
+    }
+
+    return offsetof (svg_element_t, e) + size;
+}
+
 svg_status_t
 _svg_element_init (svg_element_t	*element,
 		   svg_element_type_t	type,
@@ -44,17 +128,25 @@ _svg_element_init (svg_element_t	*element,
 		   svg_t		*doc)
 {
     svg_status_t status;
+    svg_style_t style;
 
     element->type = type;
     element->parent = parent;
     element->doc = doc;
     element->id = NULL;
-
-    status = _svg_transform_init (&element->transform);
+    element->needs_state = 1;
+    element->style_id = -1;
+    element->style_delta = ~(uint64_t) 0;
+    element->transform = NULL;
+    element->style = NULL;
+    _svg_bbox_init_unbounded (&element->bbox);
+
+    status = _svg_style_init_empty (&style, doc);
     if (status)
 	return status;
 
-    status = _svg_style_init_empty (&element->style, doc);
+    status = _svg_element_set_style (element, &style);
+    _svg_style_deinit (&style);
     if (status)
 	return status;
 
@@ -109,16 +201,26 @@ _svg_element_init_copy (svg_element_t	*element,
 
     element->type   = other->type;
     element->parent = other->parent;
+    element->doc    = other->doc;
+    element->needs_state = other->needs_state;
+    element->style_id = other->style_id;
+    element->style_delta = other->style_delta;
+    element->bbox = other->bbox;
     if (other->id)
 	element->id = strdup (other->id);
     else
 	element->id = NULL;
 
-    element->transform = other->transform;
+    element->style = other->style;
 
-    status = _svg_style_init_copy (&element->style, &other->style);
-    if (status)
-	return status;
+    if (other->transform) {
+	element->transform = (svg_transform_t *)malloc (sizeof (svg_transform_t));
+	if (element->transform == NULL)
+	    return SVG_STATUS_NO_MEMORY;
+	*element->transform = *other->transform;
+    } else {
+	element->transform = NULL;
+    }
 
     switch (other->type) {
     case SVG_ELEMENT_TYPE_SVG_GROUP:
@@ -168,13 +270,11 @@ _svg_element_deinit (svg_element_t *element)
 {
     svg_status_t status;
 
-    status = _svg_transform_deinit (&element->transform);
-    if (status)
-	return status;
+    free (element->transform);
+    element->transform = NULL;
 
-    status = _svg_style_deinit (&element->style);
-    if (status)
-	return status;
+    /* the style belongs to the document's style table */
+    element->style = NULL;
 
     if (element->id) {
 	free (element->id);
@@ -224,7 +324,7 @@ svgint_status_t
 _svg_element_clone (svg_element_t	**element,
 		    svg_element_t	*other)
 {
-    *element = (svg_element_t	*)malloc( sizeof (svg_element_t));
+    *element = (svg_element_t	*)malloc (_svg_element_size (other->type));
     if (*element == NULL)
 	return (svgint_status_t)SVG_STATUS_NO_MEMORY;
 
@@ -243,30 +343,384 @@ _svg_element_destroy (svg_element_t *element)
     return status;
 }
 
+/* A group with opacity normally has to be composited through an
+   intermediate surface. When its only child paints once (a color fill
+   or stroke, not both, or an image), the opacity can go into that
+   paint's alpha instead. The engine gets the opacity through
+   set_opacity and multiplies it down to the child. Gradient and
+   pattern paints don't take an alpha, so they are not folded. */
+static int
+_svg_element_can_fold_opacity (svg_element_t *element)
+{
+    svg_element_t *child;
+    const svg_style_t *computed;
+    svg_paint_type_t fill_type, stroke_type;
+
+    if (element->e.group.num_elements != 1)
+	return 0;
+
+    child = element->e.group.element[0];
+    switch (child->type) {
+    case SVG_ELEMENT_TYPE_IMAGE:
+	return 1;
+    case SVG_ELEMENT_TYPE_PATH:
+    case SVG_ELEMENT_TYPE_CIRCLE:
+    case SVG_ELEMENT_TYPE_ELLIPSE:
+    case SVG_ELEMENT_TYPE_LINE:
+    case SVG_ELEMENT_TYPE_RECT:
+    case SVG_ELEMENT_TYPE_TEXT:
+	break;
+    default:
+	return 0;
+    }
+
+    /* The child's own opacity is multiplied in by the engine, but
+       fill and stroke are inherited: take them from its computed
+       style, which follows a <use> clone up through the <use> where
+       the parent pointers don't. */
+    if (child->style_id < 0)
+	return 0;
+    computed = child->doc->styles[child->style_id];
+
+    /* defaults: fill black, stroke none */
+    if (computed->flags & SVG_STYLE_FLAG_FILL_PAINT)
+	fill_type = computed->fill_paint.type;
+    else
+	fill_type = SVG_PAINT_TYPE_COLOR;
+    if (computed->flags & SVG_STYLE_FLAG_STROKE_PAINT)
+	stroke_type = computed->stroke_paint.type;
+    else
+	stroke_type = SVG_PAINT_TYPE_NONE;
+
+    if (fill_type == SVG_PAINT_TYPE_NONE)
+	return stroke_type != SVG_PAINT_TYPE_GRADIENT && stroke_type != SVG_PAINT_TYPE_PATTERN;
+    if (stroke_type == SVG_PAINT_TYPE_NONE)
+	return fill_type == SVG_PAINT_TYPE_COLOR;
+
+    return 0;
+}
+
+/* A shape without its own transform or style, or whose style only
+   repeats what it inherits, can be drawn in its parent's state.
+   Opacity is always flagged (it isn't inherited), but 1.0 changes
+   nothing now that engines multiply it in. Text is left out as it
+   selects a font. */
+static int
+_svg_element_needs_state (svg_element_t *element)
+{
+    uint64_t flags = element->style->flags & element->style_delta;
+
+    switch (element->type) {
+    case SVG_ELEMENT_TYPE_PATH:
+    case SVG_ELEMENT_TYPE_CIRCLE:
+    case SVG_ELEMENT_TYPE_ELLIPSE:
+    case SVG_ELEMENT_TYPE_LINE:
+    case SVG_ELEMENT_TYPE_RECT:
+    case SVG_ELEMENT_TYPE_IMAGE:
+	break;
+    default:
+	return 1;
+    }
+
+    if (element->transform)
+	return 1;
+
+    flags &= ~(SVG_STYLE_FLAG_VISIBILITY | SVG_STYLE_FLAG_DISPLAY);
+    if (element->style->opacity == 1.0)
+	flags &= ~SVG_STYLE_FLAG_OPACITY;
+
+    return flags != SVG_STYLE_FLAG_NONE;
+}
+
+/* Elements that can't put anything on the page are SVG_BBOX_HIDDEN
+   and skipped before any state is pushed or path built: a shape whose
+   fill and stroke are both none or fully transparent, anything at
+   opacity 0, anything outside region and, when the engine can tell,
+   anything outside the current clip. Text keeps its paint test off,
+   as it also moves the current point. The engine may also find an
+   element SVG_BBOX_BELOW_DETAIL. */
+static int
+_svg_element_get_visibility (svg_element_t		*element,
+			     svg_render_engine_t	*engine,
+			     void			*closure,
+			     const svg_bbox_t		*region)
+{
+    svg_style_t *computed;
+    svg_status_t status;
+    int visible;
+
+    if (element->style_id >= 0) {
+	computed = element->doc->styles[element->style_id];
+
+	if (computed->opacity <= 0)
+	    return SVG_BBOX_HIDDEN;
+
+	switch (element->type) {
+	case SVG_ELEMENT_TYPE_PATH:
+	case SVG_ELEMENT_TYPE_CIRCLE:
+	case SVG_ELEMENT_TYPE_ELLIPSE:
+	case SVG_ELEMENT_TYPE_LINE:
+	case SVG_ELEMENT_TYPE_RECT:
+	    if ((computed->fill_paint.type == SVG_PAINT_TYPE_NONE
+		 || computed->fill_opacity <= 0)
+		&& (computed->stroke_paint.type == SVG_PAINT_TYPE_NONE
+		    || computed->stroke_opacity <= 0))
+		return SVG_BBOX_HIDDEN;
+	    break;
+	default:
+	    break;
+	}
+    }
+
+    /* the root also sets up the viewport */
+    if (element->parent == NULL)
+	return SVG_BBOX_VISIBLE;
+
+    if (_svg_bbox_is_empty (&element->bbox))
+	return SVG_BBOX_HIDDEN;
+
+    if (region && _svg_bbox_is_bounded (&element->bbox)
+	&& (element->bbox.x2 < region->x1 || element->bbox.x1 > region->x2
+	    || element->bbox.y2 < region->y1 || element->bbox.y1 > region->y2))
+	return SVG_BBOX_HIDDEN;
+
+    if (engine->test_bbox == NULL || ! _svg_bbox_is_bounded (&element->bbox))
+	return SVG_BBOX_VISIBLE;
+
+    status = (engine->test_bbox) (closure,
+				  element->bbox.x1, element->bbox.y1,
+				  element->bbox.x2, element->bbox.y2,
+				  &visible);
+    if (status)
+	return SVG_BBOX_VISIBLE;
+
+    return visible;
+}
+
+/* The color a paint averages out to, with its opacity folded into
+   *opacity. Gradients average their stops; patterns are unknown. */
+static int
+_svg_element_get_average_paint (const svg_paint_t	*paint,
+				const svg_color_t	*current_color,
+				svg_color_t		*color,
+				double			*opacity)
+{
+    const svg_gradient_t *gradient;
+    double r = 0, g = 0, b = 0, a = 0;
+    int i;
+
+    switch (paint->type) {
+    case SVG_PAINT_TYPE_COLOR:
+	*color = paint->p.color.is_current_color ? *current_color : paint->p.color;
+	return 1;
+    case SVG_PAINT_TYPE_GRADIENT:
+	gradient = paint->p.gradient;
+	if (gradient->num_stops == 0)
+	    return 0;
+	for (i = 0; i < gradient->num_stops; i++) {
+	    const svg_color_t *stop = &gradient->stops[i].color;
+	    if (stop->is_current_color)
+		stop = current_color;
+	    r += (stop->rgb >> 16) & 0xff;
+	    g += (stop->rgb >> 8) & 0xff;
+	    b += stop->rgb & 0xff;
+	    a += gradient->stops[i].opacity;
+	}
+	color->is_current_color = 0;
+	color->rgb = ((unsigned int) (r / gradient->num_stops + 0.5) << 16)
+	    | ((unsigned int) (g / gradient->num_stops + 0.5) << 8)
+	    | (unsigned int) (b / gradient->num_stops + 0.5);
+	*opacity *= a / gradient->num_stops;
+	return 1;
+    default:
+	return 0;
+    }
+}
+
+/* Stands in for a shape too small for the engine to show in detail:
+   a rectangle over its box, in the parent's space, filled with its
+   fill's average color, or its stroke's for a line or a shape with
+   no fill. Anything else that small is left out. */
+static svg_status_t
+_svg_element_render_below_detail (svg_element_t		*element,
+				  svg_render_engine_t	*engine,
+				  void			*closure)
+{
+    svg_style_t *computed;
+    svg_paint_t paint, none;
+    double opacity;
+    svg_length_t x, y, width, height, zero;
+    svg_status_t status;
+
+    switch (element->type) {
+    case SVG_ELEMENT_TYPE_PATH:
+    case SVG_ELEMENT_TYPE_CIRCLE:
+    case SVG_ELEMENT_TYPE_ELLIPSE:
+    case SVG_ELEMENT_TYPE_LINE:
+    case SVG_ELEMENT_TYPE_RECT:
+	break;
+    default:
+	return SVG_STATUS_SUCCESS;
+    }
+
+    if (element->style_id < 0 || ! _svg_bbox_is_bounded (&element->bbox))
+	return SVG_STATUS_SUCCESS;
+    computed = element->doc->styles[element->style_id];
+
+    paint.type = SVG_PAINT_TYPE_COLOR;
+    opacity = computed->opacity;
+    /* a line has nothing to fill */
+    if (element->type != SVG_ELEMENT_TYPE_LINE
+	&& computed->fill_paint.type != SVG_PAINT_TYPE_NONE
+	&& computed->fill_opacity > 0) {
+	opacity *= computed->fill_opacity;
+	if (! _svg_element_get_average_paint (&computed->fill_paint, &computed->color,
+					      &paint.p.color, &opacity))
+	    return SVG_STATUS_SUCCESS;
+    } else {
+	opacity *= computed->stroke_opacity;
+	if (! _svg_element_get_average_paint (&computed->stroke_paint, &computed->color,
+					      &paint.p.color, &opacity))
+	    return SVG_STATUS_SUCCESS;
+    }
+    none.type = SVG_PAINT_TYPE_NONE;
+
+    _svg_length_init_unit (&x, element->bbox.x1,
+			   SVG_LENGTH_UNIT_PX, SVG_LENGTH_ORIENTATION_HORIZONTAL);
+    _svg_length_init_unit (&y, element->bbox.y1,
+			   SVG_LENGTH_UNIT_PX, SVG_LENGTH_ORIENTATION_VERTICAL);
+    _svg_length_init_unit (&width, element->bbox.x2 - element->bbox.x1,
+			   SVG_LENGTH_UNIT_PX, SVG_LENGTH_ORIENTATION_HORIZONTAL);
+    _svg_length_init_unit (&height, element->bbox.y2 - element->bbox.y1,
+			   SVG_LENGTH_UNIT_PX, SVG_LENGTH_ORIENTATION_VERTICAL);
+    _svg_length_init (&zero, 0);
+
+    status = (engine->begin_element) (closure);
+    if (status)
+	return status;
+
+    status = (engine->set_fill_paint) (closure, &paint);
+    if (status)
+	return status;
+
+    status = (engine->set_fill_opacity) (closure, opacity);
+    if (status)
+	return status;
+
+    status = (engine->set_stroke_paint) (closure, &none);
+    if (status)
+	return status;
+
+    status = (engine->render_rect) (closure, &x, &y, &width, &height, &zero, &zero);
+    if (status)
+	return status;
+
+    return (engine->end_element) (closure);
+}
+
+/* The transform svg_element_render applies, viewBox aside */
+static void
+_svg_element_get_local_transform (svg_element_t *element, svg_transform_t *transform)
+{
+    if (element->transform)
+	*transform = *element->transform;
+    else
+	_svg_transform_init (transform);
+
+    /* TODO : this is probably not the right place to change transform, but
+     atm we dont store svg_length_t in group, so... */
+    if (element->type == SVG_ELEMENT_TYPE_SVG_GROUP ||
+        element->type == SVG_ELEMENT_TYPE_USE)
+	_svg_transform_add_translate (transform, element->e.group.x.value, element->e.group.y.value);
+}
+
+/* Maps region from element's parent's space into element's own, for
+   its children. Returns NULL, meaning no region, when the mapping
+   is only known to the engine (a viewBox) or can't be inverted. The
+   root of svg_render_region takes region as is. */
+static const svg_bbox_t *
+_svg_element_get_child_region (svg_element_t	*element,
+			       const svg_bbox_t	*region,
+			       svg_bbox_t	*child_region)
+{
+    svg_transform_t transform;
+
+    if (region == NULL)
+	return NULL;
+
+    if (element->parent == NULL)
+	return region;
+
+    if ((element->type == SVG_ELEMENT_TYPE_SVG_GROUP ||
+	 element->type == SVG_ELEMENT_TYPE_GROUP) &&
+	element->e.group.view_box.aspect_ratio != SVG_PRESERVE_ASPECT_RATIO_UNKNOWN)
+	return NULL;
+
+    _svg_element_get_local_transform (element, &transform);
+    if (_svg_transform_invert (&transform))
+	return NULL;
+
+    *child_region = *region;
+    _svg_bbox_transform (child_region, &transform);
+
+    return child_region;
+}
+
 svg_status_t
 svg_element_render (svg_element_t		*element,
 		    svg_render_engine_t		*engine,
 		    void			*closure)
+{
+    return _svg_element_render_region (element, engine, closure, NULL);
+}
+
+/* svg_element_render, skipping whatever lies outside region (in the
+   parent's user space; NULL for everything). */
+svg_status_t
+_svg_element_render_region (svg_element_t		*element,
+			    svg_render_engine_t		*engine,
+			    void			*closure,
+			    const svg_bbox_t		*region)
 {
     svg_status_t status, return_status = SVG_STATUS_SUCCESS;
-    svg_transform_t transform = element->transform;
+    svg_transform_t transform;
+    svg_bbox_t child_region;
+    double group_opacity = 1.0;
+    /* the caller maps region, in the root's content space, to its
+       output in place of the root's viewBox */
+    int region_root = region && element->parent == NULL;
 
     /* if the display property is not activated, we dont have to
        draw this element nor its children, so we can safely return here. */
-    status = _svg_style_get_display (&element->style);
+    status = _svg_style_get_display (element->style);
     if (status)
 	return status;
 
+    switch (_svg_element_get_visibility (element, engine, closure, region)) {
+    case SVG_BBOX_HIDDEN:
+	return SVG_STATUS_SUCCESS;
+    case SVG_BBOX_BELOW_DETAIL:
+	return _svg_element_render_below_detail (element, engine, closure);
+    default:
+	break;
+    }
+
     if (element->type == SVG_ELEMENT_TYPE_SVG_GROUP
 	|| element->type == SVG_ELEMENT_TYPE_GROUP) {
 
-	status = (engine->begin_group) (closure, _svg_style_get_opacity(&element->style));
+	group_opacity = _svg_style_get_opacity (element->style);
+	if (group_opacity != 1.0 && _svg_element_can_fold_opacity (element))
+	    group_opacity = 1.0;
+
+	status = (engine->begin_group) (closure, group_opacity);
 	if (status)
 	    return status;
-    } else {
+    } else if (element->needs_state) {
 	status = (engine->begin_element) (closure);
 	if (status)
 	    return status;
+    } else if (! element->doc->shared) {
+	element->doc->elided_state_count++;
     }
 
     if (element->type == SVG_ELEMENT_TYPE_SVG_GROUP)
@@ -277,40 +731,50 @@ svg_element_render (svg_element_t		*element,
     }
 
     /* perform extra viewBox transform */
-    if ((element->type == SVG_ELEMENT_TYPE_SVG_GROUP ||
+    if (! region_root &&
+	(element->type == SVG_ELEMENT_TYPE_SVG_GROUP ||
 	element->type == SVG_ELEMENT_TYPE_GROUP) &&
 	element->e.group.view_box.aspect_ratio != SVG_PRESERVE_ASPECT_RATIO_UNKNOWN)
     {
 	status = (engine->apply_view_box) (closure, element->e.group.view_box,
 					   &element->e.group.width, &element->e.group.height);
     }
-    /* TODO : this is probably not the right place to change transform, but
-     atm we dont store svg_length_t in group, so... */
-    if (element->type == SVG_ELEMENT_TYPE_SVG_GROUP ||
-        element->type == SVG_ELEMENT_TYPE_USE)
-	_svg_transform_add_translate (&transform, element->e.group.x.value, element->e.group.y.value);
+    if (region_root)
+	_svg_transform_init (&transform);
+    else
+	_svg_element_get_local_transform (element, &transform);
 
-    status = _svg_transform_render (&transform, engine, closure);
-    if (status)
-	return status;
+    if (_svg_transform_is_identity (&transform)) {
+	if (! element->doc->shared)
+	    element->doc->elided_state_count++;
+    } else {
+	status = _svg_transform_render (&transform, engine, closure);
+	if (status)
+	    return status;
+    }
 
-    status = _svg_style_render (&element->style, engine, closure);
-    if (status)
-	return status;
+    if (element->needs_state) {
+	status = _svg_style_render (element->style, element->style_delta,
+				    engine, closure);
+	if (status)
+	    return status;
+    }
 
     /* If the element doesnt have children, we can check visibility property, otherwise
        the children will have to be processed. */
     if (element->type != SVG_ELEMENT_TYPE_SVG_GROUP &&
 	element->type != SVG_ELEMENT_TYPE_GROUP &&
 	element->type != SVG_ELEMENT_TYPE_USE)
-	return_status = _svg_style_get_visibility (&element->style);
+	return_status = _svg_style_get_visibility (element->style);
 
     if (return_status == SVG_STATUS_SUCCESS) {
 	switch (element->type) {
 	case SVG_ELEMENT_TYPE_SVG_GROUP:
 	case SVG_ELEMENT_TYPE_GROUP:
 	case SVG_ELEMENT_TYPE_USE:
-	    status = _svg_group_render (&element->e.group, engine, closure);
+	    status = _svg_group_render_region (&element->e.group, engine, closure,
+					       _svg_element_get_child_region (element, region,
+									      &child_region));
 	    break;
 	case SVG_ELEMENT_TYPE_PATH:
 	    status = _svg_path_render (&element->e.path, engine, closure);
@@ -353,10 +817,10 @@ svg_element_render (svg_element_t		*element,
     if (element->type == SVG_ELEMENT_TYPE_SVG_GROUP
 	|| element->type == SVG_ELEMENT_TYPE_GROUP) {
 	
-	status = (engine->end_group) (closure, _svg_style_get_opacity(&element->style));
+	status = (engine->end_group) (closure, group_opacity);
 	if (status && !return_status)
 	    return_status = status;
-    } else {
+    } else if (element->needs_state) {
 	status = (engine->end_element) (closure);
 	if (status && !return_status)
 	    return_status = status;
@@ -365,6 +829,253 @@ svg_element_render (svg_element_t		*element,
     return return_status;
 }
 
+/* Walks the render tree (the same children svg_element_render visits)
+   computing each element's style against its parent's. */
+svg_status_t
+_svg_element_resolve_style (svg_element_t *element, const svg_style_t *parent_style)
+{
+    svg_style_t computed;
+    svg_status_t status;
+    int i;
+
+    element->style_delta = _svg_style_resolve (&computed, parent_style, element->style);
+
+    status = _svg_style_intern (element->doc, &computed, &element->style_id);
+    if (status)
+	return status;
+
+    element->needs_state = _svg_element_needs_state (element);
+
+    switch (element->type) {
+    case SVG_ELEMENT_TYPE_SVG_GROUP:
+    case SVG_ELEMENT_TYPE_GROUP:
+    case SVG_ELEMENT_TYPE_USE:
+	for (i = 0; i < element->e.group.num_elements; i++) {
+	    status = _svg_element_resolve_style (element->e.group.element[i], &computed);
+	    if (status)
+		return status;
+	}
+	break;
+    default:
+	break;
+    }
+
+    return SVG_STATUS_SUCCESS;
+}
+
+/* Points element at the document's copy of style, so elements that
+   specify the same properties share one. */
+svg_status_t
+_svg_element_set_style (svg_element_t *element, const svg_style_t *style)
+{
+    svg_status_t status;
+    int id;
+
+    status = _svg_style_intern (element->doc, style, &id);
+    if (status)
+	return status;
+
+    element->style = element->doc->styles[id];
+
+    return SVG_STATUS_SUCCESS;
+}
+
+/* Computes bbox for element and the render tree below it, children
+   first, and indexes the children of large groups. Stroked shapes
+   grow by the farthest a stroke can reach from the outline: half the
+   width, times the miter limit where there are corners to miter or
+   the square root of 2 for square caps. */
+svg_status_t
+_svg_element_update_bbox (svg_element_t *element)
+{
+    svg_style_t *computed = NULL;
+    svg_transform_t transform;
+    svg_status_t status;
+    svg_bbox_t bbox;
+    double reach;
+    int i;
+
+    if (element->style_id >= 0)
+	computed = element->doc->styles[element->style_id];
+
+    _svg_bbox_init_empty (&bbox);
+
+    switch (element->type) {
+    case SVG_ELEMENT_TYPE_SVG_GROUP:
+    case SVG_ELEMENT_TYPE_GROUP:
+    case SVG_ELEMENT_TYPE_USE:
+	for (i = 0; i < element->e.group.num_elements; i++) {
+	    status = _svg_element_update_bbox (element->e.group.element[i]);
+	    if (status)
+		return status;
+	    _svg_bbox_union (&bbox, &element->e.group.element[i]->bbox);
+	}
+	status = _svg_group_update_index (&element->e.group);
+	if (status)
+	    return status;
+	/* the viewBox mapping is only known to the engine */
+	if (element->type != SVG_ELEMENT_TYPE_USE
+	    && element->e.group.view_box.aspect_ratio != SVG_PRESERVE_ASPECT_RATIO_UNKNOWN)
+	    _svg_bbox_init_unbounded (&bbox);
+	break;
+    case SVG_ELEMENT_TYPE_PATH:
+	_svg_path_get_bbox (&element->e.path, &bbox);
+	break;
+    case SVG_ELEMENT_TYPE_CIRCLE:
+	_svg_circle_get_bbox (&element->e.ellipse, &bbox);
+	break;
+    case SVG_ELEMENT_TYPE_ELLIPSE:
+	_svg_ellipse_get_bbox (&element->e.ellipse, &bbox);
+	break;
+    case SVG_ELEMENT_TYPE_LINE:
+	_svg_line_get_bbox (&element->e.line, &bbox);
+	break;
+    case SVG_ELEMENT_TYPE_RECT:
+	_svg_rect_get_bbox (&element->e.rect, &bbox);
+	break;
+    case SVG_ELEMENT_TYPE_IMAGE:
+	_svg_image_get_bbox (&element->e.image, &bbox);
+	break;
+    case SVG_ELEMENT_TYPE_DEFS:
+    case SVG_ELEMENT_TYPE_GRADIENT:
+    case SVG_ELEMENT_TYPE_PATTERN:
+    case SVG_ELEMENT_TYPE_SYMBOL:
+	break;
+    default:
+	_svg_bbox_init_unbounded (&bbox);
+	break;
+    }
+
+    switch (element->type) {
+    case SVG_ELEMENT_TYPE_PATH:
+    case SVG_ELEMENT_TYPE_CIRCLE:
+    case SVG_ELEMENT_TYPE_ELLIPSE:
+    case SVG_ELEMENT_TYPE_LINE:
+    case SVG_ELEMENT_TYPE_RECT:
+	if (computed == NULL) {
+	    _svg_bbox_init_unbounded (&bbox);
+	    break;
+	}
+	if (computed->stroke_paint.type == SVG_PAINT_TYPE_NONE)
+	    break;
+	if (! _svg_length_is_user_unit (&computed->stroke_width)) {
+	    _svg_bbox_init_unbounded (&bbox);
+	    break;
+	}
+	reach = 1.0;
+	if ((element->type == SVG_ELEMENT_TYPE_PATH
+	     || element->type == SVG_ELEMENT_TYPE_RECT)
+	    && computed->stroke_line_join == SVG_STROKE_LINE_JOIN_MITER
+	    && computed->stroke_miter_limit > reach)
+	    reach = computed->stroke_miter_limit;
+	if (computed->stroke_line_cap == SVG_STROKE_LINE_CAP_SQUARE
+	    && reach < M_SQRT2)
+	    reach = M_SQRT2;
+	_svg_bbox_grow (&bbox, 0.5 * fabs (computed->stroke_width.value) * reach);
+	break;
+    default:
+	break;
+    }
+
+    /* into the parent's space */
+    _svg_element_get_local_transform (element, &transform);
+    _svg_bbox_transform (&bbox, &transform);
+
+    element->bbox = bbox;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+/* Reads every image under element, <defs> and pattern content
+   included, so that rendering never writes to one; decoding the
+   pixels is left to the buffer, which a render that draws the image
+   decodes under its lock. Returns the first error but keeps going; a
+   failed image reports it again when rendered. */
+svg_status_t
+_svg_element_read_images (svg_element_t *element)
+{
+    svg_status_t status, return_status = SVG_STATUS_SUCCESS;
+    int i;
+
+    switch (element->type) {
+    case SVG_ELEMENT_TYPE_SVG_GROUP:
+    case SVG_ELEMENT_TYPE_GROUP:
+    case SVG_ELEMENT_TYPE_DEFS:
+    case SVG_ELEMENT_TYPE_USE:
+    case SVG_ELEMENT_TYPE_SYMBOL:
+	for (i = 0; i < element->e.group.num_elements; i++) {
+	    status = _svg_element_read_images (element->e.group.element[i]);
+	    if (status && !return_status)
+		return_status = status;
+	}
+	break;
+    case SVG_ELEMENT_TYPE_PATTERN:
+	if (element->e.pattern.group_element)
+	    return_status = _svg_element_read_images (element->e.pattern.group_element);
+	break;
+    case SVG_ELEMENT_TYPE_IMAGE:
+	return_status = _svg_image_read_image (&element->e.image);
+	break;
+    default:
+	break;
+    }
+
+    return return_status;
+}
+
+/* Simplifies the paths under element so that none moves by more than
+   tolerance, in element's parent's space (the root's own content
+   space for the root, as for svg_render_region). The tolerance is
+   carried down through each transform at its largest stretch. Stops
+   where that mapping is only known to the engine (a nested viewBox),
+   and skips content drawn at a scale known only when it is used
+   (<defs>, patterns, symbols outside a <use>). */
+svg_status_t
+_svg_element_simplify_paths (svg_element_t *element, double tolerance)
+{
+    svg_transform_t transform;
+    svg_status_t status;
+    double scale;
+    int i;
+
+    if (element->parent) {
+	if ((element->type == SVG_ELEMENT_TYPE_SVG_GROUP ||
+	     element->type == SVG_ELEMENT_TYPE_GROUP ||
+	     element->type == SVG_ELEMENT_TYPE_SYMBOL) &&
+	    element->e.group.view_box.aspect_ratio != SVG_PRESERVE_ASPECT_RATIO_UNKNOWN)
+	    return SVG_STATUS_SUCCESS;
+
+	_svg_element_get_local_transform (element, &transform);
+	scale = _svg_transform_get_max_scale (&transform);
+	if (scale == 0)
+	    return SVG_STATUS_SUCCESS;
+	tolerance /= scale;
+    }
+
+    switch (element->type) {
+    case SVG_ELEMENT_TYPE_SYMBOL:
+	if (element->parent == NULL || element->parent->type != SVG_ELEMENT_TYPE_USE)
+	    break;
+	/* fall through */
+    case SVG_ELEMENT_TYPE_SVG_GROUP:
+    case SVG_ELEMENT_TYPE_GROUP:
+    case SVG_ELEMENT_TYPE_USE:
+	for (i = 0; i < element->e.group.num_elements; i++) {
+	    status = _svg_element_simplify_paths (element->e.group.element[i], tolerance);
+	    if (status)
+		return status;
+	}
+	break;
+    case SVG_ELEMENT_TYPE_PATH:
+	return _svg_path_simplify (&element->e.path, tolerance,
+				   &element->doc->simplified_point_count);
+    default:
+	break;
+    }
+
+    return SVG_STATUS_SUCCESS;
+}
+
 svg_status_t
 _svg_element_get_nearest_viewport (svg_element_t *element, svg_element_t **viewport)
 {
@@ -462,13 +1173,42 @@ _svg_element_apply_attributes (svg_element_t	*element,
 			       const char	**attributes)
 {
     svg_status_t status;
+    svg_transform_t transform;
+    svg_style_t style;
     const char *id;
 
-    status = _svg_transform_apply_attributes (&element->transform, attributes);
+    if (element->transform)
+	transform = *element->transform;
+    else
+	_svg_transform_init (&transform);
+
+    status = _svg_transform_apply_attributes (&transform, attributes);
     if (status)
 	return status;
 
-    status = _svg_style_apply_attributes (&element->style, attributes);
+    /* only elements with a transform carry one */
+    if (! _svg_transform_is_identity (&transform)) {
+	if (element->transform == NULL) {
+	    element->transform = (svg_transform_t *)malloc (sizeof (svg_transform_t));
+	    if (element->transform == NULL)
+		return SVG_STATUS_NO_MEMORY;
+	}
+	*element->transform = transform;
+    } else if (element->transform) {
+	free (element->transform);
+	element->transform = NULL;
+    }
+
+    status = _svg_style_init_copy (&style, element->style);
+    if (status) {
+	_svg_style_deinit (&style);
+	return status;
+    }
+
+    status = _svg_style_apply_attributes (&style, attributes);
+    if (status == SVG_STATUS_SUCCESS)
+	status = _svg_element_set_style (element, &style);
+    _svg_style_deinit (&style);
     if (status)
 	return status;
 
@@ -476,6 +1216,8 @@ _svg_element_apply_attributes (svg_element_t	*element,
     if (id)
 	element->id = strdup (id);
 
+    element->needs_state = _svg_element_needs_state (element);
+
     switch (element->type) {
     case SVG_ELEMENT_TYPE_SVG_GROUP:
 	status = _svg_group_apply_svg_attributes (&element->e.group, attributes);
@@ -20,11 +20,20 @@
    Author: Carl Worth <cworth@isi.edu>
 */
 
+#include <stdlib.h>
+
 #include "svgint.h"
 
+/* Below this a linear pass over the children is as quick as a
+   search */
+#define SVG_GROUP_INDEX_MIN_ELEMENTS 64
+
 static svg_status_t
 _svg_group_grow_element_by (svg_group_t *group, int additional);
 
+static int
+_svg_group_compare_hits (const void *a, const void *b);
+
 svg_status_t
 _svg_group_init (svg_group_t *group)
 {
@@ -40,6 +49,8 @@ _svg_group_init (svg_group_t *group)
     _svg_length_init_unit (&group->x, 0, SVG_LENGTH_UNIT_PX, SVG_LENGTH_ORIENTATION_HORIZONTAL);
     _svg_length_init_unit (&group->y, 0, SVG_LENGTH_UNIT_PX, SVG_LENGTH_ORIENTATION_VERTICAL);
 
+    group->index = NULL;
+
     return SVG_STATUS_SUCCESS;
 }
 
@@ -53,6 +64,7 @@ _svg_group_init_copy (svg_group_t *group,
     group->element = NULL;
     group->num_elements = 0;
     group->element_size = 0;
+    group->index = NULL;
 
     /* clone children */
     for (i=0; i < other->num_elements; i++) {
@@ -88,6 +100,11 @@ _svg_group_deinit (svg_group_t *group)
     group->num_elements = 0;
     group->element_size = 0;
 
+    if (group->index) {
+	_svg_rtree_destroy (group->index);
+	group->index = NULL;
+    }
+
     return SVG_STATUS_SUCCESS;
 }
 
@@ -106,6 +123,12 @@ _svg_group_add_element (svg_group_t *group, svg_element_t *element)
     group->element[group->num_elements] = element;
     group->num_elements++;
 
+    /* the index no longer covers every child */
+    if (group->index) {
+	_svg_rtree_destroy (group->index);
+	group->index = NULL;
+    }
+
     return SVG_STATUS_SUCCESS;
 }
 
@@ -132,6 +155,75 @@ _svg_group_render (svg_group_t		*group,
     return return_status;
 }
 
+/* Children have their boxes by now, see _svg_element_update_bbox */
+svg_status_t
+_svg_group_update_index (svg_group_t *group)
+{
+    if (group->index) {
+	_svg_rtree_destroy (group->index);
+	group->index = NULL;
+    }
+
+    if (group->num_elements < SVG_GROUP_INDEX_MIN_ELEMENTS)
+	return SVG_STATUS_SUCCESS;
+
+    return _svg_rtree_create (&group->index, group->element, group->num_elements);
+}
+
+static int
+_svg_group_compare_hits (const void *a, const void *b)
+{
+    return *(const int *) a - *(const int *) b;
+}
+
+/* Like _svg_group_render, for the children that meet region (in the
+   group's user space). Without a region, an engine that can test
+   boxes still walks the index, so a render clipped to a small part
+   of the output skips whole subtrees of it. Hits come back from the
+   index in spatial order and are sorted back into document order
+   before drawing. */
+svg_status_t
+_svg_group_render_region (svg_group_t		*group,
+			  svg_render_engine_t	*engine,
+			  void			*closure,
+			  const svg_bbox_t	*region)
+{
+    svg_status_t status, return_status = SVG_STATUS_SUCCESS;
+    int *hits = NULL;
+    int num_hits = 0, hits_size = 0;
+    int i;
+
+    if (group->index == NULL || (region == NULL && engine->test_bbox == NULL)) {
+	for (i = 0; i < group->num_elements; i++) {
+	    status = _svg_element_render_region (group->element[i],
+						 engine, closure, region);
+	    if (status && !return_status)
+		return_status = status;
+	}
+	return return_status;
+    }
+
+    status = _svg_rtree_search (group->index, region, engine, closure,
+				&hits, &num_hits, &hits_size);
+    if (status) {
+	free (hits);
+	return status;
+    }
+
+    qsort (hits, num_hits, sizeof (int), _svg_group_compare_hits);
+
+    for (i = 0; i < num_hits; i++) {
+	status = _svg_element_render_region (group->element[hits[i]],
+					     engine, closure, region);
+	if (status && !return_status)
+	    return_status = status;
+    }
+
+    free (hits);
+
+    return return_status;
+}
+
 svg_status_t
 _svg_symbol_render (svg_element_t	*group,
 		    svg_render_engine_t	*engine,
@@ -21,6 +21,8 @@
 */
 
 #include <string.h>
+#include <math.h>
+#include <sys/stat.h>
 #include <png.h>
 #include <jpeglib.h>
 #include <jerror.h>
@@ -30,41 +32,100 @@
 
 #include <string>
 #include <vector>
-#include <iostream>
 #include <sstream> 
 
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define SVG_IMAGE_SSE2 1
+#endif
+
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#define SVG_IMAGE_SSSE3 1
+#endif
+
 #ifdef _WIN32
 #include "Shlwapi.h"
 #endif
 
+static size_t
+_svg_image_base64_decode (const char *src, size_t len, unsigned char **data);
+
 static svg_status_t
-_svg_image_read_png_data (std::istringstream &fileData,
+_svg_image_read_png_data (const unsigned char *fileData,
 						  unsigned long size,
+						  unsigned int	x_pixels,
+						  unsigned int	y_pixels,
 						  char	 	**data,
 						  unsigned int	*width,
 						  unsigned int	*height);
 
+static svg_status_t
+_svg_image_read_png_size (const unsigned char *fileData,
+			  unsigned long size,
+			  unsigned int	*width,
+			  unsigned int	*height,
+			  int		*opaque);
+
 static svg_status_t
 _svg_image_read_jpeg_data (unsigned char *fileData,
 						   unsigned long size,
+						   unsigned int	x_pixels,
+						   unsigned int	y_pixels,
 						   char	 	**data,
 						   unsigned int	*width,
 						   unsigned int	*height);
 
 static svg_status_t
-_svg_image_read_image (svg_image_t *image);
+_svg_image_read_jpeg_size (const unsigned char *fileData,
+			   unsigned long size,
+			   unsigned int	*width,
+			   unsigned int	*height);
+
+static unsigned int
+_svg_image_pixels_needed (double pixels, unsigned int size);
+
+static unsigned int
+_svg_image_box_factor (unsigned int size, unsigned int needed);
+
+static void
+_svg_image_box_add_row (const unsigned char	*row,
+			unsigned int		width,
+			unsigned int		x_factor,
+			unsigned long long	*sums);
+
+static void
+_svg_image_box_emit_row (unsigned long long	*sums,
+			 unsigned int		width,
+			 unsigned int		x_factor,
+			 unsigned int		rows,
+			 unsigned char		*out);
+
+static void
+_svg_image_premultiply_row (unsigned char *row, unsigned int width);
+
+static void
+_svg_image_expand_rgb_row (unsigned char *row, unsigned int width);
+
+static void
+_svg_image_expand_gray_row (unsigned char *row, unsigned int width);
+
+static void
+_svg_image_convert_cmyk_row (unsigned char *row, unsigned int width);
+
+static svg_status_t
+_svg_image_decode (svg_image_t *image);
 
 static svg_status_t
-_svg_image_read_png (const char		*filename,
-		     char	 	**data,
-		     unsigned int	*width,
-		     unsigned int	*height);
+_svg_image_decode_data (unsigned char *buf, size_t size, svg_image_buffer_t **buffer);
+
+static int
+_svg_image_use_cached (svg_image_t *image, const char *key, size_t key_len);
 
 static svg_status_t
-_svg_image_read_jpeg (const char	*filename,
-		      char	 	**data,
-		      unsigned int	*width,
-		      unsigned int	*height);
+_svg_image_read_file (const char	*filename,
+		      unsigned char	**data,
+		      size_t		*size);
 
 svg_status_t
 _svg_image_init (svg_image_t *image)
@@ -76,7 +137,10 @@ _svg_image_init (svg_image_t *image)
 
     image->url = NULL;
 
-    image->data = NULL;
+    image->buffer = NULL;
+
+    image->read = 0;
+    image->read_status = SVG_STATUS_SUCCESS;
 
     return SVG_STATUS_SUCCESS;
 }
@@ -91,6 +155,9 @@ _svg_image_init_copy (svg_image_t *image,
     else
 	image->url = NULL;
 
+    if (other->buffer)
+	image->buffer = _svg_image_buffer_reference (other->buffer);
+
     return SVG_STATUS_SUCCESS;
 }
 
@@ -102,9 +169,9 @@ _svg_image_deinit (svg_image_t *image)
 	image->url = NULL;
     }
 
-    if (image->data) {
-	free (image->data);
-	image->data = NULL;
+    if (image->buffer) {
+	_svg_image_buffer_destroy (image->buffer);
+	image->buffer = NULL;
     }
 
     return SVG_STATUS_SUCCESS;
@@ -148,12 +215,39 @@ _svg_image_apply_attributes (svg_image_t	*image,
     return SVG_STATUS_SUCCESS;
 }
 
+svg_status_t
+_svg_image_get_bbox (svg_image_t *image, svg_bbox_t *bbox)
+{
+    if (! _svg_length_is_user_unit (&image->x)
+	|| ! _svg_length_is_user_unit (&image->y)
+	|| ! _svg_length_is_user_unit (&image->width)
+	|| ! _svg_length_is_user_unit (&image->height)) {
+	_svg_bbox_init_unbounded (bbox);
+	return SVG_STATUS_SUCCESS;
+    }
+
+    if (image->width.value == 0 || image->height.value == 0)
+	return SVG_STATUS_SUCCESS;
+
+    _svg_bbox_add_point (bbox, image->x.value, image->y.value);
+    _svg_bbox_add_point (bbox,
+			 image->x.value + image->width.value,
+			 image->y.value + image->height.value);
+
+    return SVG_STATUS_SUCCESS;
+}
+
 svg_status_t
 _svg_image_render (svg_image_t		*image,
 		   svg_render_engine_t	*engine,
 		   void			*closure)
 {
     svg_status_t status;
+    svg_image_buffer_t *buffer;
+    svg_image_pixels_t *pixels = NULL;
+    double x_pixels = 0, y_pixels = 0;
+    unsigned int x_needed, y_needed;
+    int offered = 0, need_pixels = 1;
 
     if (image->width.value == 0 || image->height.value == 0)
 	return SVG_STATUS_SUCCESS;
@@ -161,15 +255,60 @@ _svg_image_render (svg_image_t		*image,
     status = _svg_image_read_image (image);
     if (status)
 	return status;
+    buffer = image->buffer;
+
+    if (engine->get_image_resolution) {
+	status = (engine->get_image_resolution) (closure,
+						 &image->width, &image->height,
+						 &x_pixels, &y_pixels);
+	if (status)
+	    return status;
+    }
+    x_needed = _svg_image_pixels_needed (x_pixels, buffer->width);
+    y_needed = _svg_image_pixels_needed (y_pixels, buffer->height);
+
+    /* An engine that can embed the JPEG itself may not need it
+       decoded at all, unless it is at least twice as detailed as
+       needed, when decoding it smaller saves more. */
+    if (buffer->format == SVG_IMAGE_FORMAT_JPEG && engine->set_image_source
+	&& ! (x_needed && y_needed
+	      && buffer->width >= 2 * x_needed && buffer->height >= 2 * y_needed)) {
+	status = (engine->set_image_source) (closure, "image/jpeg",
+					     buffer->file_data, buffer->file_size,
+					     &need_pixels);
+	if (status)
+	    return status;
+	offered = 1;
+    }
+
+    if (need_pixels) {
+	status = _svg_image_read_pixels (image, x_needed, y_needed, &pixels);
+	if (status) {
+	    if (offered)
+		(engine->set_image_source) (closure, NULL, NULL, 0, &need_pixels);
+	    return status;
+	}
+    }
+
+    if (engine->set_image_opaque) {
+	status = (engine->set_image_opaque) (closure, buffer->opaque);
+	if (status) {
+	    if (pixels)
+		_svg_image_pixels_destroy (pixels);
+	    return status;
+	}
+    }
 
     status = (engine->render_image) (closure,
-				     (unsigned char*) image->data,
-				     image->data_width,
-				     image->data_height,
+				     pixels ? (unsigned char*) pixels->data : NULL,
+				     pixels ? pixels->width : buffer->width,
+				     pixels ? pixels->height : buffer->height,
 				     &image->x,
 				     &image->y,
 				     &image->width,
 				     &image->height);
+    if (pixels)
+	_svg_image_pixels_destroy (pixels);
     if (status)
 	return status;
 
@@ -187,103 +326,210 @@ static const char reverse_table[128] = {
 	41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 64, 64, 64, 64, 64
 };
 
-static svg_status_t
+#ifdef SVG_IMAGE_SSSE3
+/* Decodes 16 base64 digits into 12 bytes, storing 16 at dst; returns
+   0, with nothing written, if the block has anything else (padding,
+   whitespace, garbage), which is left to the scalar loop. The table
+   lookups on nibbles are those of Wojciech Mula's decoder. */
+static int
+_svg_image_base64_decode_16 (const char *src, unsigned char *dst)
+{
+    const __m128i lut_lo = _mm_setr_epi8 (0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+					  0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8 (0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+					  0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8 (0, 16, 19, 4, -65, -65, -71, -71,
+					    0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8 (0x2f);
+    __m128i in, hi_nibbles, lo_nibbles, hi, lo, roll;
+
+    in = _mm_loadu_si128 ((const __m128i *) src);
+
+    hi_nibbles = _mm_and_si128 (_mm_srli_epi32 (in, 4), mask_2f);
+    lo_nibbles = _mm_and_si128 (in, mask_2f);
+    hi = _mm_shuffle_epi8 (lut_hi, hi_nibbles);
+    lo = _mm_shuffle_epi8 (lut_lo, lo_nibbles);
+    if (_mm_movemask_epi8 (_mm_cmpgt_epi8 (_mm_and_si128 (lo, hi), _mm_setzero_si128 ())))
+	return 0;
+
+    /* ASCII to 6-bit values */
+    roll = _mm_shuffle_epi8 (lut_roll,
+			     _mm_add_epi8 (_mm_cmpeq_epi8 (in, mask_2f), hi_nibbles));
+    in = _mm_add_epi8 (in, roll);
+
+    /* 4 x 6 bits to 3 bytes, big endian, in each 32-bit lane */
+    in = _mm_maddubs_epi16 (in, _mm_set1_epi32 (0x01400140));
+    in = _mm_madd_epi16 (in, _mm_set1_epi32 (0x00011000));
+    in = _mm_shuffle_epi8 (in, _mm_setr_epi8 (2, 1, 0, 6, 5, 4, 10, 9,
+					      8, 14, 13, 12, -1, -1, -1, -1));
+
+    _mm_storeu_si128 ((__m128i *) dst, in);
+
+    return 1;
+}
+#endif
+
+/* Decodes base64 from src into a buffer from malloc, sized up front.
+   Whitespace and padding are skipped wherever they are. Returns the
+   number of bytes, or 0 without memory or for anything that isn't
+   base64. */
+static size_t
+_svg_image_base64_decode (const char *src, size_t len, unsigned char **data)
+{
+    unsigned char *out;
+    unsigned int accumulator = 0;
+    int bits = 0, c;
+    size_t i = 0, n = 0;
+
+    /* room for the 4 bytes past the end that a 16 byte store writes */
+    out = (unsigned char *)malloc (len / 4 * 3 + 3 + 16);
+    if (out == NULL)
+	return 0;
+
+    while (i < len) {
+#ifdef SVG_IMAGE_SSSE3
+	/* between two groups of 4 digits */
+	if (bits == 0) {
+	    while (len - i >= 16 && _svg_image_base64_decode_16 (src + i, out + n)) {
+		i += 16;
+		n += 12;
+	    }
+	    if (i == len)
+		break;
+	}
+#endif
+	c = (unsigned char) src[i++];
+
+	/* be liberal in what you accept */
+	if (_svg_ascii_isspace (c) || c == '=')
+	    continue;
+
+	if (c > 127 || reverse_table[c] > 63) {
+	    free (out);
+	    return 0;
+	}
+
+	accumulator = (accumulator << 6) | reverse_table[c];
+	bits += 6;
+	if (bits >= 8) {
+	    bits -= 8;
+	    out[n++] = (accumulator >> bits) & 0xff;
+	}
+    }
+
+    if (n == 0) {
+	free (out);
+	return 0;
+    }
+
+    *data = out;
+
+    return n;
+}
+
+/* Reads the image file once, and its size; later calls return the
+   first outcome. */
+svg_status_t
 _svg_image_read_image (svg_image_t *image)
 {
-    svgint_status_t status;
+    if (! image->read) {
+	image->read_status = _svg_image_decode (image);
+	image->read = 1;
+    }
 
-    if (image->data)
-	return SVG_STATUS_SUCCESS;
-	
-	//check if url is data,{mime};base64,*
-	std::string href = image->url;
-	std::string dataScheme = "data:";
-	std::string mimeType = "image/png";//default
-	std::string mimeData;
-	
-	if(!href.substr(0, 5).compare(dataScheme)){
-		//begins with "data:"
-		size_t found = href.find(";");
-		if (found!=std::string::npos){
-			
-			if(found != 5)
-				mimeType = href.substr(5, found - 5);
-			
-			found = href.find("base64,");
-			if (found!=std::string::npos){
-				//has base64,
-				mimeData = href.substr(found + 7);
-				
-				const std::string::const_iterator last = mimeData.end();
-				std::vector<unsigned char> buf;
-				
-				int bits_collected = 0;
-				unsigned int accumulator = 0;
-				
-				for (std::string::const_iterator i = mimeData.begin(); i != last; ++i) {
-					const int c = *i;
-					if (isspace(c) || c == '=') {
-						// Skip whitespace and padding. Be liberal in what you accept.
-						continue;
-					}
-					if ((c > 127) || (c < 0) || (reverse_table[c] > 63)) {
-						// This contains characters not legal in a base64 encoded string.
-						buf.clear();
-						break;
-					}
-					accumulator = (accumulator << 6) | reverse_table[c];
-					bits_collected += 6;
-					if (bits_collected >= 8) {
-						bits_collected -= 8;
-						buf.push_back((uint8_t)((accumulator >> bits_collected) & 0xffu));
-					}
-					
-				}
-				
-				unsigned long size = buf.size();
-				
-				if(size){
-					
-					if(!mimeType.compare("image/png")){
-						
-						std::istringstream fileData(std::string((char *)&buf[0], buf.size()));
-						
-						status = (svgint_status_t)_svg_image_read_png_data (fileData,
-																			size,
-																			&image->data,
-																			&image->data_width,
-																			&image->data_height);
-						
-						if (status == 0)
-							return SVG_STATUS_SUCCESS;
-						
-						if (status == SVGINT_STATUS_IMAGE_NOT_PNG)
-							mimeType = "image/jpeg";
-					}
-					
-					if(!mimeType.compare("image/jpeg")){
-						
-						status = (svgint_status_t)_svg_image_read_jpeg_data (&buf[0],
-																			 size,
-																			 &image->data,
-																			 &image->data_width,
-																			 &image->data_height);
-						
-						if (status == 0)
-							return SVG_STATUS_SUCCESS;
-						
-						if (status != SVGINT_STATUS_IMAGE_NOT_JPEG)
-							return (svg_status_t)status;
-					}
-					
-				}
-				
-			}
-			
-		}
-		
+    return image->read_status;
+}
+
+/* Sets *pixels to a reference to pixels of the image at least
+   x_pixels by y_pixels, 0 by 0 for all of them, decoding them first
+   if need be. The reference is dropped with
+   _svg_image_pixels_destroy. */
+svg_status_t
+_svg_image_read_pixels (svg_image_t		*image,
+			unsigned int		x_pixels,
+			unsigned int		y_pixels,
+			svg_image_pixels_t	**pixels)
+{
+    svg_image_buffer_t *buffer;
+    svg_status_t status;
+    char *data;
+    unsigned int width, height;
+
+    status = _svg_image_read_image (image);
+    if (status)
+	return status;
+    buffer = image->buffer;
+
+    if (_svg_image_buffer_get_pixels (buffer, x_pixels, y_pixels, pixels, &status))
+	return status;
+
+    /* another image, or another thread, may decode the same buffer
+       meanwhile: the more detailed pixels are kept */
+    if (buffer->format == SVG_IMAGE_FORMAT_PNG)
+	status = _svg_image_read_png_data (buffer->file_data, buffer->file_size,
+					   x_pixels, y_pixels,
+					   &data, &width, &height);
+    else
+	status = _svg_image_read_jpeg_data (buffer->file_data, buffer->file_size,
+					    x_pixels, y_pixels,
+					    &data, &width, &height);
+    if (status == SVG_STATUS_SUCCESS) {
+	*pixels = _svg_image_pixels_create (data, width, height);
+	if (*pixels == NULL)
+	    status = SVG_STATUS_NO_MEMORY;
+    }
+
+    _svg_image_buffer_set_pixels (buffer, *pixels, status);
+
+    return status;
+}
+
+/* The pixels across size that pixels in device space need, 0 for
+   all of them */
+static unsigned int
+_svg_image_pixels_needed (double pixels, unsigned int size)
+{
+    if (pixels <= 0 || pixels >= size)
+	return 0;
+
+    return (unsigned int) ceil (pixels);
+}
+
+static svg_status_t
+_svg_image_decode (svg_image_t *image)
+{
+    svg_status_t status;
+    svg_image_buffer_t *buffer;
+    unsigned char *buf;
+    size_t size;
+
+    /* data:[<mime type>][;...];base64,<payload>, decoded straight
+       from the attribute. The format is told from the data, not the
+       mime type, which is often wrong. */
+    if (strncmp (image->url, "data:", 5) == 0) {
+	const char *mime = image->url + 5;
+	const char *semicolon = strchr (mime, ';');
+	const char *payload = strstr (mime, "base64,");
+
+	if (semicolon && payload) {
+	    if (_svg_image_use_cached (image, image->url, strlen (image->url)))
+		return SVG_STATUS_SUCCESS;
+
+	    payload += 7;
+	    size = _svg_image_base64_decode (payload, strlen (payload), &buf);
+	    if (size == 0)
+		return SVG_STATUS_PARSE_ERROR;
+
+	    status = _svg_image_decode_data (buf, size, &buffer);
+	    if (status)
+		return status;
+
+	    image->buffer = _svg_image_cache_insert (image->url, strlen (image->url), buffer);
+
+	    return SVG_STATUS_SUCCESS;
 	}
-	
+    }
+
 #ifndef _WIN32
 	char filePath[PATH_MAX] = {0};	
  	CFStringRef url = CFStringCreateWithCString(kCFAllocatorDefault, image->url, kCFStringEncodingUTF8);
@@ -313,184 +559,294 @@ _svg_image_read_image (svg_image_t *image)
 	}
 #endif	
 
+    /* a file is known by its url, and changes with its time and size */
 #ifndef _WIN32
-    /* XXX: _svg_image_read_png only deals with filenames, not URLs */
-    status = (svgint_status_t)_svg_image_read_png (filePath,
-				  &image->data,
-				  &image->data_width,
-				  &image->data_height);
+    struct stat st;
+    int has_key = stat (filePath, &st) == 0;
 #else
-    status = (svgint_status_t)_svg_image_read_png ((const char *)filePath,
-												   &image->data,
-												   &image->data_width,
-												   &image->data_height);
+    struct _stat st;
+    int has_key = _wstat (filePath, &st) == 0;
 #endif
+    std::ostringstream fileKey;
+    if (has_key) {
+	fileKey << image->url << '\n' << (long long) st.st_mtime << '\n' << (long long) st.st_size;
+	if (_svg_image_use_cached (image, fileKey.str ().data (), fileKey.str ().size ()))
+	    return SVG_STATUS_SUCCESS;
+    }
 
-    if (status == 0)
-	return SVG_STATUS_SUCCESS;
-
-    if (status != SVGINT_STATUS_IMAGE_NOT_PNG)
-	return (svg_status_t)status;
-
-#ifndef _WIN32	
-    /* XXX: _svg_image_read_jpeg only deals with filenames, not URLs */
-    status = (svgint_status_t)_svg_image_read_jpeg (filePath,
-				   &image->data,
-				   &image->data_width,
-				   &image->data_height);
-#else
-    status = (svgint_status_t)_svg_image_read_jpeg ((const char *)filePath,
-				   &image->data,
-				   &image->data_width,
-				   &image->data_height);	
-#endif	
-	
-    if (status == 0)
-	return SVG_STATUS_SUCCESS;
+    /* XXX: _svg_image_read_file only deals with filenames, not URLs */
+    status = _svg_image_read_file ((const char *)filePath, &buf, &size);
+    if (status)
+	return status;
 
     /* XXX: need to support SVG images as well */
+    status = _svg_image_decode_data (buf, size, &buffer);
+    if (status)
+	return status;
 
-    if (status != SVGINT_STATUS_IMAGE_NOT_JPEG)
-	return (svg_status_t)status;
+    if (has_key)
+	image->buffer = _svg_image_cache_insert (fileKey.str ().data (), fileKey.str ().size (), buffer);
+    else
+	image->buffer = buffer;
 
-    return SVG_STATUS_PARSE_ERROR;
+    return SVG_STATUS_SUCCESS;
 }
 
-static void
-premultiply_data (png_structp png, png_row_infop row_info, png_bytep data)
+/* Makes a buffer of the PNG or JPEG file in buf, which it takes.
+   The file is only checked and measured: its pixels wait for
+   _svg_image_read_pixels, which knows the resolution needed, and
+   which an engine that embeds a JPEG as is never calls. */
+static svg_status_t
+_svg_image_decode_data (unsigned char *buf, size_t size, svg_image_buffer_t **buffer)
 {
-    int i;
-  
-    for (i = 0; i < row_info->rowbytes; i += 4) {
-	unsigned char *b = &data[i];
-	unsigned char alpha = b[3];
-	unsigned long pixel = ((((b[0] * alpha) / 255) << 0) |
-			       (((b[1] * alpha) / 255) << 8) |
-			       (((b[2] * alpha) / 255) << 16) |
-			       (alpha << 24));
-	unsigned long *p = (unsigned long *) b;
-	*p = pixel;
+    svgint_status_t status;
+
+    *buffer = _svg_image_buffer_create ();
+    if (*buffer == NULL) {
+	free (buf);
+	return SVG_STATUS_NO_MEMORY;
+    }
+
+    (*buffer)->format = SVG_IMAGE_FORMAT_PNG;
+    status = (svgint_status_t)_svg_image_read_png_size (buf,
+							size,
+							&(*buffer)->width,
+							&(*buffer)->height,
+							&(*buffer)->opaque);
+
+    if (status == SVGINT_STATUS_IMAGE_NOT_PNG) {
+	(*buffer)->format = SVG_IMAGE_FORMAT_JPEG;
+	(*buffer)->opaque = 1;
+	status = (svgint_status_t)_svg_image_read_jpeg_size (buf,
+							     size,
+							     &(*buffer)->width,
+							     &(*buffer)->height);
+	if (status == SVGINT_STATUS_IMAGE_NOT_JPEG)
+	    status = (svgint_status_t)SVG_STATUS_PARSE_ERROR;
+    }
+
+    if (status == 0) {
+	(*buffer)->file_data = buf;
+	(*buffer)->file_size = size;
+	return SVG_STATUS_SUCCESS;
     }
+
+    free (buf);
+    _svg_image_buffer_destroy (*buffer);
+    *buffer = NULL;
+
+    return (svg_status_t)status;
+}
+
+static int
+_svg_image_use_cached (svg_image_t *image, const char *key, size_t key_len)
+{
+    image->buffer = _svg_image_cache_lookup (key, key_len);
+
+    return image->buffer != NULL;
 }
 
 static svg_status_t
-_svg_image_read_png (const char		*filename,
-		     char	 	**data,
-		     unsigned int	*width,
-		     unsigned int	*height)
+_svg_image_read_file (const char	*filename,
+		      unsigned char	**data,
+		      size_t		*size)
 {
-    int i;
     FILE *file;
-    static const int PNG_SIG_SIZE = 8;
-    unsigned char png_sig[PNG_SIG_SIZE];
-    int sig_bytes;
-    png_struct *png;
-    png_info *info;
-    png_uint_32 png_width, png_height;
-    int depth, color_type, interlace;
-    unsigned int pixel_size;
-    png_byte **row_pointers;
+    long length;
 
-#ifndef _WIN32	
+#ifndef _WIN32
     file = fopen (filename, "rb");
 #else
-    file = _wfopen ((const wchar_t *)filename, L"rb");	
+    file = _wfopen ((const wchar_t *)filename, L"rb");
 #endif
-	
+
     if (file == NULL)
 	return SVG_STATUS_FILE_NOT_FOUND;
 
-    sig_bytes = fread (png_sig, 1, PNG_SIG_SIZE, file);
-    if (png_check_sig (png_sig, sig_bytes) == 0) {
+    if (fseek (file, 0, SEEK_END) != 0 || (length = ftell (file)) <= 0) {
 	fclose (file);
-	return (svg_status_t)SVGINT_STATUS_IMAGE_NOT_PNG;
-    }
-
-    /* XXX: Perhaps we'll want some other error handlers? */
-    png = png_create_read_struct (PNG_LIBPNG_VER_STRING,
-				  NULL,
-				  NULL,
-				  NULL);
-    if (png == NULL) {
-	fclose (file);
-	return SVG_STATUS_NO_MEMORY;
+	return SVG_STATUS_PARSE_ERROR;
     }
+    rewind (file);
 
-    info = png_create_info_struct (png);
-    if (info == NULL) {
+    *data = (unsigned char *)malloc (length);
+    if (*data == NULL) {
 	fclose (file);
-	png_destroy_read_struct (&png, NULL, NULL);
 	return SVG_STATUS_NO_MEMORY;
     }
 
-    png_init_io (png, file);
-    png_set_sig_bytes (png, sig_bytes);
-
-    png_read_info (png, info);
-
-    png_get_IHDR (png, info,
-		  &png_width, &png_height, &depth,
-		  &color_type, &interlace, NULL, NULL);
-    *width = png_width;
-    *height = png_height;
-
-    /* XXX: I still don't know what formats will be exported in the
-       libsvg -> svg_render_engine interface. For now, I'm converting
-       everything to 32-bit RGBA. */
-
-    /* convert palette/gray image to rgb */
-    if (color_type == PNG_COLOR_TYPE_PALETTE)
-	png_set_palette_to_rgb (png);
-
-    /* expand gray bit depth if needed */
-    if (color_type == PNG_COLOR_TYPE_GRAY && depth < 8)
-	png_set_expand_gray_1_2_4_to_8 (png);
-
-    /* transform transparency to alpha */
-    if (png_get_valid(png, info, PNG_INFO_tRNS))
-	png_set_tRNS_to_alpha (png);
+    *size = fread (*data, 1, length, file);
+    fclose (file);
 
-    if (depth == 16)
-	png_set_strip_16 (png);
+    if (*size != (size_t) length) {
+	free (*data);
+	return SVG_STATUS_PARSE_ERROR;
+    }
 
-    if (depth < 8)
-	png_set_packing (png);
+    return SVG_STATUS_SUCCESS;
+}
 
-    /* convert grayscale to RGB */
-    if (color_type == PNG_COLOR_TYPE_GRAY
-	|| color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
-	png_set_gray_to_rgb (png);
+/* a * c / 255, rounded: exact for bytes, as cairo does it */
+#define SVG_IMAGE_MUL_UN8(c, a) \
+    ((((c) * (a) + 0x80) + ((((c) * (a) + 0x80)) >> 8)) >> 8)
 
-    if (interlace != PNG_INTERLACE_NONE)
-	png_set_interlace_handling (png);
+/* Premultiplies a row of width BGRA pixels by their alpha, in place.
+   Four pixels at a time are skipped when opaque, which the pixels of
+   most images with alpha are. */
+static void
+_svg_image_premultiply_row (unsigned char *row, unsigned int width)
+{
+    unsigned int x = 0;
+    unsigned int alpha;
+
+#ifdef SVG_IMAGE_SSE2
+    const __m128i zero = _mm_setzero_si128 ();
+    const __m128i round = _mm_set1_epi16 (0x80);
+    const __m128i alpha_mask = _mm_set1_epi32 ((int) 0xff000000);
+    __m128i p, lo, hi, a;
+
+    for (; x + 4 <= width; x += 4) {
+	p = _mm_loadu_si128 ((const __m128i *) (row + x * 4));
+	if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_or_si128 (p, _mm_set1_epi32 (0x00ffffff)),
+					       _mm_set1_epi32 (-1))) == 0xffff)
+	    continue;
+
+	lo = _mm_unpacklo_epi8 (p, zero);
+	a = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (lo, _MM_SHUFFLE (3, 3, 3, 3)),
+				 _MM_SHUFFLE (3, 3, 3, 3));
+	lo = _mm_add_epi16 (_mm_mullo_epi16 (lo, a), round);
+	lo = _mm_srli_epi16 (_mm_add_epi16 (lo, _mm_srli_epi16 (lo, 8)), 8);
+
+	hi = _mm_unpackhi_epi8 (p, zero);
+	a = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (hi, _MM_SHUFFLE (3, 3, 3, 3)),
+				 _MM_SHUFFLE (3, 3, 3, 3));
+	hi = _mm_add_epi16 (_mm_mullo_epi16 (hi, a), round);
+	hi = _mm_srli_epi16 (_mm_add_epi16 (hi, _mm_srli_epi16 (hi, 8)), 8);
+
+	/* the alpha itself is kept as it was */
+	p = _mm_or_si128 (_mm_andnot_si128 (alpha_mask, _mm_packus_epi16 (lo, hi)),
+			  _mm_and_si128 (alpha_mask, p));
+	_mm_storeu_si128 ((__m128i *) (row + x * 4), p);
+    }
+#endif
 
-    png_set_bgr (png);
-    png_set_filler (png, 0xff, PNG_FILLER_AFTER);
+    for (; x < width; x++) {
+	unsigned char *b = row + x * 4;
 
-    png_set_read_user_transform_fn (png, premultiply_data);
+	alpha = b[3];
+	if (alpha == 0xff)
+	    continue;
+	b[0] = SVG_IMAGE_MUL_UN8 (b[0], alpha);
+	b[1] = SVG_IMAGE_MUL_UN8 (b[1], alpha);
+	b[2] = SVG_IMAGE_MUL_UN8 (b[2], alpha);
+    }
+}
 
-    png_read_update_info (png, info);
+/* Spreads the width RGB pixels at the start of row to BGRA, opaque,
+   over the whole row. It goes from the end back, so that no pixel is
+   overwritten before it is read; the first overlaps itself. */
+static void
+_svg_image_expand_rgb_row (unsigned char *row, unsigned int width)
+{
+    unsigned int x = width;
+    unsigned char *in, *out, r, g, b;
+
+#ifdef SVG_IMAGE_SSSE3
+    const __m128i shuffle = _mm_setr_epi8 (2, 1, 0, -1, 5, 4, 3, -1,
+					   8, 7, 6, -1, 11, 10, 9, -1);
+    const __m128i alpha = _mm_set1_epi32 ((int) 0xff000000);
+
+    /* the pixels past the last four first; the 16 bytes read for 12
+       stay inside the row, 4 bytes a pixel */
+    for (; x % 4; x--) {
+	in = row + (x - 1) * 3;
+	out = row + (x - 1) * 4;
+	r = in[0];
+	g = in[1];
+	b = in[2];
+	out[0] = b;
+	out[1] = g;
+	out[2] = r;
+	out[3] = 0xff;
+    }
+    for (; x; x -= 4) {
+	__m128i p = _mm_loadu_si128 ((const __m128i *) (row + (x - 4) * 3));
+	p = _mm_or_si128 (_mm_shuffle_epi8 (p, shuffle), alpha);
+	_mm_storeu_si128 ((__m128i *) (row + (x - 4) * 4), p);
+    }
+#endif
 
-    pixel_size = 4;
-    *data = (char *)malloc (png_width * png_height * pixel_size);
-    if (*data == NULL) {
-	fclose (file);
-	return SVG_STATUS_NO_MEMORY;
+    for (; x; x--) {
+	in = row + (x - 1) * 3;
+	out = row + (x - 1) * 4;
+	r = in[0];
+	g = in[1];
+	b = in[2];
+	out[0] = b;
+	out[1] = g;
+	out[2] = r;
+	out[3] = 0xff;
     }
+}
 
-    row_pointers = (png_byte **)malloc (png_height * sizeof(char *));
-    for (i=0; i < png_height; i++)
-	row_pointers[i] = (png_byte *) (*data + i * png_width * pixel_size);
+/* The same for gray pixels */
+static void
+_svg_image_expand_gray_row (unsigned char *row, unsigned int width)
+{
+    unsigned int x = width;
+    unsigned char *out;
 
-    png_read_image (png, row_pointers);
-    png_read_end (png, info);
+#ifdef SVG_IMAGE_SSE2
+    const __m128i ones = _mm_set1_epi8 (-1);
+    __m128i g, gg, ga;
 
-    free (row_pointers);
-    fclose (file);
+    for (; x % 16; x--) {
+	out = row + (x - 1) * 4;
+	out[3] = 0xff;
+	out[2] = out[1] = out[0] = row[x - 1];
+    }
+    for (; x; x -= 16) {
+	out = row + (x - 16) * 4;
+	g = _mm_loadu_si128 ((const __m128i *) (row + x - 16));
+
+	gg = _mm_unpacklo_epi8 (g, g);
+	ga = _mm_unpacklo_epi8 (g, ones);
+	_mm_storeu_si128 ((__m128i *) (out + 16), _mm_unpackhi_epi16 (gg, ga));
+	_mm_storeu_si128 ((__m128i *) out, _mm_unpacklo_epi16 (gg, ga));
+
+	gg = _mm_unpackhi_epi8 (g, g);
+	ga = _mm_unpackhi_epi8 (g, ones);
+	_mm_storeu_si128 ((__m128i *) (out + 48), _mm_unpackhi_epi16 (gg, ga));
+	_mm_storeu_si128 ((__m128i *) (out + 32), _mm_unpacklo_epi16 (gg, ga));
+    }
+#endif
 
-    png_destroy_read_struct (&png, &info, NULL);
+    for (; x; x--) {
+	out = row + (x - 1) * 4;
+	out[3] = 0xff;
+	out[2] = out[1] = out[0] = row[x - 1];
+    }
+}
 
-    return SVG_STATUS_SUCCESS;
+/* Turns a row of CMYK pixels to BGRA in place, the way Adobe writes
+   them, inverted, which is how almost all of them are */
+static void
+_svg_image_convert_cmyk_row (unsigned char *row, unsigned int width)
+{
+    unsigned int x;
+    unsigned char *p, c, m, y, k;
+
+    for (x = 0; x < width; x++) {
+	p = row + x * 4;
+	c = p[0];
+	m = p[1];
+	y = p[2];
+	k = p[3];
+	p[0] = SVG_IMAGE_MUL_UN8 (y, k);
+	p[1] = SVG_IMAGE_MUL_UN8 (m, k);
+	p[2] = SVG_IMAGE_MUL_UN8 (c, k);
+	p[3] = 0xff;
+    }
 }
 
 typedef struct _svg_image_jpeg_err {
@@ -517,204 +873,320 @@ _svg_image_jpeg_error_exit (j_common_ptr cinfo)
     longjmp (err->setjmp_buf, status);
 }
 
-static svg_status_t
-_svg_image_read_jpeg (const char	*filename,
-		      char	 	**data,
-		      unsigned int	*width,
-		      unsigned int	*height)
+typedef struct svg_image_png_reader {
+    const unsigned char *data;
+    size_t size;
+    size_t offset;
+} svg_image_png_reader_t;
+
+static void
+_svg_image_png_read_memory (png_structp png, png_bytep data, png_size_t length)
 {
-    FILE *file;
-    svgint_status_t status;
-    struct jpeg_decompress_struct cinfo;
-    svg_image_jpeg_err_t jpeg_err;
-    JSAMPARRAY buf;
-    int i, row_stride;
-    unsigned char *out, *in;
-    
-#ifndef _WIN32	
-    file = fopen (filename, "rb");
-#else
-    file = _wfopen ((const wchar_t *)filename, L"rb");	
-#endif	
+    svg_image_png_reader_t *reader = (svg_image_png_reader_t *) png_get_io_ptr (png);
 
-    if (file == NULL)
-	return SVG_STATUS_FILE_NOT_FOUND;
-    
-    cinfo.err = jpeg_std_error (&jpeg_err.pub);
-    jpeg_err.pub.error_exit = _svg_image_jpeg_error_exit;
-    
-    status = (svgint_status_t)setjmp (jpeg_err.setjmp_buf);
-    if (status) {
-	jpeg_destroy_decompress(&cinfo);
-	fclose(file);
-	return (svg_status_t)status;
-    }
-    
-    jpeg_create_decompress (&cinfo);
-    jpeg_stdio_src (&cinfo, file);
-    jpeg_read_header (&cinfo, (boolean)TRUE);
-    jpeg_start_decompress (&cinfo);
-    
-    row_stride = cinfo.output_width * cinfo.output_components;
-    *width = cinfo.output_width;
-    *height= cinfo.output_height;
-    buf = (*cinfo.mem->alloc_sarray)
-	((j_common_ptr) &cinfo, JPOOL_IMAGE, row_stride, 1);
-    
-    *data = (char *)malloc (cinfo.output_width * cinfo.output_height * 4);
-    out = (unsigned char*) *data;
-    while (cinfo.output_scanline < cinfo.output_height) {
-	jpeg_read_scanlines (&cinfo, buf, 1);
-	in = buf[0];
-	for (i=0; i < cinfo.output_width; i++ ) {
-	    switch (cinfo.num_components) {
-	    case 1:
-		out[3] = 0xff;
-		out[2] = in[0];
-		out[1] = in[1];
-		out[0] = in[2];
-		in += 1;
-		out += 4;
-		break;
-	    default:
-	    case 4:
-		out[3] = 0xff;
-		out[2] = in[0];
-		out[1] = in[1];
-		out[0] = in[2];
-		in += 3;
-		out += 4;
-	    }
-	}
-    }
-    jpeg_finish_decompress (&cinfo);
-    jpeg_destroy_decompress (&cinfo);
-    fclose(file);
-    
-    return SVG_STATUS_SUCCESS;
-}
+    if (length > reader->size - reader->offset)
+	png_error (png, "truncated image data");
 
-void userReadData(png_structp pngPtr, png_bytep data, png_size_t length) {
-    //Here we get our IO pointer back from the read struct.
-    //This is the parameter we passed to the png_set_read_fn() function.
-    //Our std::istream pointer.
-    png_voidp a = png_get_io_ptr(pngPtr);
-    //Cast the pointer to std::istream* and read 'length' bytes into 'data'
-    ((std::istream*)a)->read((char*)data, length);
+    memcpy (data, reader->data + reader->offset, length);
+    reader->offset += length;
 }
 
+/* Reads PNG data from memory, through png_set_read_fn, without a
+   copy. Given x_pixels by y_pixels needed, 0 for all, the image is
+   shrunk by whole factors that keep at least as many, averaging the
+   pixels of each box; rows are added up as they come, so that but
+   for an interlaced image only one row of it is ever held. */
 static svg_status_t
-_svg_image_read_png_data (std::istringstream &fileData,
+_svg_image_read_png_data (const unsigned char *fileData,
 						  unsigned long size,
+						  unsigned int	x_pixels,
+						  unsigned int	y_pixels,
 						  char	 	**data,
 						  unsigned int	*width,
 						  unsigned int	*height)
 {
-	
     int i;
     static const int PNG_SIG_SIZE = 8;
-    unsigned char png_sig[PNG_SIG_SIZE];
+    svg_image_png_reader_t reader;
     png_struct *png;
     png_info *info;
     png_uint_32 png_width, png_height;
-    int depth, color_type, interlace;
-    unsigned int pixel_size;
-    png_byte **row_pointers;
-	
-	if(size > PNG_SIG_SIZE){
-		fileData.read ((char *)png_sig, PNG_SIG_SIZE);
-		if (png_check_sig (png_sig, PNG_SIG_SIZE) == 0) {
-			return (svg_status_t)SVGINT_STATUS_IMAGE_NOT_PNG;	
-		}
-	}
-	
+    int depth, color_type, interlace, passes, pass, has_alpha;
+    unsigned int pixel_size, x_factor, y_factor, out_width, out_height, rows;
+    png_byte *row;
+    /* live across png_error's longjmp */
+    png_byte * volatile image = NULL;
+    unsigned long long * volatile sums = NULL;
+
+    if (size < PNG_SIG_SIZE || png_check_sig ((png_bytep) fileData, PNG_SIG_SIZE) == 0)
+	return (svg_status_t)SVGINT_STATUS_IMAGE_NOT_PNG;
+
     /* XXX: Perhaps we'll want some other error handlers? */
     png = png_create_read_struct (PNG_LIBPNG_VER_STRING,
-								  NULL,
-								  NULL,
-								  NULL);
-    if (png == NULL) {
-		return SVG_STATUS_NO_MEMORY;
-    }
-	
+				  NULL,
+				  NULL,
+				  NULL);
+    if (png == NULL)
+	return SVG_STATUS_NO_MEMORY;
+
     info = png_create_info_struct (png);
     if (info == NULL) {
-		png_destroy_read_struct (&png, NULL, NULL);
-		return SVG_STATUS_NO_MEMORY;
+	png_destroy_read_struct (&png, NULL, NULL);
+	return SVG_STATUS_NO_MEMORY;
     }
-	
-	png_set_read_fn(png, (png_voidp)&fileData, userReadData);
-	
+
+    *data = NULL;
+
+    /* corrupt or truncated data */
+    if (setjmp (png_jmpbuf (png))) {
+	free ((void *) image);
+	free ((void *) sums);
+	free (*data);
+	*data = NULL;
+	png_destroy_read_struct (&png, &info, NULL);
+	return SVG_STATUS_PARSE_ERROR;
+    }
+
+    reader.data = fileData;
+    reader.size = size;
+    reader.offset = PNG_SIG_SIZE;
+    png_set_read_fn (png, &reader, _svg_image_png_read_memory);
+
     png_set_sig_bytes (png, PNG_SIG_SIZE);
-	
+
     png_read_info (png, info);
-	
+
     png_get_IHDR (png, info,
-				  &png_width, &png_height, &depth,
-				  &color_type, &interlace, NULL, NULL);
-    *width = png_width;
-    *height = png_height;
-	
+		  &png_width, &png_height, &depth,
+		  &color_type, &interlace, NULL, NULL);
+
     /* XXX: I still don't know what formats will be exported in the
-	 libsvg -> svg_render_engine interface. For now, I'm converting
-	 everything to 32-bit RGBA. */
-	
+       libsvg -> svg_render_engine interface. For now, I'm converting
+       everything to 32-bit RGBA. */
+
     /* convert palette/gray image to rgb */
     if (color_type == PNG_COLOR_TYPE_PALETTE)
-		png_set_palette_to_rgb (png);
-	
+	png_set_palette_to_rgb (png);
+
     /* expand gray bit depth if needed */
     if (color_type == PNG_COLOR_TYPE_GRAY && depth < 8)
-		png_set_expand_gray_1_2_4_to_8 (png);
-	
+	png_set_expand_gray_1_2_4_to_8 (png);
+
     /* transform transparency to alpha */
-    if (png_get_valid(png, info, PNG_INFO_tRNS))
-		png_set_tRNS_to_alpha (png);
-	
+    has_alpha = (color_type & PNG_COLOR_MASK_ALPHA) != 0;
+    if (png_get_valid(png, info, PNG_INFO_tRNS)) {
+	png_set_tRNS_to_alpha (png);
+	has_alpha = 1;
+    }
+
     if (depth == 16)
-		png_set_strip_16 (png);
-	
+	png_set_strip_16 (png);
+
     if (depth < 8)
-		png_set_packing (png);
-	
+	png_set_packing (png);
+
     /* convert grayscale to RGB */
     if (color_type == PNG_COLOR_TYPE_GRAY
-		|| color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
-		png_set_gray_to_rgb (png);
-	
-    if (interlace != PNG_INTERLACE_NONE)
-		png_set_interlace_handling (png);
-	
+	|| color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+	png_set_gray_to_rgb (png);
+
+    passes = png_set_interlace_handling (png);
+
     png_set_bgr (png);
     png_set_filler (png, 0xff, PNG_FILLER_AFTER);
-	
-    png_set_read_user_transform_fn (png, premultiply_data);
-	
+
     png_read_update_info (png, info);
-	
+
     pixel_size = 4;
-    *data = (char *)malloc (png_width * png_height * pixel_size);
-    if (*data == NULL) {
-		return SVG_STATUS_NO_MEMORY;
+    x_factor = _svg_image_box_factor (png_width, x_pixels);
+    y_factor = _svg_image_box_factor (png_height, y_pixels);
+    out_width = (png_width + x_factor - 1) / x_factor;
+    out_height = (png_height + y_factor - 1) / y_factor;
+
+    /* Rows are read straight into the pixels, which are laid out as
+       cairo's ARGB32, premultiplied after the last pass over them.
+       Shrinking goes through one row, or all of them when interlaced,
+       as the passes fill every row a bit at a time. */
+    *data = (char *)malloc ((size_t) out_width * out_height * pixel_size);
+    if (*data && (x_factor > 1 || y_factor > 1)) {
+	sums = (unsigned long long *)calloc (out_width * 4, sizeof (unsigned long long));
+	if (passes > 1)
+	    image = (png_byte *)malloc ((size_t) png_width * png_height * pixel_size);
+	else
+	    image = (png_byte *)malloc (png_width * pixel_size);
     }
-	
-    row_pointers = (png_byte **)malloc (png_height * sizeof(char *));
-    for (i=0; i < png_height; i++)
-		row_pointers[i] = (png_byte *) (*data + i * png_width * pixel_size);
-	
-    png_read_image (png, row_pointers);
+    if (*data == NULL
+	|| ((x_factor > 1 || y_factor > 1) && (sums == NULL || image == NULL))) {
+	free ((void *) image);
+	free ((void *) sums);
+	free (*data);
+	*data = NULL;
+	png_destroy_read_struct (&png, &info, NULL);
+	return SVG_STATUS_NO_MEMORY;
+    }
+
+    if (x_factor == 1 && y_factor == 1) {
+	for (pass = 0; pass < passes; pass++)
+	    for (i=0; i < png_height; i++)
+		png_read_row (png, (png_byte *) (*data + (size_t) i * png_width * pixel_size), NULL);
+
+	if (has_alpha)
+	    for (i=0; i < png_height; i++)
+		_svg_image_premultiply_row ((unsigned char *) *data + (size_t) i * png_width * pixel_size,
+					    png_width);
+    } else {
+	if (passes > 1)
+	    for (pass = 0; pass < passes; pass++)
+		for (i=0; i < png_height; i++)
+		    png_read_row (png, image + (size_t) i * png_width * pixel_size, NULL);
+
+	rows = 0;
+	for (i=0; i < png_height; i++) {
+	    if (passes > 1) {
+		row = image + (size_t) i * png_width * pixel_size;
+	    } else {
+		row = image;
+		png_read_row (png, row, NULL);
+	    }
+	    if (has_alpha)
+		_svg_image_premultiply_row (row, png_width);
+
+	    _svg_image_box_add_row (row, png_width, x_factor, sums);
+	    if (++rows == y_factor || i == png_height - 1) {
+		_svg_image_box_emit_row (sums, png_width, x_factor, rows,
+					 (unsigned char *) *data
+					 + (size_t) (i / y_factor) * out_width * pixel_size);
+		rows = 0;
+	    }
+	}
+    }
+
     png_read_end (png, info);
-	
-    free (row_pointers);
-	
+
+    free ((void *) image);
+    free ((void *) sums);
+
     png_destroy_read_struct (&png, &info, NULL);
-	
+
+    *width = out_width;
+    *height = out_height;
+
     return SVG_STATUS_SUCCESS;
 }
 
+/* Reads no further than the header, for the size of the image and
+   whether it has any transparency: an alpha channel or a tRNS chunk,
+   which comes before the image data. */
+static svg_status_t
+_svg_image_read_png_size (const unsigned char *fileData,
+			  unsigned long size,
+			  unsigned int	*width,
+			  unsigned int	*height,
+			  int		*opaque)
+{
+    static const int PNG_SIG_SIZE = 8;
+    svg_image_png_reader_t reader;
+    png_struct *png;
+    png_info *info;
+
+    if (size < PNG_SIG_SIZE || png_check_sig ((png_bytep) fileData, PNG_SIG_SIZE) == 0)
+	return (svg_status_t)SVGINT_STATUS_IMAGE_NOT_PNG;
+
+    png = png_create_read_struct (PNG_LIBPNG_VER_STRING,
+				  NULL,
+				  NULL,
+				  NULL);
+    if (png == NULL)
+	return SVG_STATUS_NO_MEMORY;
+
+    info = png_create_info_struct (png);
+    if (info == NULL) {
+	png_destroy_read_struct (&png, NULL, NULL);
+	return SVG_STATUS_NO_MEMORY;
+    }
+
+    if (setjmp (png_jmpbuf (png))) {
+	png_destroy_read_struct (&png, &info, NULL);
+	return SVG_STATUS_PARSE_ERROR;
+    }
+
+    reader.data = fileData;
+    reader.size = size;
+    reader.offset = PNG_SIG_SIZE;
+    png_set_read_fn (png, &reader, _svg_image_png_read_memory);
+
+    png_set_sig_bytes (png, PNG_SIG_SIZE);
+
+    png_read_info (png, info);
+
+    *width = png_get_image_width (png, info);
+    *height = png_get_image_height (png, info);
+    *opaque = (png_get_color_type (png, info) & PNG_COLOR_MASK_ALPHA) == 0
+	      && ! png_get_valid (png, info, PNG_INFO_tRNS);
+
+    png_destroy_read_struct (&png, &info, NULL);
+
+    if (*width == 0 || *height == 0)
+	return SVG_STATUS_PARSE_ERROR;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+/* The whole factor by which size shrinks keeping at least needed
+   pixels, 1 for all of them */
+static unsigned int
+_svg_image_box_factor (unsigned int size, unsigned int needed)
+{
+    if (needed == 0 || needed >= size)
+	return 1;
+
+    return size / needed;
+}
+
+/* Adds a row of width pixels to sums, four channels for each box
+   x_factor pixels wide */
+static void
+_svg_image_box_add_row (const unsigned char	*row,
+			unsigned int		width,
+			unsigned int		x_factor,
+			unsigned long long	*sums)
+{
+    unsigned int x, c;
+
+    for (x = 0; x < width; x++) {
+	unsigned long long *sum = sums + (x / x_factor) * 4;
+	for (c = 0; c < 4; c++)
+	    sum[c] += row[x * 4 + c];
+    }
+}
+
+/* Writes a row of the averages of sums, over rows rows, to out, and
+   clears them for the next */
+static void
+_svg_image_box_emit_row (unsigned long long	*sums,
+			 unsigned int		width,
+			 unsigned int		x_factor,
+			 unsigned int		rows,
+			 unsigned char		*out)
+{
+    unsigned int out_width = (width + x_factor - 1) / x_factor;
+    unsigned int x, c;
+    unsigned long long n;
+
+    for (x = 0; x < out_width; x++) {
+	n = (unsigned long long) (x == out_width - 1 ? width - x * x_factor : x_factor) * rows;
+	for (c = 0; c < 4; c++) {
+	    out[x * 4 + c] = (unsigned char) ((sums[x * 4 + c] + n / 2) / n);
+	    sums[x * 4 + c] = 0;
+	}
+    }
+}
+
 static svg_status_t
 _svg_image_read_jpeg_data (unsigned char *fileData,
 						   unsigned long size,
+						   unsigned int	x_pixels,
+						   unsigned int	y_pixels,
 						   char	 	**data,
 						   unsigned int	*width,
 						   unsigned int	*height)
@@ -723,54 +1195,60 @@ _svg_image_read_jpeg_data (unsigned char *fileData,
     svgint_status_t status;
     struct jpeg_decompress_struct cinfo;
     svg_image_jpeg_err_t jpeg_err;
-    JSAMPARRAY buf;
-    int i, row_stride;
-    unsigned char *out, *in;
+    JSAMPROW row;
     
+    *data = NULL;
+
     cinfo.err = jpeg_std_error (&jpeg_err.pub);
     jpeg_err.pub.error_exit = _svg_image_jpeg_error_exit;
     
     status = (svgint_status_t)setjmp (jpeg_err.setjmp_buf);
     if (status) {
 		jpeg_destroy_decompress(&cinfo);
+		free (*data);
+		*data = NULL;
 		return (svg_status_t)status;
     }
     
     jpeg_create_decompress (&cinfo);
     jpeg_mem_src (&cinfo, fileData, size);
     jpeg_read_header (&cinfo, (boolean)TRUE);
+
+    /* libjpeg skips most of the work for a half, a quarter or an
+       eighth of the size, which is as far as x_pixels by y_pixels
+       needed, 0 for all, allow */
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = 1;
+    while (x_pixels && y_pixels && cinfo.scale_denom < 8
+	   && (cinfo.image_width + cinfo.scale_denom * 2 - 1) / (cinfo.scale_denom * 2) >= x_pixels
+	   && (cinfo.image_height + cinfo.scale_denom * 2 - 1) / (cinfo.scale_denom * 2) >= y_pixels)
+	cinfo.scale_denom *= 2;
+
     jpeg_start_decompress (&cinfo);
     
-    row_stride = cinfo.output_width * cinfo.output_components;
     *width = cinfo.output_width;
     *height= cinfo.output_height;
-    buf = (*cinfo.mem->alloc_sarray)
-	((j_common_ptr) &cinfo, JPOOL_IMAGE, row_stride, 1);
     
-    *data = (char *)malloc (cinfo.output_width * cinfo.output_height * 4);
-    out = (unsigned char*) *data;
+    *data = (char *)malloc ((size_t) cinfo.output_width * cinfo.output_height * 4);
+    if (*data == NULL) {
+		jpeg_destroy_decompress (&cinfo);
+		return SVG_STATUS_NO_MEMORY;
+    }
     while (cinfo.output_scanline < cinfo.output_height) {
-		jpeg_read_scanlines (&cinfo, buf, 1);
-		in = buf[0];
-		for (i=0; i < cinfo.output_width; i++ ) {
-			switch (cinfo.num_components) {
-				case 1:
-					out[3] = 0xff;
-					out[2] = in[0];
-					out[1] = in[1];
-					out[0] = in[2];
-					in += 1;
-					out += 4;
-					break;
-				default:
-				case 4:
-					out[3] = 0xff;
-					out[2] = in[0];
-					out[1] = in[1];
-					out[0] = in[2];
-					in += 3;
-					out += 4;
-			}
+		row = (JSAMPROW) (*data + (size_t) cinfo.output_scanline * cinfo.output_width * 4);
+		/* gray, RGB or CMYK, spread to BGRA within the row it is
+		   read into */
+		jpeg_read_scanlines (&cinfo, &row, 1);
+		switch (cinfo.output_components) {
+			case 1:
+				_svg_image_expand_gray_row (row, cinfo.output_width);
+				break;
+			case 3:
+				_svg_image_expand_rgb_row (row, cinfo.output_width);
+				break;
+			default:
+				_svg_image_convert_cmyk_row (row, cinfo.output_width);
+				break;
 		}
     }
     jpeg_finish_decompress (&cinfo);
@@ -779,3 +1257,38 @@ _svg_image_read_jpeg_data (unsigned char *fileData,
     return SVG_STATUS_SUCCESS;
 }
 
+/* Reads no further than the header, for the size of the image */
+static svg_status_t
+_svg_image_read_jpeg_size (const unsigned char *fileData,
+			   unsigned long size,
+			   unsigned int	*width,
+			   unsigned int	*height)
+{
+    svgint_status_t status;
+    struct jpeg_decompress_struct cinfo;
+    svg_image_jpeg_err_t jpeg_err;
+
+    cinfo.err = jpeg_std_error (&jpeg_err.pub);
+    jpeg_err.pub.error_exit = _svg_image_jpeg_error_exit;
+
+    status = (svgint_status_t)setjmp (jpeg_err.setjmp_buf);
+    if (status) {
+	jpeg_destroy_decompress (&cinfo);
+	return (svg_status_t)status;
+    }
+
+    jpeg_create_decompress (&cinfo);
+    jpeg_mem_src (&cinfo, (unsigned char *) fileData, size);
+    jpeg_read_header (&cinfo, (boolean)TRUE);
+    jpeg_calc_output_dimensions (&cinfo);
+
+    *width = cinfo.output_width;
+    *height = cinfo.output_height;
+
+    jpeg_destroy_decompress (&cinfo);
+
+    if (*width == 0 || *height == 0)
+	return SVG_STATUS_PARSE_ERROR;
+
+    return SVG_STATUS_SUCCESS;
+}
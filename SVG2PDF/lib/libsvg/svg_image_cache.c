@@ -0,0 +1,428 @@
+/* svg_image_cache.c: Images shared between documents
+
+   Copyright � 2002 USC/Information Sciences Institute
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public
+   License along with this program; if not, write to the
+   Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+   Boston, MA 02111-1307, USA.
+
+   Author: Carl Worth <cworth@isi.edu>
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "svgint.h"
+
+#include <mutex>
+#include <condition_variable>
+
+/* Every document of the process that embeds the same image (a logo
+   in base64, or the same file unchanged on disk) gets the same
+   file and pixels. Buffers are reference counted: the cache holds
+   one reference, each image using a buffer another, so a buffer
+   evicted while in use lives on until its last image is destroyed.
+   Entries are found by a hash of their key, compared in full to rule
+   out collisions, and evicted least recently used first once the
+   files, pixels and keys held exceed the size limit. Pixels are
+   decoded on first use, at the resolution needed then, and replaced
+   by more detailed ones should a later render need them; they count
+   from then on. Renders on other threads that want pixels being
+   decoded wait for them instead of decoding them too. One mutex
+   covers the cache, the reference counts and the pixels: lookups are
+   rare next to the decoding they save. */
+
+#define SVG_IMAGE_CACHE_BUCKETS 256
+#define SVG_IMAGE_CACHE_DEFAULT_SIZE (64 * 1024 * 1024)
+
+typedef struct svg_image_cache {
+    std::mutex mutex;
+    /* signalled when a decoding ends */
+    std::condition_variable decoded;
+
+    svg_image_buffer_t *bucket[SVG_IMAGE_CACHE_BUCKETS];
+
+    /* most recently used first */
+    svg_image_buffer_t *head;
+    svg_image_buffer_t *tail;
+
+    size_t size;
+    size_t max_size;
+} svg_image_cache_t;
+
+static svg_image_cache_t svg_image_cache = {
+    {}, {}, {NULL}, NULL, NULL, 0, SVG_IMAGE_CACHE_DEFAULT_SIZE
+};
+
+static unsigned long long
+_svg_image_cache_hash (const char *key, size_t key_len);
+
+static void
+_svg_image_cache_unlink (svg_image_buffer_t *buffer);
+
+static void
+_svg_image_cache_trim (size_t max_size);
+
+static void
+_svg_image_buffer_release (svg_image_buffer_t *buffer);
+
+static size_t
+_svg_image_buffer_size (svg_image_buffer_t *buffer);
+
+static void
+_svg_image_pixels_release (svg_image_pixels_t *pixels);
+
+/* FNV-1a */
+static unsigned long long
+_svg_image_cache_hash (const char *key, size_t key_len)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    size_t i;
+
+    for (i = 0; i < key_len; i++) {
+	hash ^= (unsigned char) key[i];
+	hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/* Takes buffer out of the cache, which drops its reference; the
+   caller holds the mutex. */
+static void
+_svg_image_cache_unlink (svg_image_buffer_t *buffer)
+{
+    svg_image_buffer_t **p;
+
+    p = &svg_image_cache.bucket[buffer->hash % SVG_IMAGE_CACHE_BUCKETS];
+    while (*p != buffer)
+	p = &(*p)->hash_next;
+    *p = buffer->hash_next;
+
+    if (buffer->prev)
+	buffer->prev->next = buffer->next;
+    else
+	svg_image_cache.head = buffer->next;
+    if (buffer->next)
+	buffer->next->prev = buffer->prev;
+    else
+	svg_image_cache.tail = buffer->prev;
+
+    svg_image_cache.size -= buffer->size;
+    buffer->cached = 0;
+
+    _svg_image_buffer_release (buffer);
+}
+
+static void
+_svg_image_cache_trim (size_t max_size)
+{
+    while (svg_image_cache.tail && svg_image_cache.size > max_size)
+	_svg_image_cache_unlink (svg_image_cache.tail);
+}
+
+/* The caller holds the mutex */
+static void
+_svg_image_buffer_release (svg_image_buffer_t *buffer)
+{
+    if (--buffer->ref_count)
+	return;
+
+    if (buffer->pixels)
+	_svg_image_pixels_release (buffer->pixels);
+    free (buffer->file_data);
+    free (buffer->key);
+    free (buffer);
+}
+
+static size_t
+_svg_image_buffer_size (svg_image_buffer_t *buffer)
+{
+    size_t size = buffer->file_size + buffer->key_len;
+
+    if (buffer->pixels)
+	size += (size_t) buffer->pixels->width * buffer->pixels->height * 4;
+
+    return size;
+}
+
+/* The caller holds the mutex */
+static void
+_svg_image_pixels_release (svg_image_pixels_t *pixels)
+{
+    if (--pixels->ref_count)
+	return;
+
+    free (pixels->data);
+    free (pixels);
+}
+
+/* Returns a new reference to the pixels cached under key, or NULL */
+svg_image_buffer_t *
+_svg_image_cache_lookup (const char *key, size_t key_len)
+{
+    unsigned long long hash = _svg_image_cache_hash (key, key_len);
+    svg_image_buffer_t *buffer;
+    std::lock_guard<std::mutex> lock (svg_image_cache.mutex);
+
+    for (buffer = svg_image_cache.bucket[hash % SVG_IMAGE_CACHE_BUCKETS];
+	 buffer;
+	 buffer = buffer->hash_next) {
+	if (buffer->hash == hash && buffer->key_len == key_len
+	    && memcmp (buffer->key, key, key_len) == 0)
+	    break;
+    }
+    if (buffer == NULL)
+	return NULL;
+
+    /* to the front */
+    if (buffer->prev) {
+	buffer->prev->next = buffer->next;
+	if (buffer->next)
+	    buffer->next->prev = buffer->prev;
+	else
+	    svg_image_cache.tail = buffer->prev;
+	buffer->prev = NULL;
+	buffer->next = svg_image_cache.head;
+	svg_image_cache.head->prev = buffer;
+	svg_image_cache.head = buffer;
+    }
+
+    buffer->ref_count++;
+
+    return buffer;
+}
+
+/* Caches buffer, as returned by _svg_image_buffer_create and filled
+   in, under key when it fits. Takes the caller's reference and
+   returns the one to use: buffer, or, should another thread have
+   cached the same key meanwhile, that buffer, buffer then being
+   destroyed. Without memory for the key buffer stays uncached. */
+svg_image_buffer_t *
+_svg_image_cache_insert (const char		*key,
+			 size_t			key_len,
+			 svg_image_buffer_t	*buffer)
+{
+    svg_image_buffer_t *other;
+    unsigned long long hash;
+    int index;
+
+    buffer->key = (char *)malloc (key_len);
+    if (buffer->key == NULL)
+	return buffer;
+    memcpy (buffer->key, key, key_len);
+    buffer->key_len = key_len;
+
+    hash = _svg_image_cache_hash (key, key_len);
+    buffer->hash = hash;
+    buffer->size = _svg_image_buffer_size (buffer);
+
+    std::lock_guard<std::mutex> lock (svg_image_cache.mutex);
+
+    if (buffer->size > svg_image_cache.max_size)
+	return buffer;
+
+    index = hash % SVG_IMAGE_CACHE_BUCKETS;
+    for (other = svg_image_cache.bucket[index]; other; other = other->hash_next) {
+	if (other->hash == hash && other->key_len == key_len
+	    && memcmp (other->key, key, key_len) == 0) {
+	    other->ref_count++;
+	    _svg_image_buffer_release (buffer);
+	    return other;
+	}
+    }
+
+    _svg_image_cache_trim (svg_image_cache.max_size - buffer->size);
+
+    buffer->hash_next = svg_image_cache.bucket[index];
+    svg_image_cache.bucket[index] = buffer;
+
+    buffer->next = svg_image_cache.head;
+    if (svg_image_cache.head)
+	svg_image_cache.head->prev = buffer;
+    else
+	svg_image_cache.tail = buffer;
+    svg_image_cache.head = buffer;
+
+    svg_image_cache.size += buffer->size;
+    buffer->cached = 1;
+    buffer->ref_count++;
+
+    return buffer;
+}
+
+/* An empty buffer holding one reference, or NULL without memory */
+svg_image_buffer_t *
+_svg_image_buffer_create (void)
+{
+    svg_image_buffer_t *buffer;
+
+    buffer = (svg_image_buffer_t *)calloc (1, sizeof (svg_image_buffer_t));
+    if (buffer == NULL)
+	return NULL;
+
+    buffer->pixels_status = SVG_STATUS_SUCCESS;
+    buffer->ref_count = 1;
+
+    return buffer;
+}
+
+/* Finds pixels with at least x_pixels by y_pixels of the image, 0
+   by 0 for all of it, first waiting for any decoding in progress.
+   Returns whether it settled the matter: with a new reference to
+   them in *pixels, or the status of a decoding that failed;
+   otherwise the caller decodes them, and must hand the outcome to
+   _svg_image_buffer_set_pixels, which the others wait for. */
+int
+_svg_image_buffer_get_pixels (svg_image_buffer_t	*buffer,
+			      unsigned int		x_pixels,
+			      unsigned int		y_pixels,
+			      svg_image_pixels_t	**pixels,
+			      svg_status_t		*status)
+{
+    std::unique_lock<std::mutex> lock (svg_image_cache.mutex);
+
+    *pixels = NULL;
+    *status = SVG_STATUS_SUCCESS;
+
+    while (buffer->decoding)
+	svg_image_cache.decoded.wait (lock);
+
+    if (x_pixels == 0 || x_pixels > buffer->width)
+	x_pixels = buffer->width;
+    if (y_pixels == 0 || y_pixels > buffer->height)
+	y_pixels = buffer->height;
+
+    if (buffer->pixels
+	&& buffer->pixels->width >= x_pixels
+	&& buffer->pixels->height >= y_pixels) {
+	buffer->pixels->ref_count++;
+	*pixels = buffer->pixels;
+	return 1;
+    }
+
+    if (buffer->pixels == NULL && buffer->pixels_status) {
+	*status = buffer->pixels_status;
+	return 1;
+    }
+
+    buffer->decoding = 1;
+
+    return 0;
+}
+
+/* Offers the outcome of a decoding, pixels staying the caller's. They
+   replace those of buffer when more detailed; a failure is kept when
+   nothing was decoded yet, so that it isn't tried again. Either way
+   the renders waiting for the decoding go on. */
+void
+_svg_image_buffer_set_pixels (svg_image_buffer_t	*buffer,
+			      svg_image_pixels_t	*pixels,
+			      svg_status_t		status)
+{
+    std::lock_guard<std::mutex> lock (svg_image_cache.mutex);
+
+    buffer->decoding = 0;
+    svg_image_cache.decoded.notify_all ();
+
+    if (pixels == NULL) {
+	if (buffer->pixels == NULL && buffer->pixels_status == SVG_STATUS_SUCCESS)
+	    buffer->pixels_status = status;
+	return;
+    }
+
+    if (buffer->pixels) {
+	if (pixels->width < buffer->pixels->width
+	    || pixels->height < buffer->pixels->height
+	    || (pixels->width == buffer->pixels->width
+		&& pixels->height == buffer->pixels->height))
+	    return;
+	_svg_image_pixels_release (buffer->pixels);
+    }
+
+    pixels->ref_count++;
+    buffer->pixels = pixels;
+    buffer->pixels_status = SVG_STATUS_SUCCESS;
+
+    if (buffer->cached) {
+	svg_image_cache.size -= buffer->size;
+	buffer->size = _svg_image_buffer_size (buffer);
+	svg_image_cache.size += buffer->size;
+	_svg_image_cache_trim (svg_image_cache.max_size);
+    }
+}
+
+/* Wraps data, width x height premultiplied ARGB from malloc, which it
+   takes; NULL without memory, data then being freed. */
+svg_image_pixels_t *
+_svg_image_pixels_create (char *data, unsigned int width, unsigned int height)
+{
+    svg_image_pixels_t *pixels;
+
+    pixels = (svg_image_pixels_t *)malloc (sizeof (svg_image_pixels_t));
+    if (pixels == NULL) {
+	free (data);
+	return NULL;
+    }
+
+    pixels->data = data;
+    pixels->width = width;
+    pixels->height = height;
+    pixels->ref_count = 1;
+
+    return pixels;
+}
+
+void
+_svg_image_pixels_destroy (svg_image_pixels_t *pixels)
+{
+    std::lock_guard<std::mutex> lock (svg_image_cache.mutex);
+
+    _svg_image_pixels_release (pixels);
+}
+
+svg_image_buffer_t *
+_svg_image_buffer_reference (svg_image_buffer_t *buffer)
+{
+    std::lock_guard<std::mutex> lock (svg_image_cache.mutex);
+
+    buffer->ref_count++;
+
+    return buffer;
+}
+
+void
+_svg_image_buffer_destroy (svg_image_buffer_t *buffer)
+{
+    std::lock_guard<std::mutex> lock (svg_image_cache.mutex);
+
+    _svg_image_buffer_release (buffer);
+}
+
+void
+svg_set_image_cache_size (size_t bytes)
+{
+    std::lock_guard<std::mutex> lock (svg_image_cache.mutex);
+
+    svg_image_cache.max_size = bytes;
+    _svg_image_cache_trim (bytes);
+}
+
+size_t
+svg_get_image_cache_size (void)
+{
+    std::lock_guard<std::mutex> lock (svg_image_cache.mutex);
+
+    return svg_image_cache.max_size;
+}
@@ -84,6 +84,14 @@ _svg_length_init_from_str (svg_length_t *length, const char *str)
     return _svg_length_init_unit (length, value, unit, length->orientation);
 }
 
+/* Whether length is in plain user units, which can be used without
+   knowing the viewport, font or resolution the engine renders with. */
+int
+_svg_length_is_user_unit (const svg_length_t *length)
+{
+    return length->unit == SVG_LENGTH_UNIT_PX;
+}
+
 svg_status_t
 _svg_length_deinit (svg_length_t *length)
 {
@@ -351,7 +351,14 @@ _svg_parser_new_svg_group_element (svg_parser_t *parser, svg_element_t **group_e
     if (parent) {
 	status = _svg_group_add_element (&parent->e.group, *group_element);
     } else {
-	_svg_style_init_defaults (&(*group_element)->style, parser->svg);
+	svg_style_t style;
+
+	_svg_style_init_empty (&style, parser->svg);
+	_svg_style_init_defaults (&style, parser->svg);
+	status = _svg_element_set_style (*group_element, &style);
+	_svg_style_deinit (&style);
+	if (status)
+	    return status;
 	parser->svg->group_element = *group_element;
     }
 
@@ -735,7 +742,7 @@ _svg_parser_parse_gradient_stop (svg_parser_t	*parser,
     if (_svg_attribute_get_string (attributes, "stop-color", &color_str, "#000000") == SVG_STATUS_SUCCESS)
 	_svg_color_init_from_str (&color, color_str);
     if (color.is_current_color)
-	color = group_element->style.color;
+	color = group_element->style->color;
 
     /* XXX: Rather than directly storing the stop in the gradient
        here, it would be cleaner to just have the stop be a standard
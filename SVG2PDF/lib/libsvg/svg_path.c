@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <math.h>
+#include <string.h>
 
 #include "svgint.h"
 
@@ -232,7 +233,9 @@ _svg_path_init_copy (svg_path_t *path,
 	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
 	NULL, NULL, NULL, NULL,
 	_svg_path_do_nothing,
-	NULL, NULL, NULL, NULL
+	NULL, NULL, NULL, NULL,
+	NULL,
+	NULL, NULL, NULL
     };
 
     _svg_path_init (path);
@@ -347,6 +350,481 @@ _svg_path_render (svg_path_t		*path,
     return SVG_STATUS_SUCCESS;
 }
 
+typedef struct svg_path_bbox_closure {
+    svg_bbox_t *bbox;
+    /* current point and start of the subpath, for arcs */
+    double x, y;
+    double start_x, start_y;
+} svg_path_bbox_closure_t;
+
+static svg_status_t
+_svg_path_bbox_line_to (void *closure, double x, double y)
+{
+    svg_path_bbox_closure_t *c = (svg_path_bbox_closure_t *) closure;
+
+    _svg_bbox_add_point (c->bbox, x, y);
+    c->x = x;
+    c->y = y;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+static svg_status_t
+_svg_path_bbox_move_to (void *closure, double x, double y)
+{
+    svg_path_bbox_closure_t *c = (svg_path_bbox_closure_t *) closure;
+
+    c->start_x = x;
+    c->start_y = y;
+
+    return _svg_path_bbox_line_to (closure, x, y);
+}
+
+static svg_status_t
+_svg_path_bbox_close_path (void *closure)
+{
+    svg_path_bbox_closure_t *c = (svg_path_bbox_closure_t *) closure;
+
+    c->x = c->start_x;
+    c->y = c->start_y;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+static svg_status_t
+_svg_path_bbox_curve_to (void *closure,
+			 double x1, double y1,
+			 double x2, double y2,
+			 double x3, double y3)
+{
+    svg_path_bbox_closure_t *c = (svg_path_bbox_closure_t *) closure;
+
+    /* a bezier stays inside the hull of its control points */
+    _svg_bbox_add_point (c->bbox, x1, y1);
+    _svg_bbox_add_point (c->bbox, x2, y2);
+
+    return _svg_path_bbox_line_to (closure, x3, y3);
+}
+
+static svg_status_t
+_svg_path_bbox_quadratic_curve_to (void *closure,
+				   double x1, double y1,
+				   double x2, double y2)
+{
+    svg_path_bbox_closure_t *c = (svg_path_bbox_closure_t *) closure;
+
+    _svg_bbox_add_point (c->bbox, x1, y1);
+
+    return _svg_path_bbox_line_to (closure, x2, y2);
+}
+
+/* Radii too small to reach the end point are scaled up, by at most
+   half the chord over the smaller radius. The arc lies on an ellipse
+   through both end points, so within twice the larger radius of
+   either. */
+static svg_status_t
+_svg_path_bbox_arc_to (void *closure,
+		       double rx, double ry,
+		       double x_axis_rotation,
+		       int large_arc_flag, int sweep_flag,
+		       double x, double y)
+{
+    svg_path_bbox_closure_t *c = (svg_path_bbox_closure_t *) closure;
+    double half_chord, r_min, r;
+    svg_bbox_t arc;
+
+    rx = fabs (rx);
+    ry = fabs (ry);
+    if (rx == 0 || ry == 0)
+	return _svg_path_bbox_line_to (closure, x, y);
+
+    half_chord = 0.5 * sqrt ((x - c->x) * (x - c->x) + (y - c->y) * (y - c->y));
+    r_min = rx < ry ? rx : ry;
+    r = rx > ry ? rx : ry;
+    if (half_chord > r_min)
+	r *= half_chord / r_min;
+
+    arc.x1 = (c->x > x ? c->x : x) - 2 * r;
+    arc.y1 = (c->y > y ? c->y : y) - 2 * r;
+    arc.x2 = (c->x < x ? c->x : x) + 2 * r;
+    arc.y2 = (c->y < y ? c->y : y) + 2 * r;
+    _svg_bbox_union (c->bbox, &arc);
+
+    return _svg_path_bbox_line_to (closure, x, y);
+}
+
+/* Adds the bounds of path's geometry, without stroke, to bbox */
+svg_status_t
+_svg_path_get_bbox (svg_path_t *path, svg_bbox_t *bbox)
+{
+    /* The same trick as svg_path_copy_engine above */
+    static svg_render_engine_t svg_path_bbox_engine = {
+	NULL, NULL, NULL, NULL,
+	_svg_path_bbox_move_to,
+	_svg_path_bbox_line_to,
+	_svg_path_bbox_curve_to,
+	_svg_path_bbox_quadratic_curve_to,
+	_svg_path_bbox_arc_to,
+	_svg_path_bbox_close_path,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL,
+	_svg_path_do_nothing,
+	NULL, NULL, NULL, NULL,
+	NULL,
+	NULL, NULL, NULL
+    };
+    svg_path_bbox_closure_t closure;
+
+    closure.bbox = bbox;
+    closure.x = closure.start_x = 0;
+    closure.y = closure.start_y = 0;
+
+    return _svg_path_render (path, &svg_path_bbox_engine, &closure);
+}
+
+/* Simplification of the straight runs of a path, see
+   _svg_path_simplify */
+
+/* Relative to the squared length of the segment, so that exactly
+   collinear points are merged whatever the units */
+#define SVG_PATH_COLLINEAR_EPSILON 1e-12
+
+typedef struct svg_path_simplify_closure {
+    /* the simplified path being built */
+    svg_path_t path;
+    double tolerance;
+    unsigned long removed;
+
+    /* the current run: its first point is already in path, the
+       others are line_to points waiting to be simplified */
+    svg_pt_t *pt;
+    int num_pts;
+    int pts_size;
+
+    char *keep;
+    int *stack;
+} svg_path_simplify_closure_t;
+
+/* Whether b lies on the segment from a to c */
+static int
+_svg_path_pt_is_between (const svg_pt_t *a, const svg_pt_t *b, const svg_pt_t *c)
+{
+    double dx = c->x - a->x, dy = c->y - a->y;
+    double bx = b->x - a->x, by = b->y - a->y;
+    double cross = dx * by - dy * bx;
+
+    if (dx == 0 && dy == 0)
+	return bx == 0 && by == 0;
+
+    if (cross * cross > SVG_PATH_COLLINEAR_EPSILON * (dx * dx + dy * dy) * (dx * dx + dy * dy))
+	return 0;
+
+    /* on the line: also between the ends, a spike back is kept */
+    return bx * dx + by * dy >= 0
+	&& (b->x - c->x) * -dx + (b->y - c->y) * -dy >= 0;
+}
+
+/* Squared distance from p to the segment from a to b */
+static double
+_svg_path_segment_distance_squared (const svg_pt_t *p, const svg_pt_t *a, const svg_pt_t *b)
+{
+    double dx = b->x - a->x, dy = b->y - a->y;
+    double len = dx * dx + dy * dy;
+    double t = 0, x, y;
+
+    if (len > 0) {
+	t = ((p->x - a->x) * dx + (p->y - a->y) * dy) / len;
+	if (t < 0)
+	    t = 0;
+	else if (t > 1)
+	    t = 1;
+    }
+
+    x = a->x + t * dx - p->x;
+    y = a->y + t * dy - p->y;
+
+    return x * x + y * y;
+}
+
+/* Ramer-Douglas-Peucker over pt[0..n-1], with an explicit stack so
+   that polylines of any length are safe: marks in keep the points
+   needed for the run to stay within tolerance of the original. */
+static void
+_svg_path_simplify_run (svg_path_simplify_closure_t *c, int n)
+{
+    svg_pt_t *pt = c->pt;
+    double tolerance_squared = c->tolerance * c->tolerance;
+    double dist, max_dist;
+    int first, last, i, max_i;
+    int top = 0;
+
+    memset (c->keep, 0, n);
+    c->keep[0] = c->keep[n - 1] = 1;
+
+    c->stack[top++] = 0;
+    c->stack[top++] = n - 1;
+
+    while (top) {
+	last = c->stack[--top];
+	first = c->stack[--top];
+
+	max_dist = 0;
+	max_i = first;
+	for (i = first + 1; i < last; i++) {
+	    dist = _svg_path_segment_distance_squared (&pt[i], &pt[first], &pt[last]);
+	    if (dist > max_dist) {
+		max_dist = dist;
+		max_i = i;
+	    }
+	}
+
+	if (max_dist <= tolerance_squared)
+	    continue;
+
+	c->keep[max_i] = 1;
+	if (max_i - first > 1) {
+	    c->stack[top++] = first;
+	    c->stack[top++] = max_i;
+	}
+	if (last - max_i > 1) {
+	    c->stack[top++] = max_i;
+	    c->stack[top++] = last;
+	}
+    }
+}
+
+/* Adds the current run to the path, simplified, and ends it */
+static svg_status_t
+_svg_path_simplify_flush (svg_path_simplify_closure_t *c)
+{
+    svg_status_t status;
+    svg_pt_t *pt = c->pt;
+    int n = c->num_pts;
+    int i, m, kept = 0;
+
+    c->num_pts = 0;
+    if (n < 2)
+	return SVG_STATUS_SUCCESS;
+
+    /* merge collinear segments first, it is exact and cheap and
+       leaves less for the quadratic worst case below */
+    m = 1;
+    for (i = 1; i < n; i++) {
+	while (m >= 2 && _svg_path_pt_is_between (&pt[m - 2], &pt[m - 1], &pt[i]))
+	    m--;
+	pt[m++] = pt[i];
+    }
+
+    if (m > 2)
+	_svg_path_simplify_run (c, m);
+    else
+	memset (c->keep, 1, m);
+
+    for (i = 1; i < m; i++) {
+	if (! c->keep[i])
+	    continue;
+	status = _svg_path_line_to (&c->path, pt[i].x, pt[i].y);
+	if (status)
+	    return status;
+	kept++;
+    }
+
+    /* the first point of the run was added before */
+    c->removed += n - 1 - kept;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+static svg_status_t
+_svg_path_simplify_move_to (void *closure, double x, double y)
+{
+    svg_path_simplify_closure_t *c = (svg_path_simplify_closure_t *)closure;
+    svg_status_t status;
+
+    status = _svg_path_simplify_flush (c);
+    if (status)
+	return status;
+
+    status = _svg_path_move_to (&c->path, x, y);
+    if (status)
+	return status;
+
+    c->pt[0].x = x;
+    c->pt[0].y = y;
+    c->num_pts = 1;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+static svg_status_t
+_svg_path_simplify_line_to (void *closure, double x, double y)
+{
+    svg_path_simplify_closure_t *c = (svg_path_simplify_closure_t *)closure;
+    int size;
+    svg_pt_t *pt;
+    char *keep;
+    int *stack;
+
+    if (c->num_pts + 2 > c->pts_size) {
+	size = c->pts_size * 2;
+	pt = (svg_pt_t *)realloc (c->pt, size * sizeof (svg_pt_t));
+	if (pt == NULL)
+	    return SVG_STATUS_NO_MEMORY;
+	c->pt = pt;
+	keep = (char *)realloc (c->keep, size);
+	if (keep == NULL)
+	    return SVG_STATUS_NO_MEMORY;
+	c->keep = keep;
+	stack = (int *)realloc (c->stack, 2 * size * sizeof (int));
+	if (stack == NULL)
+	    return SVG_STATUS_NO_MEMORY;
+	c->stack = stack;
+	c->pts_size = size;
+    }
+
+    /* after a curve or a close_path the run starts where it ended */
+    if (c->num_pts == 0)
+	c->pt[c->num_pts++] = c->path.current_pt;
+
+    c->pt[c->num_pts].x = x;
+    c->pt[c->num_pts].y = y;
+    c->num_pts++;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+static svg_status_t
+_svg_path_simplify_curve_to (void *closure,
+			     double x1, double y1,
+			     double x2, double y2,
+			     double x3, double y3)
+{
+    svg_path_simplify_closure_t *c = (svg_path_simplify_closure_t *)closure;
+    svg_status_t status;
+
+    status = _svg_path_simplify_flush (c);
+    if (status)
+	return status;
+
+    return _svg_path_curve_to (&c->path, x1, y1, x2, y2, x3, y3);
+}
+
+static svg_status_t
+_svg_path_simplify_quadratic_curve_to (void *closure,
+				       double x1, double y1,
+				       double x2, double y2)
+{
+    svg_path_simplify_closure_t *c = (svg_path_simplify_closure_t *)closure;
+    svg_status_t status;
+
+    status = _svg_path_simplify_flush (c);
+    if (status)
+	return status;
+
+    return _svg_path_quadratic_curve_to (&c->path, x1, y1, x2, y2);
+}
+
+static svg_status_t
+_svg_path_simplify_arc_to (void		*closure,
+			   double	rx,
+			   double	ry,
+			   double	x_axis_rotation,
+			   int		large_arc_flag,
+			   int		sweep_flag,
+			   double	x,
+			   double	y)
+{
+    svg_path_simplify_closure_t *c = (svg_path_simplify_closure_t *)closure;
+    svg_status_t status;
+
+    status = _svg_path_simplify_flush (c);
+    if (status)
+	return status;
+
+    return _svg_path_arc_to (&c->path, rx, ry, x_axis_rotation,
+			     large_arc_flag, sweep_flag, x, y);
+}
+
+static svg_status_t
+_svg_path_simplify_close_path (void *closure)
+{
+    svg_path_simplify_closure_t *c = (svg_path_simplify_closure_t *)closure;
+    svg_status_t status;
+
+    status = _svg_path_simplify_flush (c);
+    if (status)
+	return status;
+
+    return _svg_path_close_path (&c->path);
+}
+
+#define SVG_PATH_SIMPLIFY_INITIAL_PTS 64
+
+/* Replaces every run of straight segments of path with the fewest
+   that stay within tolerance of it, in path's own units: collinear
+   segments are merged, then Ramer-Douglas-Peucker drops the points
+   that don't matter. Curves and arcs are kept as they are. Adds the
+   number of points dropped to removed. */
+svg_status_t
+_svg_path_simplify (svg_path_t *path, double tolerance, unsigned long *removed)
+{
+    /* The same trick as svg_path_copy_engine above */
+    static svg_render_engine_t svg_path_simplify_engine = {
+	NULL, NULL, NULL, NULL,
+	_svg_path_simplify_move_to,
+	_svg_path_simplify_line_to,
+	_svg_path_simplify_curve_to,
+	_svg_path_simplify_quadratic_curve_to,
+	_svg_path_simplify_arc_to,
+	_svg_path_simplify_close_path,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+	NULL, NULL, NULL, NULL,
+	_svg_path_do_nothing,
+	NULL, NULL, NULL, NULL,
+	NULL,
+	NULL, NULL, NULL
+    };
+    svg_path_simplify_closure_t c;
+    svg_status_t status;
+
+    _svg_path_init (&c.path);
+    c.tolerance = tolerance;
+    c.removed = 0;
+    c.num_pts = 0;
+    c.pts_size = SVG_PATH_SIMPLIFY_INITIAL_PTS;
+    c.pt = (svg_pt_t *)malloc (c.pts_size * sizeof (svg_pt_t));
+    c.keep = (char *)malloc (c.pts_size);
+    c.stack = (int *)malloc (2 * c.pts_size * sizeof (int));
+
+    if (c.pt == NULL || c.keep == NULL || c.stack == NULL) {
+	status = SVG_STATUS_NO_MEMORY;
+	goto CLEANUP;
+    }
+
+    status = _svg_path_render (path, &svg_path_simplify_engine, &c);
+    if (status == SVG_STATUS_SUCCESS)
+	status = _svg_path_simplify_flush (&c);
+
+ CLEANUP:
+    free (c.pt);
+    free (c.keep);
+    free (c.stack);
+
+    /* on failure path is left as it was */
+    if (status) {
+	_svg_path_deinit (&c.path);
+	return status;
+    }
+
+    _svg_path_deinit (path);
+    *path = c.path;
+    *removed += c.removed;
+
+    return SVG_STATUS_SUCCESS;
+}
+
 svg_status_t
 _svg_path_apply_attributes (svg_path_t		*path,
 			    const char		**attributes)
@@ -811,6 +1289,89 @@ _svg_ellipse_render (svg_ellipse_t	*ellipse,
 				     &ellipse->rx, &ellipse->ry);
 }
 
+svg_status_t
+_svg_circle_get_bbox (svg_ellipse_t *circle, svg_bbox_t *bbox)
+{
+    if (! _svg_length_is_user_unit (&circle->cx)
+	|| ! _svg_length_is_user_unit (&circle->cy)
+	|| ! _svg_length_is_user_unit (&circle->rx)) {
+	_svg_bbox_init_unbounded (bbox);
+	return SVG_STATUS_SUCCESS;
+    }
+
+    if (circle->rx.value == 0)
+	return SVG_STATUS_SUCCESS;
+
+    _svg_bbox_add_point (bbox,
+			 circle->cx.value - circle->rx.value,
+			 circle->cy.value - circle->rx.value);
+    _svg_bbox_add_point (bbox,
+			 circle->cx.value + circle->rx.value,
+			 circle->cy.value + circle->rx.value);
+
+    return SVG_STATUS_SUCCESS;
+}
+
+svg_status_t
+_svg_ellipse_get_bbox (svg_ellipse_t *ellipse, svg_bbox_t *bbox)
+{
+    if (! _svg_length_is_user_unit (&ellipse->cx)
+	|| ! _svg_length_is_user_unit (&ellipse->cy)
+	|| ! _svg_length_is_user_unit (&ellipse->rx)
+	|| ! _svg_length_is_user_unit (&ellipse->ry)) {
+	_svg_bbox_init_unbounded (bbox);
+	return SVG_STATUS_SUCCESS;
+    }
+
+    if (ellipse->rx.value == 0 || ellipse->ry.value == 0)
+	return SVG_STATUS_SUCCESS;
+
+    _svg_bbox_add_point (bbox,
+			 ellipse->cx.value - ellipse->rx.value,
+			 ellipse->cy.value - ellipse->ry.value);
+    _svg_bbox_add_point (bbox,
+			 ellipse->cx.value + ellipse->rx.value,
+			 ellipse->cy.value + ellipse->ry.value);
+
+    return SVG_STATUS_SUCCESS;
+}
+
+svg_status_t
+_svg_line_get_bbox (svg_line_t *line, svg_bbox_t *bbox)
+{
+    if (! _svg_length_is_user_unit (&line->x1)
+	|| ! _svg_length_is_user_unit (&line->y1)
+	|| ! _svg_length_is_user_unit (&line->x2)
+	|| ! _svg_length_is_user_unit (&line->y2)) {
+	_svg_bbox_init_unbounded (bbox);
+	return SVG_STATUS_SUCCESS;
+    }
+
+    _svg_bbox_add_point (bbox, line->x1.value, line->y1.value);
+    _svg_bbox_add_point (bbox, line->x2.value, line->y2.value);
+
+    return SVG_STATUS_SUCCESS;
+}
+
+svg_status_t
+_svg_rect_get_bbox (svg_rect_element_t *rect, svg_bbox_t *bbox)
+{
+    if (! _svg_length_is_user_unit (&rect->x)
+	|| ! _svg_length_is_user_unit (&rect->y)
+	|| ! _svg_length_is_user_unit (&rect->width)
+	|| ! _svg_length_is_user_unit (&rect->height)) {
+	_svg_bbox_init_unbounded (bbox);
+	return SVG_STATUS_SUCCESS;
+    }
+
+    _svg_bbox_add_point (bbox, rect->x.value, rect->y.value);
+    _svg_bbox_add_point (bbox,
+			 rect->x.value + rect->width.value,
+			 rect->y.value + rect->height.value);
+
+    return SVG_STATUS_SUCCESS;
+}
+
 /**
  * _svg_path_arc_to: Add an arc to the given path
  *
@@ -0,0 +1,308 @@
+/* svg_rtree.c: Spatial index over the children of large groups
+
+   Copyright � 2002 USC/Information Sciences Institute
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Library General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Library General Public License for more details.
+
+   You should have received a copy of the GNU Library General Public
+   License along with this program; if not, write to the
+   Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+   Boston, MA 02111-1307, USA.
+
+   Author: Carl Worth <cworth@isi.edu>
+*/
+
+#include <math.h>
+#include <stdlib.h>
+
+#include "svgint.h"
+
+/* The document doesn't change once parsed, so the tree is packed
+   once, bottom up, with Sort-Tile-Recursive: each level is sorted
+   into vertical slabs by x, each slab by y, and cut into runs of
+   SVG_RTREE_FANOUT. All levels live in one array, leaves first and
+   the root last; a node's children are a contiguous range of the
+   level below, or of entry for a leaf. */
+
+#define SVG_RTREE_FANOUT 16
+
+static int
+_svg_rtree_compare_x (const void *a, const void *b);
+
+static int
+_svg_rtree_compare_y (const void *a, const void *b);
+
+static int
+_svg_rtree_pack (svg_rtree_node_t *item, int num_items, int offset,
+		 svg_rtree_node_t *parent);
+
+static svg_status_t
+_svg_rtree_search_node (svg_rtree_t		*rtree,
+			int			n,
+			const svg_bbox_t	*region,
+			svg_render_engine_t	*engine,
+			void			*closure,
+			int			**hits,
+			int			*num_hits,
+			int			*hits_size);
+
+static svg_status_t
+_svg_rtree_add_hit (int index, int **hits, int *num_hits, int *hits_size);
+
+static int
+_svg_rtree_intersects (const svg_bbox_t *a, const svg_bbox_t *b)
+{
+    return a->x1 <= b->x2 && b->x1 <= a->x2
+	&& a->y1 <= b->y2 && b->y1 <= a->y2;
+}
+
+svg_status_t
+_svg_rtree_create (svg_rtree_t		**rtree_ret,
+		   svg_element_t	**element,
+		   int			num_elements)
+{
+    svg_rtree_t *rtree;
+    int i, n, num_nodes, start, count;
+
+    rtree = (svg_rtree_t *)calloc (1, sizeof (svg_rtree_t));
+    if (rtree == NULL)
+	return SVG_STATUS_NO_MEMORY;
+
+    rtree->entry = (svg_rtree_node_t *)malloc (num_elements * sizeof (svg_rtree_node_t));
+    rtree->always = (int *)malloc (num_elements * sizeof (int));
+    if (rtree->entry == NULL || rtree->always == NULL) {
+	_svg_rtree_destroy (rtree);
+	return SVG_STATUS_NO_MEMORY;
+    }
+
+    /* Empty children draw nothing and are left out; unbounded ones
+       can't be placed and are returned by every search. */
+    for (i = 0; i < num_elements; i++) {
+	if (_svg_bbox_is_empty (&element[i]->bbox))
+	    continue;
+	if (! _svg_bbox_is_bounded (&element[i]->bbox)) {
+	    rtree->always[rtree->num_always++] = i;
+	    continue;
+	}
+	rtree->entry[rtree->num_entries].bbox = element[i]->bbox;
+	rtree->entry[rtree->num_entries].first = i;
+	rtree->entry[rtree->num_entries].count = 0;
+	rtree->num_entries++;
+    }
+
+    if (rtree->num_entries == 0) {
+	*rtree_ret = rtree;
+	return SVG_STATUS_SUCCESS;
+    }
+
+    num_nodes = 0;
+    n = rtree->num_entries;
+    do {
+	n = (n + SVG_RTREE_FANOUT - 1) / SVG_RTREE_FANOUT;
+	num_nodes += n;
+    } while (n > 1);
+
+    rtree->node = (svg_rtree_node_t *)malloc (num_nodes * sizeof (svg_rtree_node_t));
+    if (rtree->node == NULL) {
+	_svg_rtree_destroy (rtree);
+	return SVG_STATUS_NO_MEMORY;
+    }
+
+    rtree->num_leaves = _svg_rtree_pack (rtree->entry, rtree->num_entries, 0,
+					 rtree->node);
+    rtree->num_nodes = rtree->num_leaves;
+
+    start = 0;
+    count = rtree->num_leaves;
+    while (count > 1) {
+	n = _svg_rtree_pack (rtree->node + start, count, start,
+			     rtree->node + rtree->num_nodes);
+	start = rtree->num_nodes;
+	rtree->num_nodes += n;
+	count = n;
+    }
+
+    *rtree_ret = rtree;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+void
+_svg_rtree_destroy (svg_rtree_t *rtree)
+{
+    free (rtree->entry);
+    free (rtree->always);
+    free (rtree->node);
+    free (rtree);
+}
+
+static int
+_svg_rtree_compare_x (const void *a, const void *b)
+{
+    const svg_rtree_node_t *na = (const svg_rtree_node_t *) a;
+    const svg_rtree_node_t *nb = (const svg_rtree_node_t *) b;
+    double ca = na->bbox.x1 + na->bbox.x2;
+    double cb = nb->bbox.x1 + nb->bbox.x2;
+
+    return ca < cb ? -1 : ca > cb ? 1 : 0;
+}
+
+static int
+_svg_rtree_compare_y (const void *a, const void *b)
+{
+    const svg_rtree_node_t *na = (const svg_rtree_node_t *) a;
+    const svg_rtree_node_t *nb = (const svg_rtree_node_t *) b;
+    double ca = na->bbox.y1 + na->bbox.y2;
+    double cb = nb->bbox.y1 + nb->bbox.y2;
+
+    return ca < cb ? -1 : ca > cb ? 1 : 0;
+}
+
+/* Reorders item in place and writes one parent per run of
+   SVG_RTREE_FANOUT items. offset is where item sits in its own
+   array. Returns the number of parents. */
+static int
+_svg_rtree_pack (svg_rtree_node_t	*item,
+		 int			num_items,
+		 int			offset,
+		 svg_rtree_node_t	*parent)
+{
+    int num_parents, num_slabs, slab_size;
+    int i, j, n, num_written = 0;
+
+    num_parents = (num_items + SVG_RTREE_FANOUT - 1) / SVG_RTREE_FANOUT;
+    num_slabs = (int) ceil (sqrt ((double) num_parents));
+    slab_size = num_slabs * SVG_RTREE_FANOUT;
+
+    qsort (item, num_items, sizeof (svg_rtree_node_t), _svg_rtree_compare_x);
+
+    for (i = 0; i < num_items; i += slab_size) {
+	n = num_items - i < slab_size ? num_items - i : slab_size;
+	qsort (item + i, n, sizeof (svg_rtree_node_t), _svg_rtree_compare_y);
+
+	for (j = i; j < i + n; j += SVG_RTREE_FANOUT) {
+	    svg_rtree_node_t *p = &parent[num_written++];
+	    int k;
+
+	    p->first = offset + j;
+	    p->count = i + n - j < SVG_RTREE_FANOUT ? i + n - j : SVG_RTREE_FANOUT;
+	    _svg_bbox_init_empty (&p->bbox);
+	    for (k = j; k < j + p->count; k++)
+		_svg_bbox_union (&p->bbox, &item[k].bbox);
+	}
+    }
+
+    return num_written;
+}
+
+/* Without a region, asks the engine's test_bbox whether a box can
+   reach the output; an error counts as visible. */
+static int
+_svg_rtree_is_visible (const svg_bbox_t	*bbox,
+		       const svg_bbox_t	*region,
+		       svg_render_engine_t	*engine,
+		       void			*closure)
+{
+    int visible;
+
+    if (region)
+	return _svg_rtree_intersects (bbox, region);
+
+    if ((engine->test_bbox) (closure, bbox->x1, bbox->y1,
+			     bbox->x2, bbox->y2, &visible))
+	return 1;
+
+    return visible;
+}
+
+/* Appends to hits, in no particular order, the index of every child
+   whose box meets region or, if region is NULL, of every child under
+   a node that engine->test_bbox finds visible; those children still
+   go through their own test when rendered. hits is grown with
+   realloc as needed. */
+svg_status_t
+_svg_rtree_search (svg_rtree_t		*rtree,
+		   const svg_bbox_t	*region,
+		   svg_render_engine_t	*engine,
+		   void			*closure,
+		   int			**hits,
+		   int			*num_hits,
+		   int			*hits_size)
+{
+    svg_status_t status;
+    int i;
+
+    for (i = 0; i < rtree->num_always; i++) {
+	status = _svg_rtree_add_hit (rtree->always[i], hits, num_hits, hits_size);
+	if (status)
+	    return status;
+    }
+
+    if (rtree->num_nodes == 0)
+	return SVG_STATUS_SUCCESS;
+
+    return _svg_rtree_search_node (rtree, rtree->num_nodes - 1,
+				   region, engine, closure,
+				   hits, num_hits, hits_size);
+}
+
+static svg_status_t
+_svg_rtree_search_node (svg_rtree_t		*rtree,
+			int			n,
+			const svg_bbox_t	*region,
+			svg_render_engine_t	*engine,
+			void			*closure,
+			int			**hits,
+			int			*num_hits,
+			int			*hits_size)
+{
+    svg_rtree_node_t *node = &rtree->node[n];
+    svg_status_t status;
+    int i;
+
+    if (! _svg_rtree_is_visible (&node->bbox, region, engine, closure))
+	return SVG_STATUS_SUCCESS;
+
+    for (i = node->first; i < node->first + node->count; i++) {
+	if (n < rtree->num_leaves) {
+	    if (region && ! _svg_rtree_intersects (&rtree->entry[i].bbox, region))
+		continue;
+	    status = _svg_rtree_add_hit (rtree->entry[i].first,
+					 hits, num_hits, hits_size);
+	} else {
+	    status = _svg_rtree_search_node (rtree, i, region, engine, closure,
+					     hits, num_hits, hits_size);
+	}
+	if (status)
+	    return status;
+    }
+
+    return SVG_STATUS_SUCCESS;
+}
+
+static svg_status_t
+_svg_rtree_add_hit (int index, int **hits, int *num_hits, int *hits_size)
+{
+    if (*num_hits >= *hits_size) {
+	int new_size = *hits_size ? *hits_size * 2 : 64;
+	int *new_hits;
+
+	new_hits = (int *)realloc (*hits, new_size * sizeof (int));
+	if (new_hits == NULL)
+	    return SVG_STATUS_NO_MEMORY;
+	*hits = new_hits;
+	*hits_size = new_size;
+    }
+
+    (*hits)[(*num_hits)++] = index;
+
+    return SVG_STATUS_SUCCESS;
+}
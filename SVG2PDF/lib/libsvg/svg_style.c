@@ -25,6 +25,30 @@
 
 #include "svgint.h"
 
+static int
+_svg_style_color_equal (const svg_color_t *a, const svg_color_t *b);
+
+static int
+_svg_style_paint_equal (const svg_paint_t *a, const svg_paint_t *b);
+
+static int
+_svg_style_length_equal (const svg_length_t *a, const svg_length_t *b);
+
+static int
+_svg_style_string_equal (const char *a, const char *b);
+
+static int
+_svg_style_dash_equal (const svg_style_t *a, const svg_style_t *b);
+
+static int
+_svg_style_equal (const svg_style_t *a, const svg_style_t *b);
+
+static unsigned int
+_svg_style_hash_paint (unsigned int hash, const svg_paint_t *paint);
+
+static unsigned int
+_svg_style_hash (const svg_style_t *style);
+
 static svg_status_t
 _svg_style_parse_color (svg_style_t *style, const char *str);
 
@@ -162,13 +186,17 @@ static const svg_style_parse_map_t SVG_STYLE_PARSE_MAP[] = {
 svg_status_t
 _svg_style_init_empty (svg_style_t *style, svg_t *svg)
 {
+    /* _svg_style_hash and _svg_style_equal read every field, set in
+       flags or not, so equal specified styles must be bit-identical */
+    memset (style, 0, sizeof (svg_style_t));
+
     style->svg = svg;
     style->flags = SVG_STYLE_FLAG_NONE;
     style->font_family = NULL;
     _svg_length_init_from_str (&style->font_size, "10px");
     style->num_dashes = 0;
     style->stroke_dash_array = NULL;
-    style->stroke_dash_offset.value = 0;
+    _svg_length_init (&style->stroke_dash_offset, 0.0);
 
     /* initialize unused elements so copies are predictable */
     style->stroke_line_cap = SVG_STROKE_LINE_CAP_BUTT;
@@ -800,116 +828,118 @@ _svg_style_apply_attributes (svg_style_t	*style,
 
 svg_status_t
 _svg_style_render (svg_style_t		*style,
+		   uint64_t		mask,
 		   svg_render_engine_t	*engine,
 		   void			*closure)
 {
     svg_status_t status;
+    uint64_t flags = style->flags & mask;
 
-    if (style->flags & SVG_STYLE_FLAG_COLOR) {
+    if (flags & SVG_STYLE_FLAG_COLOR) {
 	status = (engine->set_color) (closure, &style->color);
 	if (status)
 	    return status;
     }
 
-    if (style->flags & SVG_STYLE_FLAG_FILL_OPACITY) {
+    if (flags & SVG_STYLE_FLAG_FILL_OPACITY) {
 	status = (engine->set_fill_opacity) (closure, style->fill_opacity);
 	if (status)
 	    return status;
     }
 
-    if (style->flags & SVG_STYLE_FLAG_FILL_PAINT) {
+    if (flags & SVG_STYLE_FLAG_FILL_PAINT) {
 			status = (engine->set_fill_paint) (closure, &style->fill_paint);
 	if (status)
 	    return status;
     }
 
-    if (style->flags & SVG_STYLE_FLAG_FILL_RULE) {
+    if (flags & SVG_STYLE_FLAG_FILL_RULE) {
 	status = (engine->set_fill_rule) (closure, style->fill_rule);
 	if (status)
 	    return status;
     }
 
-    if (style->flags & SVG_STYLE_FLAG_FONT_FAMILY) {
+    if (flags & SVG_STYLE_FLAG_FONT_FAMILY) {
 	status = (engine->set_font_family) (closure, style->font_family);
 	if (status)
 	    return status;
     }
 
-    if (style->flags & SVG_STYLE_FLAG_FONT_SIZE) {
+    if (flags & SVG_STYLE_FLAG_FONT_SIZE) {
 	/* XXX: How to deal with units of svg_length_t ? */
 	status = (engine->set_font_size) (closure, style->font_size.value);
 	if (status)
 	    return status;
     }
 
-    if (style->flags & SVG_STYLE_FLAG_FONT_STYLE) {
+    if (flags & SVG_STYLE_FLAG_FONT_STYLE) {
 	status = (engine->set_font_style) (closure, style->font_style);
 	if (status)
 	    return status;
     }
 
-    if (style->flags & SVG_STYLE_FLAG_FONT_WEIGHT) {
+    if (flags & SVG_STYLE_FLAG_FONT_WEIGHT) {
 	status = (engine->set_font_weight) (closure, style->font_weight);
 	if (status)
 	    return status;
     }
 
-    if (style->flags & SVG_STYLE_FLAG_OPACITY) {
+    if (flags & SVG_STYLE_FLAG_OPACITY) {
 	status = (engine->set_opacity) (closure, style->opacity);
 	if (status)
 	    return status;
     }
 
-    if (style->flags & SVG_STYLE_FLAG_STROKE_DASH_ARRAY) {
+    if (flags & SVG_STYLE_FLAG_STROKE_DASH_ARRAY) {
 	/* XXX: How to deal with units of svg_length_t ? */
 	status = (engine->set_stroke_dash_array) (closure, style->stroke_dash_array, style->num_dashes);
 	if (status)
 	    return status;
     }
 
-    if (style->flags & SVG_STYLE_FLAG_STROKE_DASH_OFFSET) {
+    if (flags & SVG_STYLE_FLAG_STROKE_DASH_OFFSET) {
 	status = (engine->set_stroke_dash_offset) (closure, &style->stroke_dash_offset);
 	if (status)
 	    return status;
     }
 
-    if (style->flags & SVG_STYLE_FLAG_STROKE_LINE_CAP) {
+    if (flags & SVG_STYLE_FLAG_STROKE_LINE_CAP) {
 	status = (engine->set_stroke_line_cap) (closure, style->stroke_line_cap);
 	if (status)
 	    return status;
     }
 
-    if (style->flags & SVG_STYLE_FLAG_STROKE_LINE_JOIN) {
+    if (flags & SVG_STYLE_FLAG_STROKE_LINE_JOIN) {
 	status = (engine->set_stroke_line_join) (closure, style->stroke_line_join);
 	if (status)
 	    return status;
     }
 
-    if (style->flags & SVG_STYLE_FLAG_STROKE_MITER_LIMIT) {
+    if (flags & SVG_STYLE_FLAG_STROKE_MITER_LIMIT) {
 	status = (engine->set_stroke_miter_limit) (closure, style->stroke_miter_limit);
 	if (status)
 	    return status;
     }
 
-    if (style->flags & SVG_STYLE_FLAG_STROKE_OPACITY) {
+    if (flags & SVG_STYLE_FLAG_STROKE_OPACITY) {
 	status = (engine->set_stroke_opacity) (closure, style->stroke_opacity);
 	if (status)
 	    return status;
     }
 
-    if (style->flags & SVG_STYLE_FLAG_STROKE_PAINT) {
+    if (flags & SVG_STYLE_FLAG_STROKE_PAINT) {
 	status = (engine->set_stroke_paint) (closure, &style->stroke_paint);
 	if (status)
 	    return status;
     }
 
-    if (style->flags & SVG_STYLE_FLAG_STROKE_WIDTH) {
+    if (flags & SVG_STYLE_FLAG_STROKE_WIDTH) {
 	status = (engine->set_stroke_width) (closure, &style->stroke_width);
 	if (status)
 	    return status;
     }
 
-    if (style->flags & SVG_STYLE_FLAG_TEXT_ANCHOR) {
+    if (flags & SVG_STYLE_FLAG_TEXT_ANCHOR) {
 	status = (engine->set_text_anchor) (closure, style->text_anchor);
 	if (status)
 	    return status;
@@ -941,3 +971,373 @@ _svg_style_get_visibility (svg_style_t *style)
     else
 	return SVG_STATUS_INVALID_VALUE;
 }
+
+/* Computed styles
+
+   After parsing, each element in the render tree gets its computed
+   style: the parent's, with the element's own properties on top.
+   Elements remember which of their properties differ from the
+   parent's computed value (style_delta), and only those are sent to
+   the engine, since it inherits everything else through its state
+   stack. Computed styles are interned in the document like the
+   elements' own styles, so elements with the same look share one
+   entry. */
+
+static int
+_svg_style_color_equal (const svg_color_t *a, const svg_color_t *b)
+{
+    if (a->is_current_color || b->is_current_color)
+	return a->is_current_color == b->is_current_color;
+
+    return a->rgb == b->rgb;
+}
+
+static int
+_svg_style_paint_equal (const svg_paint_t *a, const svg_paint_t *b)
+{
+    if (a->type != b->type)
+	return 0;
+
+    switch (a->type) {
+    case SVG_PAINT_TYPE_COLOR:
+	return _svg_style_color_equal (&a->p.color, &b->p.color);
+    case SVG_PAINT_TYPE_GRADIENT:
+	return a->p.gradient == b->p.gradient;
+    case SVG_PAINT_TYPE_PATTERN:
+	return a->p.pattern_element == b->p.pattern_element;
+    default:
+	return 1;
+    }
+}
+
+static int
+_svg_style_length_equal (const svg_length_t *a, const svg_length_t *b)
+{
+    return a->value == b->value
+	&& a->unit == b->unit
+	&& a->orientation == b->orientation;
+}
+
+static int
+_svg_style_string_equal (const char *a, const char *b)
+{
+    if (a == NULL || b == NULL)
+	return a == b;
+
+    return strcmp (a, b) == 0;
+}
+
+static int
+_svg_style_dash_equal (const svg_style_t *a, const svg_style_t *b)
+{
+    if (a->num_dashes != b->num_dashes)
+	return 0;
+
+    if (a->num_dashes == 0)
+	return 1;
+
+    return memcmp (a->stroke_dash_array, b->stroke_dash_array,
+		   a->num_dashes * sizeof (double)) == 0;
+}
+
+/* Lengths relative to the font size or the viewport are resolved by
+   the engine when they are set, so an equal value doesn't mean an
+   equal result. */
+static int
+_svg_style_length_is_relative (const svg_length_t *length)
+{
+    return length->unit == SVG_LENGTH_UNIT_EM
+	|| length->unit == SVG_LENGTH_UNIT_EX
+	|| length->unit == SVG_LENGTH_UNIT_PCT;
+}
+
+uint64_t
+_svg_style_resolve (svg_style_t		*computed,
+		    const svg_style_t	*parent,
+		    const svg_style_t	*specified)
+{
+    uint64_t flags = specified->flags;
+    uint64_t delta = SVG_STYLE_FLAG_NONE;
+    uint64_t own = SVG_STYLE_FLAG_DISPLAY | SVG_STYLE_FLAG_VISIBILITY;
+
+    /* Nothing is known about the engine's initial state */
+    if (parent == NULL) {
+	*computed = *specified;
+	return ~(uint64_t) 0;
+    }
+
+    *computed = *parent;
+    computed->flags = (parent->flags & ~own) | flags;
+
+    if (flags & SVG_STYLE_FLAG_COLOR) {
+	if (! _svg_style_color_equal (&specified->color, &parent->color))
+	    delta |= SVG_STYLE_FLAG_COLOR;
+	computed->color = specified->color;
+    }
+
+    if (flags & SVG_STYLE_FLAG_FILL_OPACITY) {
+	if (specified->fill_opacity != parent->fill_opacity)
+	    delta |= SVG_STYLE_FLAG_FILL_OPACITY;
+	computed->fill_opacity = specified->fill_opacity;
+    }
+
+    if (flags & SVG_STYLE_FLAG_FILL_PAINT) {
+	if (! _svg_style_paint_equal (&specified->fill_paint, &parent->fill_paint))
+	    delta |= SVG_STYLE_FLAG_FILL_PAINT;
+	computed->fill_paint = specified->fill_paint;
+    }
+
+    if (flags & SVG_STYLE_FLAG_FILL_RULE) {
+	if (specified->fill_rule != parent->fill_rule)
+	    delta |= SVG_STYLE_FLAG_FILL_RULE;
+	computed->fill_rule = specified->fill_rule;
+    }
+
+    if (flags & SVG_STYLE_FLAG_FONT_FAMILY) {
+	if (! _svg_style_string_equal (specified->font_family, parent->font_family))
+	    delta |= SVG_STYLE_FLAG_FONT_FAMILY;
+	computed->font_family = specified->font_family;
+    }
+
+    if (flags & SVG_STYLE_FLAG_FONT_SIZE) {
+	if (! _svg_style_length_equal (&specified->font_size, &parent->font_size))
+	    delta |= SVG_STYLE_FLAG_FONT_SIZE;
+	computed->font_size = specified->font_size;
+    }
+
+    if (flags & SVG_STYLE_FLAG_FONT_STYLE) {
+	if (specified->font_style != parent->font_style)
+	    delta |= SVG_STYLE_FLAG_FONT_STYLE;
+	computed->font_style = specified->font_style;
+    }
+
+    if (flags & SVG_STYLE_FLAG_FONT_WEIGHT) {
+	if (specified->font_weight != parent->font_weight)
+	    delta |= SVG_STYLE_FLAG_FONT_WEIGHT;
+	computed->font_weight = specified->font_weight;
+    }
+
+    /* opacity is not inherited, engines multiply it in */
+    computed->opacity = 1.0;
+    if (flags & SVG_STYLE_FLAG_OPACITY) {
+	if (specified->opacity != 1.0)
+	    delta |= SVG_STYLE_FLAG_OPACITY;
+	computed->opacity = specified->opacity;
+    }
+
+    if (flags & SVG_STYLE_FLAG_STROKE_DASH_ARRAY) {
+	if (! _svg_style_dash_equal (specified, parent))
+	    delta |= SVG_STYLE_FLAG_STROKE_DASH_ARRAY;
+	computed->stroke_dash_array = specified->stroke_dash_array;
+	computed->num_dashes = specified->num_dashes;
+    }
+
+    if (flags & SVG_STYLE_FLAG_STROKE_DASH_OFFSET) {
+	if (_svg_style_length_is_relative (&specified->stroke_dash_offset)
+	    || ! _svg_style_length_equal (&specified->stroke_dash_offset, &parent->stroke_dash_offset))
+	    delta |= SVG_STYLE_FLAG_STROKE_DASH_OFFSET;
+	computed->stroke_dash_offset = specified->stroke_dash_offset;
+    }
+
+    if (flags & SVG_STYLE_FLAG_STROKE_LINE_CAP) {
+	if (specified->stroke_line_cap != parent->stroke_line_cap)
+	    delta |= SVG_STYLE_FLAG_STROKE_LINE_CAP;
+	computed->stroke_line_cap = specified->stroke_line_cap;
+    }
+
+    if (flags & SVG_STYLE_FLAG_STROKE_LINE_JOIN) {
+	if (specified->stroke_line_join != parent->stroke_line_join)
+	    delta |= SVG_STYLE_FLAG_STROKE_LINE_JOIN;
+	computed->stroke_line_join = specified->stroke_line_join;
+    }
+
+    if (flags & SVG_STYLE_FLAG_STROKE_MITER_LIMIT) {
+	if (specified->stroke_miter_limit != parent->stroke_miter_limit)
+	    delta |= SVG_STYLE_FLAG_STROKE_MITER_LIMIT;
+	computed->stroke_miter_limit = specified->stroke_miter_limit;
+    }
+
+    if (flags & SVG_STYLE_FLAG_STROKE_OPACITY) {
+	if (specified->stroke_opacity != parent->stroke_opacity)
+	    delta |= SVG_STYLE_FLAG_STROKE_OPACITY;
+	computed->stroke_opacity = specified->stroke_opacity;
+    }
+
+    if (flags & SVG_STYLE_FLAG_STROKE_PAINT) {
+	if (! _svg_style_paint_equal (&specified->stroke_paint, &parent->stroke_paint))
+	    delta |= SVG_STYLE_FLAG_STROKE_PAINT;
+	computed->stroke_paint = specified->stroke_paint;
+    }
+
+    if (flags & SVG_STYLE_FLAG_STROKE_WIDTH) {
+	if (_svg_style_length_is_relative (&specified->stroke_width)
+	    || ! _svg_style_length_equal (&specified->stroke_width, &parent->stroke_width))
+	    delta |= SVG_STYLE_FLAG_STROKE_WIDTH;
+	computed->stroke_width = specified->stroke_width;
+    }
+
+    if (flags & SVG_STYLE_FLAG_TEXT_ANCHOR) {
+	if (specified->text_anchor != parent->text_anchor)
+	    delta |= SVG_STYLE_FLAG_TEXT_ANCHOR;
+	computed->text_anchor = specified->text_anchor;
+    }
+
+    return delta;
+}
+
+static int
+_svg_style_equal (const svg_style_t *a, const svg_style_t *b)
+{
+    return a->flags == b->flags
+	&& _svg_style_color_equal (&a->color, &b->color)
+	&& a->fill_opacity == b->fill_opacity
+	&& _svg_style_paint_equal (&a->fill_paint, &b->fill_paint)
+	&& a->fill_rule == b->fill_rule
+	&& _svg_style_string_equal (a->font_family, b->font_family)
+	&& _svg_style_length_equal (&a->font_size, &b->font_size)
+	&& a->font_style == b->font_style
+	&& a->font_weight == b->font_weight
+	&& a->opacity == b->opacity
+	&& _svg_style_dash_equal (a, b)
+	&& _svg_style_length_equal (&a->stroke_dash_offset, &b->stroke_dash_offset)
+	&& a->stroke_line_cap == b->stroke_line_cap
+	&& a->stroke_line_join == b->stroke_line_join
+	&& a->stroke_miter_limit == b->stroke_miter_limit
+	&& a->stroke_opacity == b->stroke_opacity
+	&& _svg_style_paint_equal (&a->stroke_paint, &b->stroke_paint)
+	&& _svg_style_length_equal (&a->stroke_width, &b->stroke_width)
+	&& a->text_anchor == b->text_anchor;
+}
+
+static unsigned int
+_svg_style_hash_paint (unsigned int hash, const svg_paint_t *paint)
+{
+    hash = hash * 31 + paint->type;
+    switch (paint->type) {
+    case SVG_PAINT_TYPE_COLOR:
+	hash = hash * 31 + paint->p.color.rgb + paint->p.color.is_current_color;
+	break;
+    case SVG_PAINT_TYPE_GRADIENT:
+	hash = hash * 31 + (unsigned int) (size_t) paint->p.gradient;
+	break;
+    case SVG_PAINT_TYPE_PATTERN:
+	hash = hash * 31 + (unsigned int) (size_t) paint->p.pattern_element;
+	break;
+    default:
+	break;
+    }
+
+    return hash;
+}
+
+/* Only needs to agree with _svg_style_equal, not to cover every field */
+static unsigned int
+_svg_style_hash (const svg_style_t *style)
+{
+    unsigned int hash;
+
+    hash = (unsigned int) (style->flags ^ (style->flags >> 32));
+    hash = _svg_style_hash_paint (hash, &style->fill_paint);
+    hash = _svg_style_hash_paint (hash, &style->stroke_paint);
+    hash = hash * 31 + (unsigned int) (style->stroke_width.value * 1024.0);
+    hash = hash * 31 + (unsigned int) (style->font_size.value * 1024.0);
+    hash = hash * 31 + (unsigned int) (style->opacity * 1024.0);
+    hash = hash * 31 + (unsigned int) (style->fill_opacity * 1024.0);
+    hash = hash * 31 + (unsigned int) (style->stroke_opacity * 1024.0);
+    hash = hash * 31 + style->num_dashes;
+
+    return hash;
+}
+
+/* Returns the index in svg->styles of a style equal to style, adding
+   a copy if there is none. Entries are allocated one by one so that
+   pointers to them stay valid while the table grows. */
+svg_status_t
+_svg_style_intern (svg_t *svg, const svg_style_t *style, int *style_id)
+{
+    svg_style_t *copy;
+    svg_status_t status;
+    unsigned int mask, i;
+    int id;
+
+    if (svg->num_styles * 2 >= svg->style_hash_size) {
+	int new_hash_size = svg->style_hash_size ? svg->style_hash_size * 2 : 64;
+	int *new_hash;
+
+	new_hash = (int *)malloc (new_hash_size * sizeof (int));
+	if (new_hash == NULL)
+	    return SVG_STATUS_NO_MEMORY;
+	for (i = 0; i < (unsigned int) new_hash_size; i++)
+	    new_hash[i] = -1;
+
+	mask = new_hash_size - 1;
+	for (id = 0; id < svg->num_styles; id++) {
+	    i = _svg_style_hash (svg->styles[id]) & mask;
+	    while (new_hash[i] >= 0)
+		i = (i + 1) & mask;
+	    new_hash[i] = id;
+	}
+
+	free (svg->style_hash);
+	svg->style_hash = new_hash;
+	svg->style_hash_size = new_hash_size;
+    }
+
+    mask = svg->style_hash_size - 1;
+    i = _svg_style_hash (style) & mask;
+    while (svg->style_hash[i] >= 0) {
+	if (_svg_style_equal (svg->styles[svg->style_hash[i]], style)) {
+	    *style_id = svg->style_hash[i];
+	    return SVG_STATUS_SUCCESS;
+	}
+	i = (i + 1) & mask;
+    }
+
+    if (svg->num_styles >= svg->styles_size) {
+	int new_size = svg->styles_size ? svg->styles_size * 2 : 32;
+	svg_style_t **new_styles;
+
+	new_styles = (svg_style_t **)realloc (svg->styles, new_size * sizeof (svg_style_t *));
+	if (new_styles == NULL)
+	    return SVG_STATUS_NO_MEMORY;
+	svg->styles = new_styles;
+	svg->styles_size = new_size;
+    }
+
+    copy = (svg_style_t *)malloc (sizeof (svg_style_t));
+    if (copy == NULL)
+	return SVG_STATUS_NO_MEMORY;
+
+    status = _svg_style_init_copy (copy, (svg_style_t *) style);
+    if (status) {
+	_svg_style_deinit (copy);
+	free (copy);
+	return status;
+    }
+
+    id = svg->num_styles++;
+    svg->styles[id] = copy;
+    svg->style_hash[i] = id;
+    *style_id = id;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+void
+_svg_style_table_clear (svg_t *svg)
+{
+    int i;
+
+    for (i = 0; i < svg->num_styles; i++) {
+	_svg_style_deinit (svg->styles[i]);
+	free (svg->styles[i]);
+    }
+    free (svg->styles);
+    svg->styles = NULL;
+    svg->num_styles = 0;
+    svg->styles_size = 0;
+
+    free (svg->style_hash);
+    svg->style_hash = NULL;
+    svg->style_hash_size = 0;
+}
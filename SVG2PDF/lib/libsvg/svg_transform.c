@@ -236,6 +236,49 @@ _svg_transform_multiply (svg_transform_t	*result,
     return SVG_STATUS_SUCCESS;
 }
 
+int
+_svg_transform_is_identity (const svg_transform_t *transform)
+{
+    return transform->m[0][0] == 1.0 && transform->m[0][1] == 0.0
+	&& transform->m[1][0] == 0.0 && transform->m[1][1] == 1.0
+	&& transform->m[2][0] == 0.0 && transform->m[2][1] == 0.0;
+}
+
+svg_status_t
+_svg_transform_invert (svg_transform_t *transform)
+{
+    double a = transform->m[0][0], b = transform->m[0][1];
+    double c = transform->m[1][0], d = transform->m[1][1];
+    double e = transform->m[2][0], f = transform->m[2][1];
+    double det = a * d - b * c;
+
+    if (det == 0)
+	return SVG_STATUS_INVALID_VALUE;
+
+    transform->m[0][0] = d / det;
+    transform->m[0][1] = -b / det;
+    transform->m[1][0] = -c / det;
+    transform->m[1][1] = a / det;
+    transform->m[2][0] = (c * f - d * e) / det;
+    transform->m[2][1] = (b * e - a * f) / det;
+
+    return SVG_STATUS_SUCCESS;
+}
+
+/* The most transform stretches any distance by: the larger singular
+   value of its linear part. */
+double
+_svg_transform_get_max_scale (const svg_transform_t *transform)
+{
+    double a = transform->m[0][0], b = transform->m[0][1];
+    double c = transform->m[1][0], d = transform->m[1][1];
+    double sum = a * a + b * b + c * c + d * d;
+    double diff = a * a + b * b - c * c - d * d;
+    double cross = a * c + b * d;
+
+    return sqrt ((sum + sqrt (diff * diff + 4 * cross * cross)) / 2);
+}
+
 svg_status_t
 _svg_transform_render (svg_transform_t		*transform,
 		       svg_render_engine_t	*engine,
@@ -222,6 +222,35 @@ typedef struct svg_transform {
     double m[3][2];
 } svg_transform_t;
 
+/* Empty when x1 > x2, unbounded when the sides are infinite */
+typedef struct svg_bbox {
+    double x1;
+    double y1;
+    double x2;
+    double y2;
+} svg_bbox_t;
+
+/* A box and either a child index (entries) or a range of the level
+   below (nodes), see svg_rtree.c */
+typedef struct svg_rtree_node {
+    svg_bbox_t bbox;
+    int first;
+    int count;
+} svg_rtree_node_t;
+
+typedef struct svg_rtree {
+    svg_rtree_node_t *entry;
+    int num_entries;
+
+    /* children with an unbounded box */
+    int *always;
+    int num_always;
+
+    svg_rtree_node_t *node;
+    int num_nodes;
+    int num_leaves;
+} svg_rtree_t;
+
 struct svg_group {
     svg_element_t **element;
     int num_elements;
@@ -232,6 +261,10 @@ struct svg_group {
     svg_view_box_t view_box;
     svg_length_t x;
     svg_length_t y;
+
+    /* Built with the boxes for groups of at least
+       SVG_GROUP_INDEX_MIN_ELEMENTS children, NULL otherwise */
+    svg_rtree_t *index;
 };
 
 typedef struct svg_text {
@@ -264,12 +297,63 @@ typedef struct svg_rect_element {
     svg_length_t ry;
 } svg_rect_element_t;
 
+/* Premultiplied ARGB, reference counted: a render holds on to the
+   pixels it draws while another replaces them with more detailed
+   ones. */
+typedef struct svg_image_pixels {
+    char *data;
+    unsigned int width;
+    unsigned int height;
+
+    int ref_count;
+} svg_image_pixels_t;
+
+typedef enum svg_image_format {
+    SVG_IMAGE_FORMAT_PNG,
+    SVG_IMAGE_FORMAT_JPEG
+} svg_image_format_t;
+
+/* An image file shared through the image cache, see
+   svg_image_cache.c. The file is kept as it came and decoded on
+   demand, at no more than the resolution asked for: the pixels are
+   the most detailed decoded yet. */
+typedef struct svg_image_buffer {
+    svg_image_format_t format;
+    unsigned char *file_data;
+    size_t file_size;
+    unsigned int width;
+    unsigned int height;
+    /* every pixel is opaque, known from the header */
+    int opaque;
+
+    /* NULL until decoded */
+    svg_image_pixels_t *pixels;
+    /* of the first decoding, when it failed */
+    svg_status_t pixels_status;
+    /* a thread is decoding the pixels */
+    int decoding;
+
+    int ref_count;
+
+    /* bookkeeping of the cache */
+    int cached;
+    char *key;
+    size_t key_len;
+    unsigned long long hash;
+    size_t size;
+    struct svg_image_buffer *prev, *next;
+    struct svg_image_buffer *hash_next;
+} svg_image_buffer_t;
+
 typedef struct svg_image {
     char *url;
 
-    char *data;
-    unsigned int data_width;
-    unsigned int data_height;
+    /* set once the image was read */
+    svg_image_buffer_t *buffer;
+
+    /* set once a read was tried, so a failure isn't retried */
+    int read;
+    svg_status_t read_status;
 
     /* User-space position and size */
     svg_length_t x;
@@ -302,13 +386,36 @@ struct svg_element {
 
     svg_t *doc;
 
-    svg_transform_t transform;
-    svg_style_t style;
+    char *id;
+
+    /* NULL for the identity */
+    svg_transform_t *transform;
 
-    svg_element_type_t type;
+    /* Interned in doc->styles and shared with every element that
+       specifies the same properties: never modify it in place, build
+       a new style and _svg_element_set_style instead. */
+    svg_style_t *style;
 
-    char *id;
+    /* Index of the computed style in doc->styles, and the properties
+       of style that differ from the parent's computed style. -1 and
+       all bits outside the render tree (defs, patterns, symbols). */
+    uint64_t style_delta;
+    int style_id;
+
+    /* Computed when attributes are applied: 0 for a leaf whose
+       transform and style leave the inherited state alone, so that
+       rendering it needs no begin_element/end_element. */
+    int needs_state;
+
+    /* What the element draws, stroke included, in its parent's user
+       space. Unbounded when that depends on the engine (text, units
+       other than px) and outside the render tree. */
+    svg_bbox_t bbox;
+
+    svg_element_type_t type;
 
+    /* Only the member for type is allocated, see _svg_element_create.
+       Keep this last. */
     union {
 	svg_group_t group;
 	svg_path_t path;
@@ -372,6 +479,28 @@ struct svg {
     svg_parser_t parser;
 
     svg_render_engine_t *engine;
+
+    /* set when the document was loaded from svg_compile output */
+    const char *display_list;
+    size_t display_list_size;
+    char *display_list_copy;
+
+    /* state changes skipped by the last svg_render */
+    unsigned long elided_state_count;
+
+    /* path points dropped by svg_simplify_paths, all calls */
+    unsigned long simplified_point_count;
+
+    /* set by svg_prepare_shared: renders may run concurrently and
+       must not write to the document */
+    int shared;
+
+    /* interned element and computed styles, see _svg_style_intern */
+    svg_style_t **styles;
+    int num_styles;
+    int styles_size;
+    int *style_hash;
+    int style_hash_size;
 };
 
 extern svg_t* doc;
@@ -412,6 +541,32 @@ _svg_attribute_get_length (const char	**attributes,
 			   svg_length_t	*value,
 			   const char	*default_value);
 
+/* svg_bbox.c */
+
+void
+_svg_bbox_init_empty (svg_bbox_t *bbox);
+
+void
+_svg_bbox_init_unbounded (svg_bbox_t *bbox);
+
+int
+_svg_bbox_is_empty (const svg_bbox_t *bbox);
+
+int
+_svg_bbox_is_bounded (const svg_bbox_t *bbox);
+
+void
+_svg_bbox_add_point (svg_bbox_t *bbox, double x, double y);
+
+void
+_svg_bbox_union (svg_bbox_t *bbox, const svg_bbox_t *other);
+
+void
+_svg_bbox_grow (svg_bbox_t *bbox, double distance);
+
+void
+_svg_bbox_transform (svg_bbox_t *bbox, const svg_transform_t *transform);
+
 /* svg_color.c */
 
 svg_status_t
@@ -426,6 +581,19 @@ _svg_color_init_from_str (svg_color_t *color, const char *str);
 svg_status_t
 _svg_color_deinit (svg_color_t *color);
 
+/* svg_display_list.c */
+
+int
+_svg_display_list_is_compiled (const char *buf, size_t count);
+
+void
+_svg_display_list_get_size (svg_t *svg, svg_length_t *width, svg_length_t *height);
+
+svg_status_t
+_svg_display_list_render (svg_t			*svg,
+			  svg_render_engine_t	*engine,
+			  void			*closure);
+
 /* svg_element.c */
 
 svgint_status_t
@@ -472,6 +640,27 @@ _svg_element_parse_view_box (const char	*view_box_str,
 svg_status_t
 _svg_element_get_nearest_viewport (svg_element_t *element, svg_element_t **viewport);
 
+svg_status_t
+_svg_element_set_style (svg_element_t *element, const svg_style_t *style);
+
+svg_status_t
+_svg_element_resolve_style (svg_element_t *element, const svg_style_t *parent_style);
+
+svg_status_t
+_svg_element_update_bbox (svg_element_t *element);
+
+svg_status_t
+_svg_element_read_images (svg_element_t *element);
+
+svg_status_t
+_svg_element_simplify_paths (svg_element_t *element, double tolerance);
+
+svg_status_t
+_svg_element_render_region (svg_element_t		*element,
+			    svg_render_engine_t		*engine,
+			    void			*closure,
+			    const svg_bbox_t		*region);
+
 /* svg_gradient.c */
 
 svg_status_t
@@ -519,6 +708,15 @@ _svg_group_render (svg_group_t		*group,
 		   svg_render_engine_t	*engine,
 		   void			*closure);
 
+svg_status_t
+_svg_group_render_region (svg_group_t		*group,
+			  svg_render_engine_t	*engine,
+			  void			*closure,
+			  const svg_bbox_t	*region);
+
+svg_status_t
+_svg_group_update_index (svg_group_t *group);
+
 svg_status_t
 _svg_symbol_render (svg_element_t	*group,
 		    svg_render_engine_t	*engine,
@@ -555,11 +753,60 @@ svg_status_t
 _svg_image_apply_attributes (svg_image_t	*image,
 			     const char		**attributes);
 
+svg_status_t
+_svg_image_get_bbox (svg_image_t *image, svg_bbox_t *bbox);
+
 svg_status_t
 _svg_image_render (svg_image_t		*image,
 		   svg_render_engine_t	*engine,
 		   void			*closure);
 
+svg_status_t
+_svg_image_read_image (svg_image_t *image);
+
+svg_status_t
+_svg_image_read_pixels (svg_image_t		*image,
+			unsigned int		x_pixels,
+			unsigned int		y_pixels,
+			svg_image_pixels_t	**pixels);
+
+/* svg_image_cache.c */
+
+svg_image_buffer_t *
+_svg_image_cache_lookup (const char *key, size_t key_len);
+
+svg_image_buffer_t *
+_svg_image_cache_insert (const char		*key,
+			 size_t			key_len,
+			 svg_image_buffer_t	*buffer);
+
+svg_image_buffer_t *
+_svg_image_buffer_create (void);
+
+int
+_svg_image_buffer_get_pixels (svg_image_buffer_t	*buffer,
+			      unsigned int		x_pixels,
+			      unsigned int		y_pixels,
+			      svg_image_pixels_t	**pixels,
+			      svg_status_t		*status);
+
+void
+_svg_image_buffer_set_pixels (svg_image_buffer_t	*buffer,
+			      svg_image_pixels_t	*pixels,
+			      svg_status_t		status);
+
+svg_image_pixels_t *
+_svg_image_pixels_create (char *data, unsigned int width, unsigned int height);
+
+void
+_svg_image_pixels_destroy (svg_image_pixels_t *pixels);
+
+svg_image_buffer_t *
+_svg_image_buffer_reference (svg_image_buffer_t *buffer);
+
+void
+_svg_image_buffer_destroy (svg_image_buffer_t *buffer);
+
 /* svg_length.c */
 
 svg_status_t
@@ -574,6 +821,9 @@ _svg_length_init_unit (svg_length_t		*length,
 svg_status_t
 _svg_length_init_from_str (svg_length_t *length, const char *str);
 
+int
+_svg_length_is_user_unit (const svg_length_t *length);
+
 svg_status_t
 _svg_length_deinit (svg_length_t *length);
 
@@ -678,6 +928,24 @@ _svg_rect_render (svg_rect_element_t	*rect,
 		  svg_render_engine_t	*engine,
 		  void			*closure);
 
+svg_status_t
+_svg_path_get_bbox (svg_path_t *path, svg_bbox_t *bbox);
+
+svg_status_t
+_svg_path_simplify (svg_path_t *path, double tolerance, unsigned long *removed);
+
+svg_status_t
+_svg_circle_get_bbox (svg_ellipse_t *circle, svg_bbox_t *bbox);
+
+svg_status_t
+_svg_ellipse_get_bbox (svg_ellipse_t *ellipse, svg_bbox_t *bbox);
+
+svg_status_t
+_svg_line_get_bbox (svg_line_t *line, svg_bbox_t *bbox);
+
+svg_status_t
+_svg_rect_get_bbox (svg_rect_element_t *rect, svg_bbox_t *bbox);
+
 svg_status_t
 _svg_path_apply_attributes (svg_path_t		*path,
 			    const char		**attributes);
@@ -795,6 +1063,25 @@ _svg_pattern_render (svg_element_t		*pattern,
 		     svg_render_engine_t	*engine,
 		     void			*closure);
 
+/* svg_rtree.c */
+
+svg_status_t
+_svg_rtree_create (svg_rtree_t		**rtree,
+		   svg_element_t	**element,
+		   int			num_elements);
+
+void
+_svg_rtree_destroy (svg_rtree_t *rtree);
+
+svg_status_t
+_svg_rtree_search (svg_rtree_t		*rtree,
+		   const svg_bbox_t	*region,
+		   svg_render_engine_t	*engine,
+		   void			*closure,
+		   int			**hits,
+		   int			*num_hits,
+		   int			*hits_size);
+
 /* svg_str.c */
 
 void
@@ -828,9 +1115,21 @@ _svg_style_deinit (svg_style_t *style);
 
 svg_status_t
 _svg_style_render (svg_style_t		*style,
+		   uint64_t		mask,
 		   svg_render_engine_t	*engine,
 		   void			*closure);
 
+uint64_t
+_svg_style_resolve (svg_style_t		*computed,
+		    const svg_style_t	*parent,
+		    const svg_style_t	*specified);
+
+svg_status_t
+_svg_style_intern (svg_t *svg, const svg_style_t *style, int *style_id);
+
+void
+_svg_style_table_clear (svg_t *svg);
+
 svg_status_t
 _svg_style_apply_attributes (svg_style_t	*style, 
 			     const char		**attributes);
@@ -875,6 +1174,15 @@ _svg_text_apply_attributes (svg_text_t		*text,
 svg_status_t
 _svg_transform_init (svg_transform_t *transform);
 
+int
+_svg_transform_is_identity (const svg_transform_t *transform);
+
+svg_status_t
+_svg_transform_invert (svg_transform_t *transform);
+
+double
+_svg_transform_get_max_scale (const svg_transform_t *transform);
+
 svg_status_t
 _svg_transform_init_matrix (svg_transform_t *transform,
 			    double a, double b,